@@ -0,0 +1,226 @@
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+
+/*
+
+CPU绑定和NUMA：
+
+子进程fork出来以后由调度器随便放，双路的压测机上每次测出来的数都不一样，
+网卡中断也会和工作进程挤在同一个核上
+
+--cpus 0-3,8       第i个子进程绑定到列表中第i%n个核上，同样的参数每次放的位置都一样
+--irq-cpus 0,1     这些核留给网卡中断，不放工作进程；没有--cpus时从允许使用的所有核里去掉它们
+--numa             子进程的内存优先从它所在核的NUMA节点分配，
+                   包括epoll/uring工作进程在各个阶段的直方图、每个条目的统计和绑定之后分配的缓冲区，
+                   统计槽只有几百字节，和别的子进程共用页，不迁移
+
+和io_uring一样直接用系统调用，不依赖libnuma
+测试结束后报告每个子进程实际在哪个核、哪个节点上，方便原样重复一次测试
+
+*/
+
+#define MAX_CPUS 1024
+#define CPU_WORDS (MAX_CPUS/(8*sizeof(unsigned long)))
+#define MAX_NODES 1024
+#define NODE_WORDS (MAX_NODES/(8*sizeof(unsigned long)))
+
+struct cpuset
+{
+    unsigned long bits[CPU_WORDS];
+};
+
+char *cpus_arg=NULL;     //--cpus
+char *irq_cpus_arg=NULL; //--irq-cpus
+int numa=0;              //--numa
+int pinned=0;            //子进程是否绑定了核
+
+static int cpu_list[MAX_CPUS];//子进程依次绑定的核
+static int ncpu_list=0;
+
+static void cpuset_add(struct cpuset *s,int cpu)
+{
+    s->bits[cpu/(8*sizeof(unsigned long))]|=1UL<<(cpu%(8*sizeof(unsigned long)));
+}
+
+static int cpuset_has(const struct cpuset *s,int cpu)
+{
+    return (s->bits[cpu/(8*sizeof(unsigned long))]>>(cpu%(8*sizeof(unsigned long))))&1;
+}
+
+//解析 0-3,8,10-11 这样的核列表，格式错误返回-1
+static int cpuset_parse(const char *str,struct cpuset *s)
+{
+    char *end;
+    long a,b;
+
+    memset(s,0,sizeof(*s));
+    while(*str)
+    {
+        a=strtol(str,&end,10);
+        if(end==str)
+            return -1;
+        b=a;
+        if(*end=='-')
+        {
+            str=end+1;
+            b=strtol(str,&end,10);
+            if(end==str)
+                return -1;
+        }
+        if(a<0 || b<a || b>=MAX_CPUS)
+            return -1;
+        for(; a<=b; a++)
+            cpuset_add(s,a);
+
+        if(*end==',')
+            end++;
+        else if(*end!='\0')
+            return -1;
+        str=end;
+    }
+    return 0;
+}
+
+/*
+根据--cpus和--irq-cpus算出子进程要绑定的核，只能用本进程允许使用的核
+没有给这两个选项时返回0，什么都不做
+*/
+static int affinity_setup(void)
+{
+    struct cpuset allowed,cpus,irq;
+    int i;
+
+    if(cpus_arg==NULL && irq_cpus_arg==NULL)
+        return 0;
+
+    memset(&allowed,0,sizeof(allowed));
+    if(syscall(__NR_sched_getaffinity,0,sizeof(allowed.bits),allowed.bits)<0)
+    {
+        perror(" Failed to get CPU affinity ");
+        return 3;
+    }
+
+    if(cpus_arg!=NULL && cpuset_parse(cpus_arg,&cpus))
+    {
+        fprintf(stderr,"Option parameter error,Illegal CPU list %s\n",cpus_arg);
+        return 2;
+    }
+    if(cpus_arg==NULL)
+        cpus=allowed;
+
+    memset(&irq,0,sizeof(irq));
+    if(irq_cpus_arg!=NULL && cpuset_parse(irq_cpus_arg,&irq))
+    {
+        fprintf(stderr,"Option parameter error,Illegal CPU list %s\n",irq_cpus_arg);
+        return 2;
+    }
+
+    for(i=0; i<MAX_CPUS; i++)
+    {
+        if(!cpuset_has(&cpus,i) || cpuset_has(&irq,i))
+            continue;
+        if(!cpuset_has(&allowed,i))
+        {
+            fprintf(stderr,"Option parameter error,CPU %d is offline or not allowed\n",i);
+            return 2;
+        }
+        cpu_list[ncpu_list++]=i;
+    }
+
+    if(ncpu_list==0)
+    {
+        fprintf(stderr,"Option parameter error,No CPU left for the workers\n");
+        return 2;
+    }
+
+    pinned=1;
+    return 0;
+}
+
+//让[p,p+len)中完整的页优先放在nodes指定的节点上，已经分配的页也迁移过去
+//和相邻槽位共用的首尾两页不动
+static void numa_bind(void *p,size_t len,const unsigned long *nodes)
+{
+    uintptr_t page=sysconf(_SC_PAGESIZE);
+    uintptr_t a=((uintptr_t)p+page-1)&~(page-1);
+    uintptr_t b=((uintptr_t)p+len)&~(page-1);
+
+    if(b>a)
+        syscall(__NR_mbind,a,b-a,MPOL_PREFERRED,nodes,MAX_NODES,MPOL_MF_MOVE);
+}
+
+/*
+子进程把自己绑定到第id个核上，记下实际所在的核和节点
+--numa时之后的内存分配都优先用本节点，直方图和条目统计也迁过来
+*/
+static void affinity_apply(int id)
+{
+    struct cpuset set;
+    unsigned long nodes[NODE_WORDS];
+    unsigned cpu,node;
+    int s;
+
+    if(!pinned)
+        return;
+
+    memset(&set,0,sizeof(set));
+    cpuset_add(&set,cpu_list[id%ncpu_list]);
+
+    //绑定之后内核马上把本进程迁到那个核上
+    if(syscall(__NR_sched_setaffinity,0,sizeof(set.bits),set.bits)<0)
+    {
+        perror(" Failed to set CPU affinity ");
+        exit(3);
+    }
+
+    if(syscall(__NR_getcpu,&cpu,&node,NULL)<0)
+    {
+        cpu=cpu_list[id%ncpu_list];
+        node=0;
+    }
+    st->cpu=cpu;
+    st->node=node;
+
+    if(!numa)
+        return;
+
+    memset(nodes,0,sizeof(nodes));
+    nodes[node/(8*sizeof(unsigned long))]|=1UL<<(node%(8*sizeof(unsigned long)));
+
+    //没有NUMA的机器上这些调用失败也没有关系
+    //每个阶段的都要迁过来，写得最多的是直方图，一组约125KB
+    //fork引擎的直方图几个子进程共用一组，子进程自己的那份在绑定之后才写，本来就在本节点
+    syscall(__NR_set_mempolicy,MPOL_PREFERRED,nodes,MAX_NODES);
+    for(s=0; s<nstages; s++)
+    {
+        if(engine!=ENGINE_FORK)
+            numa_bind(&hist_slots[s*nhists+id],sizeof(struct hists),nodes);
+        numa_bind(&entry_slots[(s*nprocs+id)*nentries],sizeof(struct entry_stats)*nentries,nodes);
+    }
+}
+
+//每个核上放了哪些子进程
+static void affinity_print(int n)
+{
+    int i,k,c;
+
+    if(!pinned)
+        return;
+
+    printf("Worker placement:\n");
+    for(k=0; k<ncpu_list && k<n; k++)
+    {
+        c=cpu_list[k];
+        printf("cpu %3d node %d:",c,slots[k].node);
+        for(i=k; i<n; i+=ncpu_list)
+        {
+            //子进程实际所在的核和计划的不同时标出来
+            if(slots[i].cpu!=c)
+                printf(" %d(cpu %d)",i,slots[i].cpu);
+            else
+                printf(" %d",i);
+        }
+        printf("\n");
+    }
+}
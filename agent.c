@@ -0,0 +1,614 @@
+/*
+
+分布式测试：
+
+一台压测机的网卡和CPU喂不饱大的集群时，用多台机器一起压：
+
+    webbench --agent 0.0.0.0:9000 --agent-token S              每台压测机上启动代理，等协调者连接
+    webbench --agents 10.0.0.1:9000,10.0.0.2:9000 --agent-token S -c 2000 URL  协调者，参数和单机测试一样
+
+协调者把自己的命令行(去掉--agents)发给每个代理，-c和--rate按代理个数平分，
+和一台机器上把客户端分给多个工作进程一样，除不尽的余数分给前面的代理
+代理用这个命令行从头解析参数、构造请求、检查目标服务器，准备好了告诉协调者
+所有代理都准备好后协调者同时发出开始信号，信号里是多少微秒后开始，
+各台机器的时钟不需要对齐，只差信号在网络上的时间
+测试结束后代理把每个阶段汇总好的计数器、直方图、每个条目的结果和时间序列发回来
+
+协调者把每个代理当作一个统计槽和一组直方图，和单机测试一样汇总：
+直方图按桶相加之后再算百分位数，而不是把各台机器的百分位数平均，
+所以合并后的p99就是所有请求的p99
+
+代理会用别人发来的命令行发起测试，所以：
+只给端口时只监听回环地址，要让别的机器连上必须写明地址，这时还必须有口令
+协调者的第一条消息里带着口令(--agent-token，或者环境变量WEBBENCH_AGENT_TOKEN，不会出现在ps里)，
+和代理的不一样时直接断开
+命令行里不能有--serve、--agent、--agents、--agent-dir，
+--workload和--body的文件按同样的路径在代理上读取，但只能在--agent-dir目录(默认是代理的当前目录)里面
+结构体按内存里的样子直接发送，代理和协调者要用同一个版本、同一种体系结构编译的webbench，
+消息头里带着版本号和struct stats、struct hists的大小，对不上时拒绝
+
+*/
+
+#define AGENT_MAGIC 0x57424147  //"WBAG"
+#define AGENT_VERSION 2
+#define MAX_AGENTS 64
+#define AGENT_CONFIG_MAX (256*1024)  //核对口令之前最多收这么多字节的命令行
+#define AGENT_CONFIG_TIMEOUT 10      //连上后多少秒内必须发来命令行
+#define AGENT_RESULT_MAX (1ULL<<30)
+
+//消息类型
+#define MSG_CONFIG 1  //协调者->代理：口令和命令行参数，以'\0'分隔
+#define MSG_READY  2  //代理->协调者：准备好了，带struct agent_ready
+#define MSG_START  3  //协调者->代理：多少微秒后开始，long long
+#define MSG_RESULT 4  //代理->协调者：测试结果
+
+struct agent_msg
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int type;
+    unsigned int size;        //struct stats和struct hists的大小
+    unsigned long long len;   //后面数据的字节数
+};
+
+//代理准备好时告诉协调者的参数，两边的阶段和条目必须一样才能合并
+struct agent_ready
+{
+    int nstages;
+    int nentries;
+    int nprocs;
+};
+
+int agent_port=0;       //--agent 代理监听的端口
+int agent_fd=-1;        //代理和协调者之间的连接
+char *agents_arg=NULL;  //--agents 代理的地址列表
+char *agent_token=NULL; //--agent-token 协调者和代理共用的口令
+char *agent_dir=NULL;   //--agent-dir 代理上允许读取--workload和--body文件的目录
+
+static struct addr agent_listen;//--agent 代理监听的地址，默认只监听回环地址
+
+static struct addr agent_addrs[MAX_AGENTS];
+static char agent_names[MAX_AGENTS][64];
+static int agent_fds[MAX_AGENTS];
+int nagents=0;
+
+//写完len个字节，对端关闭时不要被SIGPIPE杀掉，成功返回0
+static int send_all(int fd,const void *buf,size_t len)
+{
+    const char *p=buf;
+    ssize_t n;
+
+    while(len>0)
+    {
+        n=send(fd,p,len,MSG_NOSIGNAL);
+        if(n<0 && errno==EINTR)
+            continue;
+        if(n<=0)
+            return -1;
+        p+=n;
+        len-=n;
+    }
+    return 0;
+}
+
+//读满len个字节，对端关闭或者出错返回-1
+static int recv_all(int fd,void *buf,size_t len)
+{
+    char *p=buf;
+    ssize_t n;
+
+    while(len>0)
+    {
+        n=recv(fd,p,len,0);
+        if(n<0 && errno==EINTR)
+            continue;
+        if(n<=0)
+            return -1;
+        p+=n;
+        len-=n;
+    }
+    return 0;
+}
+
+//发送一条消息，成功返回0
+static int agent_send(int fd,int type,const void *data,size_t len)
+{
+    struct agent_msg m;
+
+    m.magic=AGENT_MAGIC;
+    m.version=AGENT_VERSION;
+    m.type=type;
+    m.size=sizeof(struct stats)+sizeof(struct hists);
+    m.len=len;
+    if(send_all(fd,&m,sizeof(m)))
+        return -1;
+    return send_all(fd,data,len);
+}
+
+//接收一条type类型、不超过max字节的消息，返回malloc的数据，长度放在*len里，出错返回NULL
+static void *agent_recv(int fd,int type,unsigned long long max,size_t *len)
+{
+    struct agent_msg m;
+    void *p;
+
+    if(recv_all(fd,&m,sizeof(m)))
+        return NULL;
+    if(m.magic!=AGENT_MAGIC || m.version!=AGENT_VERSION || m.size!=sizeof(struct stats)+sizeof(struct hists))
+    {
+        fprintf(stderr,"Agent protocol mismatch,both sides must run the same webbench build\n");
+        return NULL;
+    }
+    if((int)m.type!=type || m.len>max)
+        return NULL;
+
+    //长度为0时也返回一块内存，和出错区分开
+    p=malloc(m.len+1);
+    if(p==NULL || recv_all(fd,p,m.len))
+    {
+        free(p);
+        return NULL;
+    }
+    *len=m.len;
+    return p;
+}
+
+//口令，没有--agent-token时取环境变量，都没有时是空串
+static const char *agent_secret(void)
+{
+    if(agent_token==NULL)
+        agent_token=getenv("WEBBENCH_AGENT_TOKEN");
+    return agent_token==NULL?"":agent_token;
+}
+
+//比较口令，花的时间只和长度有关，不会泄露前面有几个字符对上了
+static int token_equal(const char *a,const char *b)
+{
+    size_t i,n=strlen(a);
+    unsigned char d=0;
+
+    if(strlen(b)!=n)
+        return 0;
+    for(i=0; i<n; i++)
+        d|=a[i]^b[i];
+    return d==0;
+}
+
+//监听的地址是不是回环地址
+static int addr_loopback(const struct addr *a)
+{
+    const struct sockaddr_in6 *a6=(const struct sockaddr_in6 *)&a->sa;
+
+    if(a->sa.ss_family==AF_INET)
+        return (ntohl(((const struct sockaddr_in *)&a->sa)->sin_addr.s_addr)>>24)==127;
+    if(IN6_IS_ADDR_V4MAPPED(&a6->sin6_addr))
+        return a6->sin6_addr.s6_addr[12]==127;
+    return IN6_IS_ADDR_LOOPBACK(&a6->sin6_addr);
+}
+
+//代理收到的--workload和--body的文件必须在agent_dir里面，不在时报错返回-1
+static int agent_path_check(const char *opt,const char *path)
+{
+    char *real;
+    size_t n=strlen(agent_dir);
+    int ok;
+
+    real=realpath(path,NULL);
+    ok=real!=NULL && strncmp(real,agent_dir,n)==0 &&
+       (real[n]=='/' || real[n]=='\0' || (n>0 && agent_dir[n-1]=='/'));
+    free(real);
+    if(!ok)
+    {
+        fprintf(stderr,"Option parameter error,%s %s is not inside the agent directory %s\n",opt,path,agent_dir);
+        return -1;
+    }
+    return 0;
+}
+
+//代理收到的命令行里不能有的选项
+static int agent_forbid(const char *opt)
+{
+    fprintf(stderr,"Option parameter error,%s is not allowed in a test sent to an agent\n",opt);
+    return 2;
+}
+
+//解析host:port或者[IPv6]:port，只有端口时主机用defhost，defhost为NULL时必须有主机
+//成功返回端口，格式错误返回-1
+static int hostport_parse(char *item,const char *defhost,struct addr *a)
+{
+    const char *host;
+    char *port;
+
+    host=item;
+    if(item[0]=='[')
+    {
+        port=strchr(item,']');
+        if(port==NULL || port[1]!=':')
+            return -1;
+        *port='\0';
+        host=item+1;
+        port+=2;
+    }
+    else
+    {
+        port=strrchr(item,':');
+        if(port==NULL && defhost==NULL)
+            return -1;
+        if(port==NULL)
+        {
+            host=defhost;
+            port=item;
+        }
+        else
+            *port++='\0';
+    }
+
+    if(atoi(port)<=0 || atoi(port)>65535 || Resolve(host,atoi(port),a,1)<0)
+        return -1;
+    return atoi(port);
+}
+
+//解析--agent的监听地址，只给端口时只监听回环地址，格式错误返回-1
+static int agent_parse(char *arg)
+{
+    agent_port=hostport_parse(arg,"127.0.0.1",&agent_listen);
+    return agent_port>0?0:-1;
+}
+
+/*
+代理：在--agent的地址上等协调者连接
+先核对口令，再
+每次测试fork一个子进程，子进程用协调者发来的命令行重新走一遍main()，
+参数、请求和统计都是全新的，测试结束后子进程退出，代理接着等下一次
+一次只做一个测试，同一台机器上同时跑两个测试结果没有意义
+*/
+static int agent_serve(void)
+{
+    char *args,*p,**argv,name[64];
+    struct timeval tv;
+    size_t len;
+    int ls,c,argc,i;
+    pid_t pid;
+
+    AddrString(&agent_listen,name,sizeof(name));
+    if(agent_secret()[0]=='\0' && !addr_loopback(&agent_listen))
+    {
+        fprintf(stderr,"Option parameter error,an agent listening on %s needs --agent-token\n",name);
+        return 2;
+    }
+
+    //以后收到的文件路径都和解析过符号链接的绝对路径比较
+    agent_dir=realpath(agent_dir==NULL?".":agent_dir,NULL);
+    if(agent_dir==NULL)
+    {
+        perror(" Failed to open the agent directory ");
+        return 2;
+    }
+
+    ls=SocketListenAddr(&agent_listen);
+    if(ls<0)
+    {
+        perror(" Failed to listen for the coordinator ");
+        return 3;
+    }
+    printf("Agent listening on %s,files from %s\n",name,agent_dir);
+    fflush(stdout);
+
+    while(1)
+    {
+        c=accept(ls,NULL,NULL);
+        if(c<0)
+        {
+            if(errno==EINTR)
+                continue;
+            perror(" accept failed ");
+            return 3;
+        }
+
+        //还没核对口令的连接：不发数据的不能一直占着代理，长度也不能随便报
+        tv.tv_sec=AGENT_CONFIG_TIMEOUT;
+        tv.tv_usec=0;
+        setsockopt(c,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+        args=agent_recv(c,MSG_CONFIG,AGENT_CONFIG_MAX,&len);
+        if(args==NULL)
+        {
+            fprintf(stderr,"Agent dropped a coordinator that sent no valid test\n");
+            close(c);
+            continue;
+        }
+
+        //先是口令，然后是参数，都以'\0'分隔，最后一个参数后面也有'\0'
+        args[len]='\0';
+        if(!token_equal(args,agent_secret()))
+        {
+            fprintf(stderr,"Agent rejected a coordinator with a wrong token\n");
+            free(args);
+            close(c);
+            continue;
+        }
+
+        //协调者要等所有代理都准备好才发开始信号，之后的消息不限时
+        tv.tv_sec=0;
+        setsockopt(c,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+        for(argc=0,p=args+strlen(args)+1; p<args+len; p+=strlen(p)+1)
+            argc++;
+        argv=calloc(argc+1,sizeof(char *));
+        if(argv==NULL)
+            exit(3);
+        for(i=0,p=args+strlen(args)+1; i<argc; p+=strlen(p)+1)
+            argv[i++]=p;
+
+        fflush(stdout);
+        pid=fork();
+        if(pid==0)
+        {
+            //getopt_long的optind设为0才会完全重新开始解析
+            close(ls);
+            agent_port=0;
+            agent_fd=c;
+            optind=0;
+            exit(main(argc,argv));
+        }
+        if(pid<0)
+            perror(" Failed to create subprocesses ");
+
+        close(c);
+        free(argv);
+        free(args);
+        while(pid>0 && waitpid(pid,NULL,0)<0 && errno==EINTR)
+            ;
+        printf("Agent waiting for the next test\n");
+        fflush(stdout);
+    }
+}
+
+//代理：测试准备好了，告诉协调者并等它的开始信号，返回多少微秒后开始，出错返回-1
+static long long agent_ready(void)
+{
+    struct agent_ready r;
+    long long *delay,d=-1;
+    size_t len;
+
+    r.nstages=nstages;
+    r.nentries=nentries;
+    r.nprocs=nprocs;
+    if(agent_send(agent_fd,MSG_READY,&r,sizeof(r)))
+        return -1;
+
+    delay=agent_recv(agent_fd,MSG_START,sizeof(*delay),&len);
+    if(delay!=NULL && len==sizeof(*delay))
+        d=*delay;
+    free(delay);
+    return d;
+}
+
+//代理：把每个阶段汇总好的结果发给协调者
+//依次是时间序列的长度、每个阶段的struct stats和struct hists、每个阶段每个条目的结果、时间序列
+static int agent_result(void)
+{
+    char *buf,*p;
+    size_t len;
+    int s,e,ret;
+
+    len=sizeof(int)+(sizeof(struct stats)+sizeof(struct hists))*nstages+
+        sizeof(struct entry_stats)*nstages*nentries+sizeof(struct sample)*nseries;
+    buf=malloc(len);
+    if(buf==NULL)
+        return -1;
+
+    p=buf;
+    memcpy(p,&nseries,sizeof(int));
+    p+=sizeof(int);
+    for(s=0; s<nstages; s++,p+=sizeof(struct stats)+sizeof(struct hists))
+    {
+        stats_sum((struct stats *)p,slots+s*nprocs,nprocs);
+        hists_sum((struct hists *)(p+sizeof(struct stats)),hist_slots+s*nhists,nhists);
+    }
+    for(s=0; s<nstages; s++)
+        for(e=0; e<nentries; e++,p+=sizeof(struct entry_stats))
+            workload_sum((struct entry_stats *)p,e,s*nprocs,nprocs);
+    if(nseries>0)
+        memcpy(p,series,sizeof(struct sample)*nseries);
+
+    ret=agent_send(agent_fd,MSG_RESULT,buf,len);
+    free(buf);
+    return ret;
+}
+
+//解析--agents的地址列表，host:port或者[IPv6]:port，用逗号分隔，格式错误返回-1
+static int agents_parse(char *list)
+{
+    char *item;
+
+    for(item=strtok(list,","); item!=NULL; item=strtok(NULL,","))
+    {
+        if(nagents>=MAX_AGENTS || hostport_parse(item,NULL,&agent_addrs[nagents])<0)
+            return -1;
+        AddrString(&agent_addrs[nagents],agent_names[nagents],sizeof(agent_names[nagents]));
+        nagents++;
+    }
+
+    return nagents>0?0:-1;
+}
+
+//发给第k个代理的消息：口令，然后是协调者的命令行去掉--agents和--agent-token，最后加上它分到的-c和--rate
+static char *agent_args(int k,int argc,char *argv[],size_t *len)
+{
+    char extra[96],*buf,*p;
+    const char *token=agent_secret();
+    size_t size;
+    int i,n;
+
+    n=clients/nagents+(k<clients%nagents);
+    if(rate>0)
+        n=snprintf(extra,sizeof(extra),"-c%c%d%c--rate%c%.17g",0,n,0,0,rate/nagents);
+    else
+        n=snprintf(extra,sizeof(extra),"-c%c%d",0,n);
+
+    size=strlen(token)+1+sizeof("webbench")+n+1;
+    for(i=1; i<argc; i++)
+        size+=strlen(argv[i])+1;
+    buf=malloc(size);
+    if(buf==NULL)
+        return NULL;
+
+    p=buf;
+    strcpy(p,token);
+    p+=strlen(p)+1;
+    memcpy(p,"webbench",sizeof("webbench"));
+    p+=sizeof("webbench");
+    for(i=1; i<argc; i++)
+    {
+        if(strcmp(argv[i],"--agents")==0 || strcmp(argv[i],"--agent-token")==0)
+        {
+            i++;
+            continue;
+        }
+        if(strncmp(argv[i],"--agents=",9)==0 || strncmp(argv[i],"--agent-token=",14)==0)
+            continue;
+        strcpy(p,argv[i]);
+        p+=strlen(p)+1;
+    }
+    memcpy(p,extra,n+1);
+    p+=n+1;
+
+    *len=p-buf;
+    return buf;
+}
+
+//协调者：读回第k个代理的结果，放到第k个统计槽里，格式不对返回-1
+static int agent_collect(int k)
+{
+    char *buf,*p;
+    size_t len,want;
+    int n,s,i;
+
+    buf=agent_recv(agent_fds[k],MSG_RESULT,AGENT_RESULT_MAX,&len);
+    if(buf==NULL || len<sizeof(int))
+    {
+        free(buf);
+        return -1;
+    }
+
+    memcpy(&n,buf,sizeof(int));
+    want=sizeof(int)+(sizeof(struct stats)+sizeof(struct hists))*nstages+
+         sizeof(struct entry_stats)*nstages*nentries+sizeof(struct sample)*(size_t)n;
+    if(n<0 || n>runtime || len!=want)
+    {
+        free(buf);
+        return -1;
+    }
+
+    p=buf+sizeof(int);
+    for(s=0; s<nstages; s++,p+=sizeof(struct stats)+sizeof(struct hists))
+    {
+        memcpy(&slots[s*nagents+k],p,sizeof(struct stats));
+        memcpy(&hist_slots[s*nagents+k],p+sizeof(struct stats),sizeof(struct hists));
+    }
+    for(s=0; s<nstages; s++,p+=sizeof(struct entry_stats)*nentries)
+        memcpy(&entry_slots[(s*nagents+k)*nentries],p,sizeof(struct entry_stats)*nentries);
+
+    //各台机器同一秒的采样相加
+    for(i=0; i<n && series!=NULL; i++,p+=sizeof(struct sample))
+    {
+        series[i].requests+=((struct sample *)p)->requests;
+        series[i].bytes+=((struct sample *)p)->bytes;
+        series[i].errors+=((struct sample *)p)->errors;
+        series[i].stage=((struct sample *)p)->stage;
+    }
+    if(n>nseries)
+        nseries=n;
+
+    free(buf);
+    return 0;
+}
+
+/*
+协调者：把命令行发给所有代理，等它们都准备好后同时开始，
+收回结果后每个代理当作一个统计槽，和单机测试一样汇总、输出
+*/
+static int coordinate(int argc,char *argv[])
+{
+    struct agent_ready *r;
+    long long delay=1000000;//开始信号发出1秒后开始，足够信号传到所有代理
+    char *args;
+    size_t len;
+    int k,lost=0;
+
+    st=&total;
+    for(k=0; k<nagents; k++)
+    {
+        agent_fds[k]=SocketAddr(&agent_addrs[k]);
+        if(agent_fds[k]<0)
+        {
+            fprintf(stderr,"\n Connection to agent %s failed, interrupt test \n",agent_names[k]);
+            return 3;
+        }
+
+        args=agent_args(k,argc,argv,&len);
+        if(args==NULL || agent_send(agent_fds[k],MSG_CONFIG,args,len))
+        {
+            fprintf(stderr,"\n Failed to send the test to agent %s, interrupt test \n",agent_names[k]);
+            return 3;
+        }
+        free(args);
+    }
+
+    //代理要解析目标地址、试连一次，出错时直接关闭连接
+    for(k=0; k<nagents; k++)
+    {
+        r=agent_recv(agent_fds[k],MSG_READY,sizeof(*r),&len);
+        if(r==NULL || len!=sizeof(*r))
+        {
+            fprintf(stderr,"\n Agent %s failed to start the test, see its output, interrupt test \n",agent_names[k]);
+            return 3;
+        }
+        if(r->nstages!=nstages || r->nentries!=nentries)
+        {
+            fprintf(stderr,"\n Agent %s built a different test, interrupt test \n",agent_names[k]);
+            return 3;
+        }
+        printf("Agent %s ready with %d processes\n",agent_names[k],r->nprocs);
+        free(r);
+    }
+
+    //所有代理在同一时刻开始
+    for(k=0; k<nagents; k++)
+        if(agent_send(agent_fds[k],MSG_START,&delay,sizeof(delay)))
+        {
+            fprintf(stderr,"\n Lost agent %s before the start, interrupt test \n",agent_names[k]);
+            return 3;
+        }
+    bench_start=now_us()+delay;
+    printf("%d agents start in %lld ms,results in %d s\n",nagents,delay/1000,runtime);
+    fflush(stdout);
+
+    //每个代理一个统计槽和一组直方图
+    nprocs=nagents;
+    nhists=nagents;
+    slots=stats_alloc(nstages*nagents);
+    hist_slots=hists_alloc(nstages*nagents);
+    entry_slots=calloc((size_t)nstages*nagents*nentries,sizeof(struct entry_stats));
+    series=calloc(runtime,sizeof(struct sample));
+    if(slots==NULL || hist_slots==NULL || entry_slots==NULL)
+    {
+        perror(" Failed to allocate statistics ");
+        return 3;
+    }
+
+    //中途失去联系的代理，结果不算在内
+    for(k=0; k<nagents; k++)
+    {
+        if(agent_collect(k))
+        {
+            fprintf(stderr,"Lost agent %s, its results are missing\n",agent_names[k]);
+            lost++;
+        }
+        close(agent_fds[k]);
+    }
+    if(lost==nagents)
+        return 3;
+
+    stats_sum(&total,slots+first_stage*nprocs,(nstages-first_stage)*nprocs);
+    hists_sum(&hist_total,hist_slots+first_stage*nhists,(nstages-first_stage)*nhists);
+    return report();
+}
@@ -0,0 +1,814 @@
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+/*
+
+事件驱动引擎：
+
+benchcore()中每个客户端是一个独立的进程，阻塞地完成
+连接->发送->读取->关闭
+客户端数量上千之后，内存和进程切换的开销会超过压测本身
+
+epollcore()让一个工作进程同时驱动成千上万个非阻塞连接：
+每个连接是一个小小的状态机，由epoll通知哪个连接可以继续往下走
+
+    CONN_CONNECTING  非阻塞connect已发出，等待可写事件得知连接结果
+    CONN_HANDSHAKE   https://时连上之后的TLS握手，按OpenSSL的要求等可读或可写
+    CONN_WRITING     发送请求报文，可能需要多次才能发完
+    CONN_READING     读取服务器回复直到对端关闭连接
+                     长连接时读到一个完整的回复就回到CONN_WRITING
+    CONN_H2          --h2c时连上之后一直处于这个状态，请求和回复是连接上的多个流
+
+一个请求结束(成功或失败)后，这个连接槽位立刻发起下一次连接
+统计的计数器和失败原因与benchcore()完全一致
+
+期限：connect的超时、--timeout和--idle-timeout都是连接上的一个定时器，挂在定时器轮上(timer.c)，
+连接进入新的阶段时改期限，每轮循环取出到期的处理，epoll_wait最多等到下一个可能到期的时刻
+测试结束的时间也是epoll_wait等待的上限，不用闹钟信号
+
+开环模式(--rate)下请求不是一结束就发下一个，而是按计划时间发出：
+结束了的槽位排到空闲队列的末尾(长连接时连接保持打开，处于CONN_IDLE)
+到了计划时间就从空闲队列的头上取一个槽位发出请求，所有槽位轮流使用，
+长连接时-c个连接都会建立起来并一直开着，可以用很低的速率保持上百万个空闲的连接
+没有空闲槽位时请求只能推迟，推迟的时间会算进延迟里
+
+负载曲线(--ramp/--steps)：闭环模式下只有前nactive个槽位工作，
+其余的槽位在要发下一个请求时关掉连接停下来(parked)，轮到它们时再发起连接
+
+struct conn只放连接一直要用的状态，回复的解析状态和模板的缓冲区用到时才从池里取(slab.c)
+
+*/
+
+#define CONN_CONNECTING 0
+#define CONN_WRITING    1
+#define CONN_READING    2
+#define CONN_IDLE       3  //开环模式下长连接在等待下一个计划时间
+#define CONN_HANDSHAKE  5  //TLS握手，4是uring引擎的CONN_CLOSING
+#define CONN_H2         6  //--h2c的连接，读写都交给h2.c，一个连接上同时有多个请求
+
+//一次epoll_wait最多取回的事件数
+#define MAX_EVENTS 256
+
+//一个模拟客户端的连接状态，每个槽位一份，上百万个连接时每个字节都要算
+struct conn
+{
+    int fd;     //当前连接的socket，-1表示没有连接
+    unsigned char state;  //连接所处的阶段
+    unsigned char first;  //还没有收到回复的第一个字节
+    unsigned char discard;//uring引擎正在进行的读取是在内核里丢掉正文(--drain)
+    unsigned char parked; //负载曲线上还没轮到，没有连接也不在空闲队列里
+    int events; //当前在epoll中关注的事件
+    int sent;   //请求报文已经发送的字节数
+    int inflight;//流水线上还没有收到回复的请求数
+    int entry;  //当前请求是workload中的第几个条目
+    long long start;//当前请求(流水线时是这一批请求)开始的时间
+    long long phase;//当前阶段(连接、等第一个字节、传输)开始的时间
+    struct tls_conn *tls;//https://时连接的TLS状态
+    struct h2_conn *h2;  //--h2c时连接的HTTP/2状态，第一次连上时分配，重连时重新初始化
+    struct http_resp *resp;//解析回复，长连接时靠它找到回复的结尾，有请求在进行时才从池里取
+    struct timer timer;  //当前阶段的期限
+    struct request_msg msg;//正在发送的请求报文，head为NULL表示没有在发送
+};
+
+//所有连接共用的读缓冲区，读到的内容解析完就丢弃，只统计字节数
+//平时每次读16K，--drain时用满整个缓冲区
+//16K正好装下一个TLS记录，SSL_read不会把解密好的数据留在OpenSSL里而epoll却不再通知
+#define EPOLL_READ_SIZE 16384
+static char epoll_buf[DRAIN_BUF_SIZE];
+
+//发送时组装报头和正文用
+static struct iovec *epoll_iov;
+
+//回复的解析状态和有模板时渲染请求报文的缓冲区(tmpl_size字节)的池
+static struct slab resp_slab;
+static struct slab tbuf_slab;
+
+//没能建立连接的槽位，不会再收到任何事件，由主循环重新发起连接
+//开环模式下是等待发出下一个请求的空闲槽位
+//先进先出的环，从idle_head开始的nidle个，每个槽位最多在里面一次
+static struct conn **idle;
+static int nidle=0,idle_head=0,idle_size=0;
+
+//本进程的所有槽位，闭环模式下前nactive个在工作
+static struct conn *conns_base;
+static int nactive=0;
+
+//定时器所在的连接
+#define timer_conn(t) ((struct conn *)((char *)(t)-offsetof(struct conn,timer)))
+
+//槽位排到空闲队列的末尾，请求已经结束了，回复的解析状态还回池里
+static void idle_push(struct conn *c)
+{
+    slab_free(&resp_slab,c->resp);
+    c->resp=NULL;
+    idle[(idle_head+nidle++)%idle_size]=c;
+}
+
+//从空闲队列的头上取一个槽位
+static struct conn *idle_pop(void)
+{
+    struct conn *c=idle[idle_head];
+
+    idle_head=(idle_head+1)%idle_size;
+    nidle--;
+    return c;
+}
+
+//开始解析回复，要用时才从池里取解析状态
+static void conn_resp(struct conn *c,int head)
+{
+    if(c->resp==NULL)
+        c->resp=slab_alloc(&resp_slab);
+    http_resp_init(c->resp,head);
+}
+
+//准备发送一个新的请求，有变量时从池里取一个缓冲区渲染
+static void conn_prepare(struct conn *c)
+{
+    request_prepare(c->entry,entries[c->entry].tmpl>=0?slab_alloc(&tbuf_slab):NULL,&c->msg);
+}
+
+//请求报文发完了或者连接关了，渲染用的缓冲区还回池里
+static void conn_sent(struct conn *c)
+{
+    if(c->msg.head!=NULL && entries[c->entry].tmpl>=0)
+        slab_free(&tbuf_slab,(char *)c->msg.head);
+    c->msg.head=NULL;
+}
+
+//连接进入新的阶段，ms毫秒之后到期，ms为0表示这个阶段没有期限
+static void conn_deadline(struct conn *c,int ms)
+{
+    if(ms>0)
+        timer_add(&wheel,&c->timer,now_us()+ms*1000LL);
+    else
+        timer_del(&wheel,&c->timer);
+}
+
+//HTTP/2连接的收发缓冲区还回池里
+static void h2_release(struct h2_conn *h);
+
+//关闭连接，https://时先释放TLS状态，返回close的结果
+static int conn_close(struct conn *c)
+{
+    int r;
+
+    tls_free(c->tls);
+    c->tls=NULL;
+    if(c->h2!=NULL)
+        h2_release(c->h2);
+    conn_sent(c);
+    timer_del(&wheel,&c->timer);
+    r=SYSCALL(close(c->fd));
+    c->fd=-1;
+    conns_open--;
+    return r;
+}
+
+//关闭连接并统计一次成功的请求
+static void conn_finish(struct conn *c)
+{
+    //套接字关闭失败
+    if(conn_close(c))
+    {
+        request_fail(c->entry,1);
+        st->sclose_failed++;
+    }
+    else
+        request_done(c->entry,c->start,1,c->resp);
+}
+
+//请求失败，关闭连接
+static void conn_fail(struct conn *c)
+{
+    request_fail(c->entry,1);
+    conn_close(c);
+}
+
+//闭环模式下这个槽位还没轮到时关掉长连接停下来，返回1表示停下了
+static int conn_park(struct conn *c)
+{
+    if(rate>0 || c-conns_base<nactive)
+        return 0;
+
+    if(c->fd>=0)
+        conn_close(c);
+    slab_free(&resp_slab,c->resp);
+    c->resp=NULL;
+    c->parked=1;
+    return 1;
+}
+
+//按负载曲线更新工作的槽位数，新轮到的停着的槽位放进空闲队列，由主循环发起连接
+//返回距离下一个槽位轮到的毫秒数，-1表示不用等
+static int conns_activate(int nconns)
+{
+    long long now=now_us(),t;
+    int n=active_conns(nconns,now);
+
+    for(; nactive<n; nactive++)
+    {
+        if(!conns_base[nactive].parked)
+            continue;
+        conns_base[nactive].parked=0;
+        idle_push(&conns_base[nactive]);
+    }
+    nactive=n;
+
+    if(n==nconns || (t=active_wake(n,now))<0)
+        return -1;
+    return (int)((t-now+999)/1000);
+}
+
+//修改连接关注的事件，和当前一样时省掉一次epoll_ctl
+static int conn_watch(int epfd, struct conn *c, int events)
+{
+    struct epoll_event ev;
+
+    if(c->events==events)
+        return 0;
+
+    c->events=events;
+    ev.events=events;
+    ev.data.ptr=c;
+    return SYSCALL(epoll_ctl(epfd,EPOLL_CTL_MOD,c->fd,&ev));
+}
+
+//连上了，https://时准备TLS握手，失败时算一次握手失败并关闭连接，返回-1
+static int conn_tls(struct conn *c)
+{
+    c->tls=tls_new(c->fd);
+    if(c->tls==NULL)
+    {
+        st->tls_failed++;
+        conn_fail(c);
+        return -1;
+    }
+    c->state=CONN_HANDSHAKE;
+    c->phase=now_us();
+    conn_deadline(c,request_timeout);
+    return 0;
+}
+
+//推进TLS握手，完成后发送请求
+static void conn_write(int epfd, struct conn *c);
+static void conn_handshake(int epfd, struct conn *c)
+{
+    int n=SYSCALL(tls_handshake(c->tls));
+
+    if(n<0)
+    {
+        conn_fail(c);
+        return;
+    }
+    if(n==0)
+    {
+        if(conn_watch(epfd,c,tls_want(c->tls)))
+        {
+            st->tls_failed++;
+            conn_fail(c);
+        }
+        return;
+    }
+
+    c->state=CONN_WRITING;
+    conn_write(epfd,c);
+}
+
+//HTTP/2的连接在h2.c里
+static int h2_start(int epfd, struct conn *c);
+static void h2_event(int epfd, struct conn *c, int events);
+static void h2_init(void);
+
+//为一个连接槽位发起新的连接
+static void conn_open(int epfd, struct conn *c)
+{
+    struct epoll_event ev;
+    const struct addr *ad,*local;
+    int inprogress;
+
+    c->sent=0;
+    c->start=now_us();//请求从建立连接开始计时
+    c->phase=c->start;
+    c->entry=workload_pick();
+    ad=next_addr();
+    local=next_local(ad);
+    c->fd=SocketNonblock(ad,local,&inprogress);
+    st->syscalls+=local!=NULL?4:2;//socket和connect，绑定时还有setsockopt和bind
+
+    //连接失败
+    if(c->fd<0)
+    {
+        request_fail(c->entry,1);
+        connect_error(errno);
+        idle_push(c);
+        return;
+    }
+
+    //连接还未完成时等待可写，已经连上时也是先等可写再发送(或者握手)
+    c->state=inprogress?CONN_CONNECTING:CONN_WRITING;
+
+    c->events=EPOLLOUT;
+    ev.events=EPOLLOUT;
+    ev.data.ptr=c;
+    if(SYSCALL(epoll_ctl(epfd,EPOLL_CTL_ADD,c->fd,&ev)))
+    {
+        request_fail(c->entry,1);
+        st->connect_failed++;
+        SYSCALL(close(c->fd));
+        c->fd=-1;
+        idle_push(c);
+        return;
+    }
+    conn_opened();
+
+    //已经连上了，https://时接着握手，否则等着超时
+    if(!inprogress)
+    {
+        phase_record(&hs->connect_time,c->phase);
+        if(tls && conn_tls(c))
+            idle_push(c);
+        else if(h2c && h2_start(epfd,c))
+            idle_push(c);
+    }
+    else
+        conn_deadline(c,connect_timeout);
+}
+
+//发送请求报文，发完后转入读阶段
+static void conn_write(int epfd, struct conn *c)
+{
+    int rlen,n;
+
+    //新的请求，有变量时填入这一次的值，发送的期限从这里开始
+    if(c->sent==0)
+    {
+        conn_prepare(c);
+        conn_deadline(c,request_timeout);
+    }
+    rlen=c->msg.len;
+
+    //报头和正文一起发，可能上次只发出了一部分
+    n=request_iov(&entries[c->entry],&c->msg,c->sent,epoll_iov);
+    if(c->tls!=NULL)
+        n=SYSCALL(tls_writev(c->tls,epoll_iov,n));
+    else
+        n=SYSCALL(writev(c->fd,epoll_iov,n));
+    if(n<0)
+    {
+        //发送缓冲区满了，等下一次可写事件，TLS时等OpenSSL要的事件
+        if(errno==EAGAIN || errno==EINTR)
+        {
+            if(conn_watch(epfd,c,c->tls!=NULL?tls_want(c->tls):EPOLLOUT))
+            {
+                st->send_failed++;
+                conn_fail(c);
+            }
+            return;
+        }
+
+        st->send_failed++;
+        conn_fail(c);
+        return;
+    }
+
+    c->sent+=n;
+    if(c->sent<rlen)
+    {
+        if(conn_watch(epfd,c,EPOLLOUT))
+        {
+            st->send_failed++;
+            conn_fail(c);
+        }
+        return;
+    }
+    conn_sent(c);
+
+    //http/0.9的特殊处理，与benchcore()相同，先关闭写的一半，TLS连接不能这样做
+    if(http10==0 && c->tls==NULL && SYSCALL(shutdown(c->fd,1)))
+    {
+        st->wclose_failed++;
+        conn_fail(c);
+        return;
+    }
+
+    //不复用的连接也解析回复，用来分类和检查，一直读到对端关闭
+    conn_resp(c,entries[c->entry].head);
+    c->inflight=keepalive?pipeline:1;
+
+    //不等待服务器回复，直接关闭
+    if(force)
+    {
+        conn_finish(c);
+        return;
+    }
+
+    //请求发完了，开始等第一个字节
+    c->phase=now_us();
+    c->first=1;
+
+    c->state=CONN_READING;
+    conn_deadline(c,request_timeout);
+
+    if(conn_watch(epfd,c,EPOLLIN))
+    {
+        st->read_failed++;
+        conn_fail(c);
+    }
+}
+
+//还没收到回复的请求都算读取失败，关闭连接
+static void conn_fail_inflight(struct conn *c)
+{
+    request_fail(c->entry,c->inflight);
+    st->read_failed+=c->inflight;
+    conn_close(c);
+}
+
+//读取服务器回复，对端关闭连接代表本次请求结束
+//长连接时根据回复报文找到结尾，一批请求的回复都收到后在同一个连接上发送下一批
+static void conn_read(int epfd, struct conn *c)
+{
+    int n,discard;
+
+    n=recv_resp(c->fd,c->tls,epoll_buf,drain?DRAIN_BUF_SIZE:EPOLL_READ_SIZE,c->resp,&discard);
+    if(n<0)
+    {
+        if(errno==EAGAIN || errno==EINTR)
+            return;
+
+        st->read_failed++;
+        conn_fail(c);
+        return;
+    }
+
+    if(n>0 && c->first)
+    {
+        phase_record(&hs->ttfb,c->phase);
+        c->phase=now_us();
+        c->first=0;
+    }
+
+    if(!keepalive)
+    {
+        if(n>0)
+        {
+            request_bytes(c->entry,n);
+            if(discard)
+                http_resp_skip(c->resp,n,&c->inflight);
+            else
+                http_resp_feed(c->resp,epoll_buf,n,&c->inflight);
+            return;
+        }
+        if(!c->first)
+            phase_record(&hs->transfer,c->phase);
+        http_resp_end(c->resp);
+        conn_finish(c);
+        return;
+    }
+
+    //对端关闭时回复正好完整，算一次成功
+    if(n==0)
+    {
+        if(http_resp_eof(c->resp))
+        {
+            c->inflight--;
+            if(c->inflight==0)
+            {
+                if(!c->first)
+                    phase_record(&hs->transfer,c->phase);
+                conn_finish(c);
+                return;
+            }
+            request_done(c->entry,c->start,1,c->resp);
+        }
+        conn_fail_inflight(c);
+        return;
+    }
+
+    request_bytes(c->entry,n);
+    if(discard)
+        n=http_resp_skip(c->resp,n,&c->inflight);
+    else
+        n=http_resp_feed(c->resp,epoll_buf,n,&c->inflight);
+    if(n<0)
+    {
+        conn_fail_inflight(c);
+        return;
+    }
+    if(c->inflight==0)
+        phase_record(&hs->transfer,c->phase);
+
+    //服务器要求关闭，这个连接到此为止，后面的请求不会有回复了
+    if(c->resp->state==RESP_DONE && c->resp->close)
+    {
+        if(c->inflight>0)
+        {
+            request_done(c->entry,c->start,n,c->resp);
+            conn_fail_inflight(c);
+            return;
+        }
+
+        //最后一个回复在连接成功关闭后才算成功
+        if(n>1)
+            request_done(c->entry,c->start,n-1,c->resp);
+        conn_finish(c);
+        return;
+    }
+
+    if(n>0)
+        request_done(c->entry,c->start,n,c->resp);
+    if(c->inflight>0)
+        return;
+
+    //开环模式：连接保持打开，等到下一个计划时间再发，空闲太久就关掉
+    if(rate>0)
+    {
+        c->state=CONN_IDLE;
+        conn_deadline(c,idle_timeout);
+        return;
+    }
+
+    //负载降下来了，这个槽位停下
+    if(conn_park(c))
+        return;
+
+    //这一批回复都收到了，直接在同一个连接上发下一批请求
+    c->state=CONN_WRITING;
+    c->sent=0;
+    c->start=now_us();
+    c->entry=workload_pick();
+    conn_write(epfd,c);
+}
+
+//提高进程可以打开的文件描述符上限，每个连接都要占用一个
+static void raise_nofile(int need)
+{
+    struct rlimit rl;
+
+    if(getrlimit(RLIMIT_NOFILE,&rl))
+        return;
+
+    if(rl.rlim_cur>=(rlim_t)need)
+        return;
+
+    rl.rlim_cur=(rl.rlim_max==RLIM_INFINITY || rl.rlim_max>(rlim_t)need)?(rlim_t)need:rl.rlim_max;
+    if(setrlimit(RLIMIT_NOFILE,&rl))
+        perror(" Failed to raise open file limit ");
+}
+
+//开环模式下空闲的长连接收到了事件，只可能是服务器关闭了连接或者出错
+//这不算请求失败，关闭后下次用这个槽位时重新连接
+static void conn_idle_event(struct conn *c)
+{
+    int n;
+
+    //TLS 1.3的会话票据也会在空闲时到达，读进去就行
+    if(c->tls!=NULL)
+        n=SYSCALL(tls_read(c->tls,epoll_buf,sizeof(epoll_buf)));
+    else
+        n=SYSCALL(read(c->fd,epoll_buf,sizeof(epoll_buf)));
+    if(n<0 && (errno==EAGAIN || errno==EINTR))
+        return;
+
+    conn_close(c);
+}
+
+//HTTP/2连接的定时器到期
+static void h2_timer(int epfd, struct conn *c);
+
+//处理到期的定时器，关掉的连接槽位进入空闲队列
+static void conns_expire(int epfd)
+{
+    struct timer *t;
+    struct conn *c;
+    int n;
+
+    while((t=timer_expired(&wheel,now_us()))!=NULL)
+    {
+        c=timer_conn(t);
+        switch(c->state)
+        {
+        case CONN_CONNECTING:
+            request_fail(c->entry,1);
+            st->connect_timeout++;
+            conn_close(c);
+            idle_push(c);
+            break;
+
+        case CONN_IDLE:
+            //开环模式下空闲太久的长连接，槽位已经在空闲队列里了，下次用到时重新连接
+            conn_close(c);
+            break;
+
+        case CONN_H2:
+            h2_timer(epfd,c);
+            if(c->fd<0)
+                idle_push(c);
+            break;
+
+        default:
+            //握手、发送或者等回复超过了--timeout，还没收到回复的请求都算超时
+            n=c->state==CONN_READING?c->inflight:1;
+            request_fail(c->entry,n);
+            st->timeouts+=n;
+            conn_close(c);
+            idle_push(c);
+            break;
+        }
+    }
+}
+
+//开环模式：把到了计划时间的请求分给空闲的槽位发出
+//*next是本进程下一个请求的序号，返回距离下一个计划时间的毫秒数，-1表示没有空闲槽位
+static int dispatch(int epfd, long long *next)
+{
+    struct conn *c;
+    long long now,t;
+
+    now=now_us();
+    while(nidle>0 && !timeout)
+    {
+        t=intended_time(*next);
+        if(t>now)
+            return (int)((t-now+999)/1000);
+
+        c=idle_pop();
+        *next+=pipeline;
+
+        //长连接还开着就直接发，否则先建立连接，连接失败的槽位会回到空闲队列
+        if(c->fd>=0)
+        {
+            c->state=CONN_WRITING;
+            c->sent=0;
+            c->entry=workload_pick();
+            conn_write(epfd,c);
+
+            //立刻就失败了或者不等待回复，槽位直接回到空闲队列
+            if(c->fd<0)
+                idle_push(c);
+        }
+        else
+            conn_open(epfd,c);
+
+        //请求从计划时间开始计时，而不是实际发出的时间
+        c->start=t;
+    }
+
+    return -1;
+}
+
+//一个工作进程用epoll驱动nconns个并发连接，直到测试时间结束
+static void epollcore(int nconns)
+{
+    struct epoll_event events[MAX_EVENTS];
+    struct conn *conns,*c;
+    int epfd,n,i,retry;
+    int err,wait,wake;
+    long long next=0;//开环模式下本进程下一个请求的序号
+    socklen_t len;
+
+    epfd=epoll_create1(0);
+    conns=state_calloc(nconns,sizeof(struct conn));
+    idle=state_calloc(nconns,sizeof(struct conn *));
+    epoll_iov=calloc(REQUEST_IOV,sizeof(struct iovec));
+    if(epfd<0 || conns==NULL || idle==NULL || epoll_iov==NULL)
+    {
+        perror(" Failed to create epoll worker ");
+        exit(3);
+    }
+
+    wheel_init(&wheel,now_us());
+    conns_base=conns;
+    idle_size=nconns;
+    slab_init(&resp_slab,sizeof(struct http_resp));
+    slab_init(&tbuf_slab,tmpl_size);
+    mem_state+=sizeof(epoll_buf);
+    if(h2c)
+        h2_init();
+
+    //开环模式所有槽位先进入空闲队列
+    //闭环模式所有槽位先停着，按负载曲线轮到的立刻发起连接
+    for(i=0; i<nconns; i++)
+    {
+        conns[i].fd=-1;
+        if(rate>0)
+            idle_push(&conns[i]);
+        else
+            conns[i].parked=1;
+    }
+
+    while(!run_over(now_us()))
+    {
+        stage_check(now_us());
+
+        //开环模式等到下一个计划时间，没有空闲槽位时等有请求结束
+        //闭环模式有等待重连的槽位时不能阻塞在epoll_wait上，也不能错过下一个槽位轮到的时间
+        //同时不能错过最早的期限和测试结束的时间
+        conns_expire(epfd);
+        if(rate>0)
+            wait=dispatch(epfd,&next);
+        else
+        {
+            wake=conns_activate(nconns);
+            wait=nidle?0:wake;
+        }
+        wait=timer_wait(&wheel,now_us(),wait);
+        wait=wait_until(now_us(),run_end(),wait);
+
+        n=SYSCALL(epoll_wait(epfd,events,MAX_EVENTS,wait));
+        if(n<0)
+        {
+            if(errno==EINTR)
+                continue;
+            perror(" epoll_wait failed ");
+            break;
+        }
+
+        for(i=0; i<n; i++)
+        {
+            c=events[i].data.ptr;
+
+            switch(c->state)
+            {
+            case CONN_CONNECTING:
+                //取出非阻塞connect的最终结果
+                err=0;
+                len=sizeof(err);
+                if(SYSCALL(getsockopt(c->fd,SOL_SOCKET,SO_ERROR,&err,&len)) || err)
+                {
+                    connect_error(err?err:errno);
+                    conn_fail(c);
+                    break;
+                }
+                phase_record(&hs->connect_time,c->phase);
+                if(tls)
+                {
+                    if(!conn_tls(c))
+                        conn_handshake(epfd,c);
+                    break;
+                }
+                if(h2c)
+                {
+                    h2_start(epfd,c);
+                    break;
+                }
+                c->state=CONN_WRITING;
+                conn_write(epfd,c);
+                break;
+
+            case CONN_HANDSHAKE:
+                conn_handshake(epfd,c);
+                break;
+
+            case CONN_WRITING:
+                conn_write(epfd,c);
+                break;
+
+            case CONN_READING:
+                conn_read(epfd,c);
+                break;
+
+            case CONN_H2:
+                h2_event(epfd,c,events[i].events);
+                break;
+
+            case CONN_IDLE:
+                //槽位已经在空闲队列里了
+                conn_idle_event(c);
+                continue;
+            }
+
+            //开环模式下结束了的槽位回到空闲队列，等下一个计划时间
+            if(rate>0)
+            {
+                if(c->fd<0 || c->state==CONN_IDLE)
+                    idle_push(c);
+                continue;
+            }
+
+            //本次请求已经结束，立刻为这个槽位发起下一次请求，负载降下来了就停下
+            if(c->fd<0 && !timeout && !c->parked && !conn_park(c))
+                conn_open(epfd,c);
+        }
+
+        if(rate>0)
+            continue;
+
+        //连接失败的槽位不会再收到事件，在这里补发连接
+        //只重试本轮开始时已经在队列里的，再次失败的排在它们后面，留到下一轮
+        for(retry=nidle; retry>0 && !timeout; retry--)
+        {
+            c=idle_pop();
+            if(!conn_park(c))
+                conn_open(epfd,c);
+        }
+    }
+
+    //开环模式：计划时间已经到了却没有发出去的请求
+    if(rate>0 && intended_count(now_us())>next)
+        st->unsent=intended_count(now_us())-next;
+
+    //测试时间到了，还在进行中的请求既不算成功也不算失败
+    close(epfd);
+}
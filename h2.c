@@ -0,0 +1,1687 @@
+#include <ctype.h>
+#include <netinet/tcp.h>
+
+/*
+
+HTTP/2明文(h2c)：
+
+--h2c 用prior knowledge直接说HTTP/2，不经过HTTP/1.1的Upgrade：
+连上之后发出连接序言(PRI * HTTP/2.0...)和SETTINGS，收到服务器的SETTINGS后开始发请求
+-c是连接数，每个连接上同时进行--streams个流，一个流就是一个请求
+一个流结束了立刻在同一个连接上开下一个，连接一直复用，直到服务器发GOAWAY或者测试结束
+
+HTTP/2的连接由epoll引擎驱动，建立连接、连接超时、负载曲线都和HTTP/1.1的连接一样，
+连上之后连接进入CONN_H2状态，之后的读写都在这里处理：
+    收：读到的数据凑够完整的帧再处理，回复的HEADERS、DATA按流号找到对应的请求
+    发：新的流的HEADERS、请求正文的DATA和各种应答先放进发送缓冲区，处理完一个事件后一次发出
+
+请求报头(HPACK)：
+开始时把每个条目构造好的HTTP/1.1报头转换成HTTP/2的字段并编码好，每个条目三份：
+    first    连接上的第一个请求，所有条目都有的字段(:authority、user-agent等)依次加进动态表
+    indexed  之后的请求，这些字段直接引用动态表，每个只要一个字节
+    plain    服务器给的动态表放不下这些字段时，全部是不加索引的字面值
+:method、:scheme、:path和字段名尽量引用静态表，字符串不用Huffman编码
+测试过程中开一个流只是把编码好的报头块拷贝进发送缓冲区
+值里有模板变量的字段(包括:path)不加进动态表，报头块在这个字段的值之前断开，开流时渲染出值接上
+
+回复报头必须完整地解码：服务器会把字段加进它的动态表，后面的回复引用它们，
+不跟着维护动态表就解不出后面回复的:status，Huffman编码的字符串按RFC 7541附录B解码
+
+流量控制：
+    收：给每个流和整个连接16M的窗口，收到的DATA累计到窗口的一半时用WINDOW_UPDATE还回去
+    发：请求正文(--body)按服务器的最大帧长度和流、连接两级窗口切成DATA帧，
+        窗口用完了就等服务器的WINDOW_UPDATE，每等一次记一次stall
+
+统计：
+每个流和HTTP/1.1的一个请求一样，按条目和状态码记录成功、失败、延迟，按--expect-*检查回复
+ttfb从请求发完到收到回复的HEADERS，transfer从回复的HEADERS到流结束
+连接另外统计：建立的连接数、开出的流数、从发出序言到收到服务器SETTINGS的时间(h2 setup)、
+被服务器重置的流、GOAWAY、GOAWAY时服务器没有处理的流、协议错误和发送正文时的窗口等待
+
+--timeout：每个流从开出到结束都要在期限内，超时的流算失败并用RST_STREAM取消，连接继续用
+连接只有一个定时器，指向最早的期限；还没收到服务器的SETTINGS时是建立连接的期限
+
+内存：连接的状态(主要是回复报头的动态表)在槽位第一次连上时从池里取，之后一直挂在槽位上
+32K的收发缓冲区只在有不完整的帧、有没发出去的数据时才从池里取，空了就还回去，
+所以大量空闲的连接只占连接的状态，不占缓冲区
+
+*/
+
+//帧的类型
+#define H2_DATA          0
+#define H2_HEADERS       1
+#define H2_PRIORITY      2
+#define H2_RST_STREAM    3
+#define H2_SETTINGS      4
+#define H2_PUSH_PROMISE  5
+#define H2_PING          6
+#define H2_GOAWAY        7
+#define H2_WINDOW_UPDATE 8
+#define H2_CONTINUATION  9
+
+//帧的标志
+#define H2_END_STREAM  0x1
+#define H2_ACK         0x1
+#define H2_END_HEADERS 0x4
+#define H2_PADDED      0x8
+#define H2_PRIO        0x20
+
+//RST_STREAM的错误码：不再需要这个流
+#define H2_CANCEL 0x8
+
+//SETTINGS的参数
+#define H2_SET_HEADER_TABLE_SIZE      1
+#define H2_SET_ENABLE_PUSH            2
+#define H2_SET_MAX_CONCURRENT_STREAMS 3
+#define H2_SET_INITIAL_WINDOW_SIZE    4
+#define H2_SET_MAX_FRAME_SIZE         5
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_FRAME_MAX 16384          //我们接收的最大帧长度，就是协议的默认值
+#define H2_WINDOW (1<<24)           //给服务器的接收窗口，每个流和整个连接都是这么大
+#define H2_DEFAULT_WINDOW 65535     //协议规定的初始窗口
+#define H2_MAX_ID 0x7fffffff        //最大的流号
+#define H2_IN_SIZE (2*(H2_FRAME_MAX+9))//接收缓冲区，至少能放下一个最大的帧
+#define H2_OUT_SIZE 32768           //发送缓冲区
+#define H2_OUT_RESERVE 1024         //留给应答和WINDOW_UPDATE的空间，请求只用到这之前
+
+//HPACK动态表的默认大小，两个方向都用默认值
+#define HPACK_TABLE_SIZE 4096
+#define HPACK_FIELDS (HPACK_TABLE_SIZE/32)//每个字段至少占32字节，表里最多这么多个
+
+//请求报头块的三种编码
+#define H2_BLOCK_FIRST   0
+#define H2_BLOCK_INDEXED 1
+#define H2_BLOCK_PLAIN   2
+
+//一个请求最多转换出这么多个字段
+#define H2_MAX_FIELDS 64
+
+
+//动态表中的一个字段，名字和值放在表的buf里
+struct hpack_field
+{
+    int name,value;     //在buf中的偏移
+    int nlen,vlen;
+};
+
+//解码回复报头用的动态表，和服务器编码时的动态表保持一致
+struct hpack_table
+{
+    struct hpack_field f[HPACK_FIELDS];
+    int first,n;        //环形数组，f[first]是最新加入的，共n个
+    int size,max;       //按协议计算的大小和上限
+    int blen;           //buf已经用到的位置，用到头时把还在表里的字段挪到前面
+    char buf[2*HPACK_TABLE_SIZE];
+};
+
+//转换成HTTP/2的一个请求字段
+struct h2_field
+{
+    const char *name,*value;
+    int nlen,vlen;
+};
+
+//报头块的一段：h2_blocks中编码好的部分，后面跟着一个要在开流时渲染的字段值
+struct h2_part
+{
+    int off,len;
+    int tmpl;       //字段值的模板，-1表示这一段后面没有要渲染的值
+};
+
+//一个条目编码好的三份请求报头块，每份是h2_parts中连续的几段
+struct h2_request
+{
+    int part[3],npart[3];
+    int max[3];     //报头块的最大长度
+};
+
+//一个流
+struct h2_stream
+{
+    int id;             //流号，0表示这个位置空闲
+    int entry;          //请求是workload中的第几个条目
+    int sent;           //正文已经发出的字节数
+    int window;         //服务器给这个流的发送窗口
+    int unacked;        //这个流收到了、还没有用WINDOW_UPDATE还给服务器的字节数
+    int stalled;        //正文在等窗口
+    int replied;        //收到了最终回复(不是1xx)的报头
+    long long start;    //请求开始的时间
+    long long phase;    //当前阶段(等回复、传输)开始的时间
+    struct http_resp resp;//回复的状态码和正文，按--expect-*检查
+};
+
+//一个HTTP/2连接的状态，挂在epoll引擎的struct conn上
+struct h2_conn
+{
+    char *in;           //收到的数据，完整的帧处理掉，不完整的留着，空了就还回池里(NULL)
+    int ilen;
+    char *out;          //要发出的帧，都发出去了就还回池里(NULL)
+    int olen,ooff;      //缓冲区中的长度，已经发出的长度
+    int more;           //有正文因为发送缓冲区满了没放进去，发出去之后接着放
+    struct h2_stream *streams;//--streams个流的位置
+    int nstreams;       //正在进行的流数
+    int limit;          //最多同时进行的流数：--streams和服务器的MAX_CONCURRENT_STREAMS中小的那个
+    int next_id;        //下一个流号
+    int ready;          //收到了服务器的第一个SETTINGS，可以发请求了
+    int closing;        //收到了GOAWAY或者流号用完了，不再开新的流
+    long long window;   //连接的发送窗口
+    int init_window;    //服务器给每个新的流的发送窗口
+    int frame_max;      //服务器能接收的最大帧长度
+    int unacked;        //整个连接收到了、还没有还给服务器的字节数
+    int hpack;          //请求报头用哪一份编码
+    int table_max;      //服务器给请求报头的动态表大小
+    int table_update;   //下一个报头块前面要先告诉服务器动态表变小了
+    int hstream;        //报头块还没有结束的流，后面只能是它的CONTINUATION，0表示没有
+    int hflags;         //这个报头块第一个帧(HEADERS)的标志
+    char *hbuf;         //拼接HEADERS和CONTINUATION中的报头块
+    int hlen,hcap;
+    struct hpack_table table;//回复报头的动态表
+};
+
+//连接的状态(struct h2_conn和--streams个流)和收发缓冲区的池
+static struct slab h2_slab;
+static struct slab h2_in_slab;
+static struct slab h2_out_slab;
+
+static char *h2_blocks;           //所有条目编码好的请求报头块
+static int h2_blocks_len=0;
+static struct h2_request *h2_requests;
+static int h2_block_max[3];     //所有条目中最长的报头块，开流前按它检查发送缓冲区
+static struct h2_part *h2_parts;
+static int nh2_parts=0;
+static int h2_part_start=0;       //正在编码的一段从h2_blocks的哪里开始
+static char *h2_value;            //渲染模板字段值用
+static int h2_common_size=0;      //所有条目都有、加进动态表的字段的大小
+
+//Huffman解码树：内部节点的两个孩子，正数是节点，负数是-(符号+1)
+static short huff_tree[256][2];
+
+/* 一些表 */
+
+//HPACK的静态表(RFC 7541附录A)，下标从1开始
+static const char *const hpack_static[62][2]=
+{
+    {NULL,NULL},
+    {":authority",""},
+    {":method","GET"},
+    {":method","POST"},
+    {":path","/"},
+    {":path","/index.html"},
+    {":scheme","http"},
+    {":scheme","https"},
+    {":status","200"},
+    {":status","204"},
+    {":status","206"},
+    {":status","304"},
+    {":status","400"},
+    {":status","404"},
+    {":status","500"},
+    {"accept-charset",""},
+    {"accept-encoding","gzip, deflate"},
+    {"accept-language",""},
+    {"accept-ranges",""},
+    {"accept",""},
+    {"access-control-allow-origin",""},
+    {"age",""},
+    {"allow",""},
+    {"authorization",""},
+    {"cache-control",""},
+    {"content-disposition",""},
+    {"content-encoding",""},
+    {"content-language",""},
+    {"content-length",""},
+    {"content-location",""},
+    {"content-range",""},
+    {"content-type",""},
+    {"cookie",""},
+    {"date",""},
+    {"etag",""},
+    {"expect",""},
+    {"expires",""},
+    {"from",""},
+    {"host",""},
+    {"if-match",""},
+    {"if-modified-since",""},
+    {"if-none-match",""},
+    {"if-range",""},
+    {"if-unmodified-since",""},
+    {"last-modified",""},
+    {"link",""},
+    {"location",""},
+    {"max-forwards",""},
+    {"proxy-authenticate",""},
+    {"proxy-authorization",""},
+    {"range",""},
+    {"referer",""},
+    {"refresh",""},
+    {"retry-after",""},
+    {"server",""},
+    {"set-cookie",""},
+    {"strict-transport-security",""},
+    {"transfer-encoding",""},
+    {"user-agent",""},
+    {"vary",""},
+    {"via",""},
+    {"www-authenticate",""},
+};
+
+//Huffman编码表(RFC 7541附录B)，第256个是EOS
+static const unsigned int hpack_huff_code[257]=
+{
+    0x1ff8,0x7fffd8,0xfffffe2,0xfffffe3,0xfffffe4,0xfffffe5,0xfffffe6,0xfffffe7,
+    0xfffffe8,0xffffea,0x3ffffffc,0xfffffe9,0xfffffea,0x3ffffffd,0xfffffeb,0xfffffec,
+    0xfffffed,0xfffffee,0xfffffef,0xffffff0,0xffffff1,0xffffff2,0x3ffffffe,0xffffff3,
+    0xffffff4,0xffffff5,0xffffff6,0xffffff7,0xffffff8,0xffffff9,0xffffffa,0xffffffb,
+    0x14,0x3f8,0x3f9,0xffa,0x1ff9,0x15,0xf8,0x7fa,
+    0x3fa,0x3fb,0xf9,0x7fb,0xfa,0x16,0x17,0x18,
+    0x0,0x1,0x2,0x19,0x1a,0x1b,0x1c,0x1d,
+    0x1e,0x1f,0x5c,0xfb,0x7ffc,0x20,0xffb,0x3fc,
+    0x1ffa,0x21,0x5d,0x5e,0x5f,0x60,0x61,0x62,
+    0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,
+    0x6b,0x6c,0x6d,0x6e,0x6f,0x70,0x71,0x72,
+    0xfc,0x73,0xfd,0x1ffb,0x7fff0,0x1ffc,0x3ffc,0x22,
+    0x7ffd,0x3,0x23,0x4,0x24,0x5,0x25,0x26,
+    0x27,0x6,0x74,0x75,0x28,0x29,0x2a,0x7,
+    0x2b,0x76,0x2c,0x8,0x9,0x2d,0x77,0x78,
+    0x79,0x7a,0x7b,0x7ffe,0x7fc,0x3ffd,0x1ffd,0xffffffc,
+    0xfffe6,0x3fffd2,0xfffe7,0xfffe8,0x3fffd3,0x3fffd4,0x3fffd5,0x7fffd9,
+    0x3fffd6,0x7fffda,0x7fffdb,0x7fffdc,0x7fffdd,0x7fffde,0xffffeb,0x7fffdf,
+    0xffffec,0xffffed,0x3fffd7,0x7fffe0,0xffffee,0x7fffe1,0x7fffe2,0x7fffe3,
+    0x7fffe4,0x1fffdc,0x3fffd8,0x7fffe5,0x3fffd9,0x7fffe6,0x7fffe7,0xffffef,
+    0x3fffda,0x1fffdd,0xfffe9,0x3fffdb,0x3fffdc,0x7fffe8,0x7fffe9,0x1fffde,
+    0x7fffea,0x3fffdd,0x3fffde,0xfffff0,0x1fffdf,0x3fffdf,0x7fffeb,0x7fffec,
+    0x1fffe0,0x1fffe1,0x3fffe0,0x1fffe2,0x7fffed,0x3fffe1,0x7fffee,0x7fffef,
+    0xfffea,0x3fffe2,0x3fffe3,0x3fffe4,0x7ffff0,0x3fffe5,0x3fffe6,0x7ffff1,
+    0x3ffffe0,0x3ffffe1,0xfffeb,0x7fff1,0x3fffe7,0x7ffff2,0x3fffe8,0x1ffffec,
+    0x3ffffe2,0x3ffffe3,0x3ffffe4,0x7ffffde,0x7ffffdf,0x3ffffe5,0xfffff1,0x1ffffed,
+    0x7fff2,0x1fffe3,0x3ffffe6,0x7ffffe0,0x7ffffe1,0x3ffffe7,0x7ffffe2,0xfffff2,
+    0x1fffe4,0x1fffe5,0x3ffffe8,0x3ffffe9,0xffffffd,0x7ffffe3,0x7ffffe4,0x7ffffe5,
+    0xfffec,0xfffff3,0xfffed,0x1fffe6,0x3fffe9,0x1fffe7,0x1fffe8,0x7ffff3,
+    0x3fffea,0x3fffeb,0x1ffffee,0x1ffffef,0xfffff4,0xfffff5,0x3ffffea,0x7ffff4,
+    0x3ffffeb,0x7ffffe6,0x3ffffec,0x3ffffed,0x7ffffe7,0x7ffffe8,0x7ffffe9,0x7ffffea,
+    0x7ffffeb,0xffffffe,0x7ffffec,0x7ffffed,0x7ffffee,0x7ffffef,0x7fffff0,0x3ffffee,
+    0x3fffffff,
+};
+static const unsigned char hpack_huff_len[257]=
+{
+    13,23,28,28,28,28,28,28,28,24,30,28,28,30,28,28,
+    28,28,28,28,28,28,30,28,28,28,28,28,28,28,28,28,
+    6,10,10,12,13,6,8,11,10,10,8,11,8,6,6,6,
+    5,5,5,6,6,6,6,6,6,6,7,8,15,6,12,10,
+    13,6,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
+    7,7,7,7,7,7,7,7,8,7,8,13,19,13,14,6,
+    15,5,6,5,6,5,6,6,6,5,7,7,6,6,6,5,
+    6,7,6,5,5,6,7,7,7,7,7,15,11,14,13,28,
+    20,22,20,20,22,22,22,23,22,23,23,23,23,23,24,23,
+    24,24,22,23,24,23,23,23,23,21,22,23,22,23,23,24,
+    22,21,20,22,22,23,23,21,23,22,22,24,21,22,23,23,
+    21,21,22,21,23,22,23,23,20,22,22,22,23,22,22,23,
+    26,26,20,19,22,23,22,25,26,26,26,27,27,26,24,25,
+    19,21,26,27,27,26,27,24,21,21,26,26,28,27,27,27,
+    20,24,20,21,22,21,21,23,22,22,25,25,24,24,26,23,
+    26,27,26,26,27,27,27,27,27,28,27,27,27,27,27,26,
+    30,
+};
+
+/* HPACK */
+
+//按编码表建Huffman解码树，257个符号正好256个内部节点
+static void huff_init(void)
+{
+    int s,i,b,node,nodes=1;
+
+    for(s=0; s<257; s++)
+    {
+        node=0;
+        for(i=hpack_huff_len[s]-1; i>0; i--)
+        {
+            b=hpack_huff_code[s]>>i&1;
+            if(huff_tree[node][b]==0)
+                huff_tree[node][b]=nodes++;
+            node=huff_tree[node][b];
+        }
+        huff_tree[node][hpack_huff_code[s]&1]=-(s+1);
+    }
+}
+
+//解码Huffman编码的字符串，最多写cap字节到dst，返回解码后的长度，出错返回-1
+static int huff_decode(const unsigned char *p,int len,char *dst,int cap)
+{
+    int node=0,n=0,bits=0,ones=1,i,k,b,x;
+
+    for(i=0; i<len; i++)
+    {
+        for(k=7; k>=0; k--)
+        {
+            b=p[i]>>k&1;
+            bits++;
+            ones&=b;
+            x=huff_tree[node][b];
+            if(x>0)
+            {
+                node=x;
+                continue;
+            }
+
+            //EOS不能出现在字符串里
+            if(x==0 || x==-257)
+                return -1;
+            if(n<cap)
+                dst[n]=-x-1;
+            n++;
+            node=0;
+            bits=0;
+            ones=1;
+        }
+    }
+
+    //最后是不到一个字节、全是1的填充
+    if(bits>7 || !ones)
+        return -1;
+    return n;
+}
+
+//解码一个prefix位前缀的整数，成功返回0
+static int hpack_int(const unsigned char **pp,const unsigned char *end,int prefix,int *v)
+{
+    const unsigned char *p=*pp;
+    int mask=(1<<prefix)-1,shift=0,x;
+
+    if(p>=end)
+        return -1;
+    x=*p++&mask;
+    if(x==mask)
+    {
+        do
+        {
+            if(p>=end || shift>21)
+                return -1;
+            x+=(*p&0x7f)<<shift;
+            shift+=7;
+        }while(*p++&0x80);
+    }
+
+    *pp=p;
+    *v=x;
+    return 0;
+}
+
+//解码一个字符串，最多写cap字节到dst，返回它的长度(可能大于cap)，出错返回-1
+static int hpack_string(const unsigned char **pp,const unsigned char *end,char *dst,int cap)
+{
+    const unsigned char *p=*pp;
+    int huff,len,n;
+
+    if(p>=end)
+        return -1;
+    huff=*p&0x80;
+    if(hpack_int(&p,end,7,&len) || len>end-p)
+        return -1;
+
+    if(huff)
+        n=huff_decode(p,len,dst,cap);
+    else
+    {
+        n=len;
+        memcpy(dst,p,len<cap?len:cap);
+    }
+    *pp=p+len;
+    return n;
+}
+
+//动态表中第i个字段，0是最新加入的
+static struct hpack_field *hpack_get(struct hpack_table *t,int i)
+{
+    return &t->f[(t->first+i)%HPACK_FIELDS];
+}
+
+//从最老的字段开始挤出去，直到表的大小不超过max
+static void hpack_evict(struct hpack_table *t,int max)
+{
+    struct hpack_field *f;
+
+    while(t->size>max)
+    {
+        f=hpack_get(t,t->n-1);
+        t->size-=f->nlen+f->vlen+32;
+        t->n--;
+    }
+    if(t->n==0)
+        t->blen=0;
+}
+
+//把字段加进动态表，name和value不能指向表里面(会被挤出去)
+static void hpack_add(struct hpack_table *t,const char *name,int nlen,const char *value,int vlen)
+{
+    static char tmp[2*HPACK_TABLE_SIZE];
+    struct hpack_field *f;
+    int size=nlen+vlen+32,len=0,i;
+
+    //比整个表还大时表被清空，字段也不加进去
+    if(size>t->max)
+    {
+        hpack_evict(t,0);
+        return;
+    }
+    hpack_evict(t,t->max-size);
+
+    //buf用到头了，还在表里的字段不超过表的大小，挪到前面后一定放得下
+    if(t->blen+nlen+vlen>(int)sizeof(t->buf))
+    {
+        for(i=t->n-1; i>=0; i--)
+        {
+            f=hpack_get(t,i);
+            memcpy(tmp+len,t->buf+f->name,f->nlen);
+            f->name=len;
+            len+=f->nlen;
+            memcpy(tmp+len,t->buf+f->value,f->vlen);
+            f->value=len;
+            len+=f->vlen;
+        }
+        memcpy(t->buf,tmp,len);
+        t->blen=len;
+    }
+
+    t->first=(t->first+HPACK_FIELDS-1)%HPACK_FIELDS;
+    t->n++;
+    t->size+=size;
+    f=&t->f[t->first];
+    f->name=t->blen;
+    f->nlen=nlen;
+    memcpy(t->buf+t->blen,name,nlen);
+    t->blen+=nlen;
+    f->value=t->blen;
+    f->vlen=vlen;
+    memcpy(t->buf+t->blen,value,vlen);
+    t->blen+=vlen;
+}
+
+//按索引取出静态表或动态表中的字段，成功返回0
+static int hpack_field(struct hpack_table *t,int idx,const char **name,int *nlen,const char **value,int *vlen)
+{
+    struct hpack_field *f;
+
+    if(idx<=0)
+        return -1;
+    if(idx<62)
+    {
+        *name=hpack_static[idx][0];
+        *nlen=strlen(*name);
+        *value=hpack_static[idx][1];
+        *vlen=strlen(*value);
+        return 0;
+    }
+    if(idx-62>=t->n)
+        return -1;
+    f=hpack_get(t,idx-62);
+    *name=t->buf+f->name;
+    *nlen=f->nlen;
+    *value=t->buf+f->value;
+    *vlen=f->vlen;
+    return 0;
+}
+
+/*
+解码一个回复的报头块，返回:status，没有:status时返回0，格式错误返回-1
+关心的只有:status，但所有字段都要按顺序解码，动态表才能和服务器的一致
+*/
+static int hpack_decode(struct hpack_table *t,const unsigned char *p,int len)
+{
+    static char name[HPACK_TABLE_SIZE],value[HPACK_TABLE_SIZE];
+    const unsigned char *end=p+len;
+    const char *n,*v;
+    int status=0,idx,nlen,vlen,add;
+
+    while(p<end)
+    {
+        //动态表大小更新：001xxxxx
+        if((*p&0xe0)==0x20)
+        {
+            if(hpack_int(&p,end,5,&idx) || idx>HPACK_TABLE_SIZE)
+                return -1;
+            t->max=idx;
+            hpack_evict(t,idx);
+            continue;
+        }
+
+        //引用表中完整的字段：1xxxxxxx
+        if(*p&0x80)
+        {
+            if(hpack_int(&p,end,7,&idx) || hpack_field(t,idx,&n,&nlen,&v,&vlen))
+                return -1;
+        }
+        //字面值：01xxxxxx加进动态表，0000xxxx不加，0001xxxx永远不加
+        else
+        {
+            add=(*p&0xc0)==0x40;
+            if(hpack_int(&p,end,add?6:4,&idx))
+                return -1;
+            if(idx>0)
+            {
+                if(hpack_field(t,idx,&n,&nlen,&v,&vlen))
+                    return -1;
+
+                //名字可能在动态表里，加进新字段时会被挤掉，先拷贝出来
+                memcpy(name,n,nlen);
+            }
+            else if((nlen=hpack_string(&p,end,name,sizeof(name)))<0)
+                return -1;
+            n=name;
+            if((vlen=hpack_string(&p,end,value,sizeof(value)))<0)
+                return -1;
+            v=value;
+
+            //放不下的长字符串只用到长度：比整个表还大，加进去也是清空表
+            if(add)
+                hpack_add(t,n,nlen,v,vlen);
+        }
+
+        if(nlen==7 && vlen==3 && memcmp(n,":status",7)==0 &&
+           isdigit((unsigned char)v[0]) && isdigit((unsigned char)v[1]) && isdigit((unsigned char)v[2]))
+            status=(v[0]-'0')*100+(v[1]-'0')*10+(v[2]-'0');
+    }
+
+    return status;
+}
+
+/* 请求报头的编码，只在开始时做一次 */
+
+static void h2_put(const void *p,int len)
+{
+    h2_blocks=workload_realloc(h2_blocks,h2_blocks_len+len);
+    memcpy(h2_blocks+h2_blocks_len,p,len);
+    h2_blocks_len+=len;
+}
+
+//编码prefix位前缀的整数，flags是第一个字节中前缀以外的高位
+static int hpack_put_int(unsigned char *b,int flags,int prefix,int v)
+{
+    int n=0,mask=(1<<prefix)-1;
+
+    if(v<mask)
+    {
+        b[n++]=flags|v;
+        return n;
+    }
+    b[n++]=flags|mask;
+    for(v-=mask; v>=128; v>>=7)
+        b[n++]=(v&0x7f)|0x80;
+    b[n++]=v;
+    return n;
+}
+
+static void h2_put_int(int flags,int prefix,int v)
+{
+    unsigned char b[8];
+
+    h2_put(b,hpack_put_int(b,flags,prefix,v));
+}
+
+//字面值字段，kind是0x40(加进动态表)或者0x00(不加)，名字在静态表里时引用它
+static void h2_put_literal(int kind,int name,const struct h2_field *f)
+{
+    h2_put_int(kind,kind?6:4,name);
+    if(name==0)
+    {
+        h2_put_int(0,7,f->nlen);
+        h2_put(f->name,f->nlen);
+    }
+    h2_put_int(0,7,f->vlen);
+    h2_put(f->value,f->vlen);
+}
+
+//结束正在编码的一段，tmpl是接在后面的字段值的模板
+static void h2_part_end(int tmpl)
+{
+    struct h2_part *pt;
+
+    h2_parts=workload_realloc(h2_parts,sizeof(struct h2_part)*(nh2_parts+1));
+    pt=&h2_parts[nh2_parts++];
+    pt->off=h2_part_start;
+    pt->len=h2_blocks_len-h2_part_start;
+    pt->tmpl=tmpl;
+    h2_part_start=h2_blocks_len;
+}
+
+//在静态表里找字段，完全相同时返回索引，*name是第一个名字相同的索引，都没有时为0
+static int hpack_find(const struct h2_field *f,int *name)
+{
+    int i;
+
+    *name=0;
+    for(i=1; i<62; i++)
+    {
+        if((int)strlen(hpack_static[i][0])!=f->nlen || memcmp(hpack_static[i][0],f->name,f->nlen))
+            continue;
+        if(*name==0)
+            *name=i;
+        if((int)strlen(hpack_static[i][1])==f->vlen && memcmp(hpack_static[i][1],f->value,f->vlen)==0)
+            return i;
+    }
+    return 0;
+}
+
+static int h2_field_eq(const struct h2_field *a,const struct h2_field *b)
+{
+    return a->nlen==b->nlen && a->vlen==b->vlen &&
+           memcmp(a->name,b->name,a->nlen)==0 && memcmp(a->value,b->value,a->vlen)==0;
+}
+
+static void h2_field_set(struct h2_field *f,const char *name,int nlen,const char *value,int vlen)
+{
+    f->name=name;
+    f->nlen=nlen;
+    f->value=value;
+    f->vlen=vlen;
+}
+
+/*
+把一个HTTP/1.1请求报文拆成HTTP/2的字段，返回字段个数，buf是报文的一份拷贝，字段指向它
+请求行变成:method和:path，Host变成:authority，只对HTTP/1.1的连接有意义的字段去掉，字段名改成小写
+*/
+static int h2_fields(char *buf,struct h2_field *f)
+{
+    static const char *const drop[]={"connection","keep-alive","proxy-connection","transfer-encoding","upgrade"};
+    char *p,*q,*line,*colon;
+    int n=4,nlen,i;
+
+    p=strchr(buf,' ');
+    q=strchr(p+1,' ');
+    h2_field_set(&f[0],":method",7,buf,p-buf);
+    h2_field_set(&f[1],":scheme",7,"http",4);
+    h2_field_set(&f[2],":authority",10,"",0);
+    h2_field_set(&f[3],":path",5,p+1,q-p-1);
+
+    for(line=strstr(q,"\r\n")+2; (p=strstr(line,"\r\n"))!=NULL && p>line; line=p+2)
+    {
+        colon=memchr(line,':',p-line);
+        if(colon==NULL)
+            continue;
+        nlen=colon-line;
+        for(q=line; q<colon; q++)
+            *q=tolower((unsigned char)*q);
+        for(q=colon+1; q<p && *q==' '; q++)
+            ;
+
+        if(nlen==4 && memcmp(line,"host",4)==0)
+        {
+            h2_field_set(&f[2],":authority",10,q,p-q);
+            continue;
+        }
+        for(i=0; i<(int)(sizeof(drop)/sizeof(drop[0])); i++)
+            if((int)strlen(drop[i])==nlen && memcmp(drop[i],line,nlen)==0)
+                break;
+        if(i<(int)(sizeof(drop)/sizeof(drop[0])) || n==H2_MAX_FIELDS)
+            continue;
+        h2_field_set(&f[n++],line,nlen,q,p-q);
+    }
+
+    return n;
+}
+
+//len字节的报头块按fm切成HEADERS和CONTINUATION帧后连同帧头的长度
+static int h2_headers_len(int len,int fm)
+{
+    return len+9*(len>0?(len+fm-1)/fm:1);
+}
+
+/*
+开始测试前把每个条目的请求编码成三份报头块
+所有条目都有的字段(按第一个条目中的顺序)在first中依次加进动态表，
+它们在表中的位置因此是固定的，indexed直接引用，不管第一个请求是哪个条目
+*/
+static int h2_setup(void)
+{
+    static struct h2_field common[H2_MAX_FIELDS];
+    static int tmpl[H2_MAX_FIELDS];
+    struct h2_field (*fields)[H2_MAX_FIELDS];
+    char **bufs;
+    int *nfields;
+    int ncommon=0,e,i,j,k,b,idx,name,found,start,max,vmax=0;
+
+    huff_init();
+
+    fields=workload_realloc(NULL,sizeof(*fields)*nentries);
+    nfields=workload_realloc(NULL,sizeof(int)*nentries);
+    bufs=workload_realloc(NULL,sizeof(char *)*nentries);
+    h2_requests=workload_realloc(NULL,sizeof(struct h2_request)*nentries);
+
+    for(e=0; e<nentries; e++)
+    {
+        bufs[e]=workload_realloc(NULL,entries[e].hlen+1);
+        memcpy(bufs[e],arena+entries[e].off,entries[e].hlen);
+        bufs[e][entries[e].hlen]='\0';
+        nfields[e]=h2_fields(bufs[e],fields[e]);
+    }
+
+    //所有条目都有的字段，:method和:path每个条目不一样，静态表里有的不用再加，值有变量的每次都不一样
+    for(i=1; i<nfields[0]; i++)
+    {
+        if(i==3 || hpack_find(&fields[0][i],&name) ||
+           tmpl_find(fields[0][i].value,fields[0][i].value+fields[0][i].vlen,'{'))
+            continue;
+        for(e=1; e<nentries; e++)
+        {
+            for(j=0; j<nfields[e] && !h2_field_eq(&fields[0][i],&fields[e][j]); j++)
+                ;
+            if(j==nfields[e])
+                break;
+        }
+        if(e<nentries || h2_common_size+fields[0][i].nlen+fields[0][i].vlen+32>HPACK_TABLE_SIZE)
+            continue;
+        common[ncommon++]=fields[0][i];
+        h2_common_size+=fields[0][i].nlen+fields[0][i].vlen+32;
+    }
+
+    //每个条目中这些字段的先后顺序必须一样，否则不用动态表
+    for(e=0; e<nentries && ncommon>0; e++)
+    {
+        for(i=0,k=0; i<nfields[e]; i++)
+        {
+            for(j=0; j<ncommon && !h2_field_eq(&common[j],&fields[e][i]); j++)
+                ;
+            if(j==ncommon)
+                continue;
+            if(j!=k++)
+                break;
+        }
+        if(i<nfields[e] || k!=ncommon)
+            ncommon=h2_common_size=0;
+    }
+
+    for(e=0; e<nentries; e++)
+    {
+        //值里有变量的字段各自编译成模板，HTTP/1.1报文的模板在这里用不上
+        for(i=0; i<nfields[e]; i++)
+        {
+            tmpl[i]=entries[e].tmpl<0?-1:tmpl_compile(fields[e][i].value,fields[e][i].vlen,entries[e].url);
+            if(tmpl[i]>=0 && tmpls[tmpl[i]].max>vmax)
+                vmax=tmpls[tmpl[i]].max;
+        }
+
+        for(b=0; b<3; b++)
+        {
+            h2_requests[e].part[b]=nh2_parts;
+            h2_part_start=start=h2_blocks_len;
+            max=0;
+            for(i=0,k=0; i<nfields[e]; i++)
+            {
+                idx=hpack_find(&fields[e][i],&name);
+                found=k<ncommon && h2_field_eq(&common[k],&fields[e][i]);
+                if(found)
+                    k++;
+
+                //名字照常编码，值的长度和内容开流时再写，长度最多3个字节
+                if(tmpl[i]>=0)
+                {
+                    h2_put_int(0x00,4,name);
+                    if(name==0)
+                    {
+                        h2_put_int(0,7,fields[e][i].nlen);
+                        h2_put(fields[e][i].name,fields[e][i].nlen);
+                    }
+                    h2_part_end(tmpl[i]);
+                    max+=3+tmpls[tmpl[i]].max;
+                }
+                else if(idx>0)
+                    h2_put_int(0x80,7,idx);
+                else if(found && b==H2_BLOCK_FIRST)
+                    h2_put_literal(0x40,name,&fields[e][i]);
+                else if(found && b==H2_BLOCK_INDEXED)
+                    h2_put_int(0x80,7,62+ncommon-k);//最早加进去的索引最大
+                else
+                    h2_put_literal(0x00,name,&fields[e][i]);
+            }
+            h2_part_end(-1);
+            h2_requests[e].npart[b]=nh2_parts-h2_requests[e].part[b];
+            h2_requests[e].max[b]=max+h2_blocks_len-start;
+            if(h2_requests[e].max[b]>h2_block_max[b])
+                h2_block_max[b]=h2_requests[e].max[b];
+        }
+        free(bufs[e]);
+    }
+    h2_value=workload_realloc(NULL,vmax+1);
+
+    //报头块连同动态表大小的更新和切成帧的帧头，要能一次放进发送缓冲区
+    for(b=0; b<3; b++)
+        if(h2_headers_len(8+h2_block_max[b],H2_FRAME_MAX)>H2_OUT_SIZE-H2_OUT_RESERVE)
+        {
+            fprintf(stderr,"Request headers too large for HTTP/2,%d bytes encoded,at most %d\n",
+                    h2_block_max[b],H2_OUT_SIZE-H2_OUT_RESERVE-8-9*2);
+            return 2;
+        }
+
+    free(fields);
+    free(nfields);
+    free(bufs);
+    return 0;
+}
+
+/* 帧 */
+
+static unsigned int h2_u32(const unsigned char *p)
+{
+    return (unsigned int)p[0]<<24|p[1]<<16|p[2]<<8|p[3];
+}
+
+static void h2_put_u32(unsigned char *p,unsigned int v)
+{
+    p[0]=v>>24;
+    p[1]=v>>16;
+    p[2]=v>>8;
+    p[3]=v;
+}
+
+//发送缓冲区还放得下一个len字节的帧
+static int h2_room(const struct h2_conn *h,int len)
+{
+    return H2_OUT_SIZE-h->olen>=9+len;
+}
+
+//要往发送缓冲区里写了，没有时从池里取一个
+static void h2_out(struct h2_conn *h)
+{
+    if(h->out==NULL)
+        h->out=slab_alloc(&h2_out_slab);
+}
+
+//在发送缓冲区末尾写一个帧头，返回帧的内容要写到的位置，调用的地方保证放得下
+static unsigned char *h2_frame(struct h2_conn *h,int len,int type,int flags,int id)
+{
+    unsigned char *p;
+
+    h2_out(h);
+    p=(unsigned char *)h->out+h->olen;
+
+    p[0]=len>>16;
+    p[1]=len>>8;
+    p[2]=len;
+    p[3]=type;
+    p[4]=flags;
+    h2_put_u32(p+5,id&H2_MAX_ID);
+    h->olen+=9+len;
+    return p+9;
+}
+
+static void h2_window_update(struct h2_conn *h,int id,int n)
+{
+    h2_put_u32(h2_frame(h,4,H2_WINDOW_UPDATE,0,id),n);
+}
+
+//按流号找正在进行的流
+static struct h2_stream *h2_find(struct h2_conn *h,int id)
+{
+    int i;
+
+    for(i=0; i<streams; i++)
+        if(h->streams[i].id==id)
+            return &h->streams[i];
+    return NULL;
+}
+
+//服务器在流号上发来帧，这个流号我们从来没有开过
+static int h2_bad_id(const struct h2_conn *h,int id)
+{
+    return id==0 || (id&1)==0 || id>=h->next_id;
+}
+
+/* 连接 */
+
+//epoll引擎的工作进程开始时准备HTTP/2连接的池，连接的状态后面紧跟着它的流
+static void h2_init(void)
+{
+    slab_init(&h2_slab,sizeof(struct h2_conn)+streams*sizeof(struct h2_stream));
+    slab_init(&h2_in_slab,H2_IN_SIZE);
+    slab_init(&h2_out_slab,H2_OUT_SIZE);
+}
+
+//连接关闭了，收发缓冲区里的数据都没用了，还回池里
+static void h2_release(struct h2_conn *h)
+{
+    slab_free(&h2_in_slab,h->in);
+    slab_free(&h2_out_slab,h->out);
+    h->in=h->out=NULL;
+    h->ilen=h->olen=h->ooff=0;
+}
+
+//连接出错：还在进行的流都失败，原因记在reason上，然后关闭连接
+//还没开始发请求就断了的，建立连接时的这个请求算失败
+static void h2_fail(struct conn *c,long long *reason)
+{
+    struct h2_conn *h=c->h2;
+    int i;
+
+    if(!h->ready)
+    {
+        request_fail(c->entry,1);
+        (*reason)++;
+    }
+    for(i=0; i<streams; i++)
+    {
+        if(h->streams[i].id==0)
+            continue;
+        request_fail(h->streams[i].entry,1);
+        (*reason)++;
+        h->streams[i].id=0;
+    }
+    h->nstreams=0;
+    conn_close(c);
+}
+
+//服务器违反了协议，关闭连接，返回-1
+static int h2_protocol_error(struct conn *c)
+{
+    st->h2_protocol++;
+    h2_fail(c,&st->read_failed);
+    return -1;
+}
+
+//发出发送缓冲区中的帧，发不完的等可写事件，失败时关闭连接返回-1
+static int h2_flush(int epfd,struct conn *c)
+{
+    struct h2_conn *h=c->h2;
+    int n;
+
+    if(h->ooff<h->olen)
+    {
+        n=SYSCALL(write(c->fd,h->out+h->ooff,h->olen-h->ooff));
+        if(n<0 && errno!=EAGAIN && errno!=EINTR)
+        {
+            h2_fail(c,&st->send_failed);
+            return -1;
+        }
+        if(n>0)
+            h->ooff+=n;
+    }
+
+    //没发完的挪到前面，后面接着追加，都发出去了就把缓冲区还回池里
+    if(h->ooff>0)
+    {
+        memmove(h->out,h->out+h->ooff,h->olen-h->ooff);
+        h->olen-=h->ooff;
+        h->ooff=0;
+    }
+    if(h->olen==0)
+    {
+        slab_free(&h2_out_slab,h->out);
+        h->out=NULL;
+    }
+
+    if(conn_watch(epfd,c,h->olen>0 || h->more?EPOLLIN|EPOLLOUT:EPOLLIN))
+    {
+        h2_fail(c,&st->send_failed);
+        return -1;
+    }
+    return 0;
+}
+
+//连上了：发出连接序言、SETTINGS和连接的WINDOW_UPDATE，等服务器的SETTINGS
+//失败时关闭连接返回-1
+static int h2_start(int epfd,struct conn *c)
+{
+    struct h2_conn *h=c->h2;
+    unsigned char *p;
+    int i,one=1;
+
+    //槽位第一次连上
+    if(h==NULL)
+    {
+        h=c->h2=slab_alloc(&h2_slab);
+        memset(h,0,sizeof(*h));
+        h->streams=(struct h2_stream *)(h+1);
+    }
+
+    //SETTINGS的应答、WINDOW_UPDATE这些小帧不能被Nagle压住等服务器延迟的ACK
+    setsockopt(c->fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+
+    h->ilen=h->olen=h->ooff=h->more=0;
+    h->nstreams=0;
+    h->limit=streams;
+    h->next_id=1;
+    h->ready=h->closing=0;
+    h->window=H2_DEFAULT_WINDOW;
+    h->init_window=H2_DEFAULT_WINDOW;
+    h->frame_max=H2_FRAME_MAX;
+    h->unacked=0;
+    h->hpack=H2_BLOCK_FIRST;
+    h->table_max=HPACK_TABLE_SIZE;
+    h->table_update=0;
+    h->hstream=0;
+    h->table.first=h->table.n=h->table.size=h->table.blen=0;
+    h->table.max=HPACK_TABLE_SIZE;
+    for(i=0; i<streams; i++)
+        h->streams[i].id=0;
+
+    h2_out(h);
+    memcpy(h->out,H2_PREFACE,24);
+    h->olen=24;
+
+    //不要服务器推送，每个流的接收窗口开大
+    p=h2_frame(h,12,H2_SETTINGS,0,0);
+    p[0]=0;
+    p[1]=H2_SET_ENABLE_PUSH;
+    h2_put_u32(p+2,0);
+    p[6]=0;
+    p[7]=H2_SET_INITIAL_WINDOW_SIZE;
+    h2_put_u32(p+8,H2_WINDOW);
+    h2_window_update(h,0,H2_WINDOW-H2_DEFAULT_WINDOW);
+
+    c->state=CONN_H2;
+    c->phase=now_us();
+    conn_deadline(c,request_timeout);//收到服务器SETTINGS的期限
+    return h2_flush(epfd,c);
+}
+
+//这个连接还能开新的流：测试没结束，连接没有在关闭，负载曲线上也还轮得到它
+static int h2_more(struct conn *c)
+{
+    return !timeout && !c->h2->closing && c-conns_base<nactive;
+}
+
+//发请求正文，一个DATA帧不超过服务器的最大帧长度，也不超过流和连接的发送窗口
+static void h2_send_body(struct h2_conn *h,struct h2_stream *s)
+{
+    int blen=entries[s->entry].blen,n;
+
+    while(s->sent<blen)
+    {
+        n=blen-s->sent;
+        if(n>h->frame_max)
+            n=h->frame_max;
+        if(n>s->window)
+            n=s->window;
+        if(n>h->window)
+            n=h->window;
+        if(n>H2_OUT_SIZE-H2_OUT_RESERVE-h->olen-9)
+            n=H2_OUT_SIZE-H2_OUT_RESERVE-h->olen-9;
+        if(n<=0)
+        {
+            //窗口用完了，等服务器的WINDOW_UPDATE，发送缓冲区满了不算
+            if(s->window>0 && h->window>0)
+                h->more=1;
+            else if(!s->stalled)
+            {
+                s->stalled=1;
+                st->h2_stalls++;
+            }
+            return;
+        }
+
+        s->stalled=0;
+        memcpy(h2_frame(h,n,H2_DATA,s->sent+n==blen?H2_END_STREAM:0,s->id),body+s->sent,n);
+        s->sent+=n;
+        s->window-=n;
+        h->window-=n;
+
+        //请求发完了，开始等回复
+        if(s->sent==blen)
+            s->phase=now_us();
+    }
+}
+
+//把第b份报头块写到dst，有变量的字段值在这里渲染，返回长度
+static int h2_block(const struct h2_request *r,int b,unsigned char *dst)
+{
+    const struct h2_part *pt=&h2_parts[r->part[b]],*end=pt+r->npart[b];
+    unsigned char *p=dst;
+    int n;
+
+    for(; pt<end; pt++)
+    {
+        memcpy(p,h2_blocks+pt->off,pt->len);
+        p+=pt->len;
+        if(pt->tmpl<0)
+            continue;
+        n=tmpl_render(pt->tmpl,h2_value);
+        p+=hpack_put_int(p,0,7,n);
+        memcpy(p,h2_value,n);
+        p+=n;
+    }
+
+    return p-dst;
+}
+
+/*
+报头块已经写在发送缓冲区的帧头后面，比服务器允许的帧长时切成一个HEADERS和几个CONTINUATION帧，
+从后往前把每一段往后挪，腾出它的帧头，中间不能夹别的帧
+flags是HEADERS帧的标志，END_HEADERS只放在最后一帧上
+*/
+static void h2_headers_out(struct h2_conn *h,int len,int flags,int id)
+{
+    unsigned char *p=(unsigned char *)h->out+h->olen+9;
+    int fm=h->frame_max,n=len>0?(len+fm-1)/fm:1,k,m;
+
+    for(k=n-1; k>0; k--)
+        memmove(p+k*(fm+9),p+k*fm,k==n-1?len-k*fm:fm);
+
+    for(k=0; k<n; k++)
+    {
+        m=k==n-1?len-k*fm:fm;
+        h2_frame(h,m,k==0?H2_HEADERS:H2_CONTINUATION,(k==0?flags:0)|(k==n-1?H2_END_HEADERS:0),id);
+    }
+}
+
+//开一个新的流，发出请求的HEADERS，发送缓冲区放不下时返回0
+static int h2_stream_open(struct h2_conn *h)
+{
+    struct h2_stream *s;
+    struct h2_request *r;
+    unsigned char up[8],*p;
+    int e,b,ulen=0,len,i;
+
+    //第一个请求把共有的字段加进动态表，服务器给的表放不下时都用字面值
+    b=h->hpack;
+    if(b==H2_BLOCK_FIRST && h2_common_size>h->table_max)
+        b=h->hpack=H2_BLOCK_PLAIN;
+    if(h->table_update)
+        ulen=hpack_put_int(up,0x20,5,h->table_max);
+
+    //按最长的报头块检查，放得下再抽条目，不然长的条目会比短的更常被跳过，各条目的比例就偏了
+    if(h->olen+h2_headers_len(ulen+h2_block_max[b],h->frame_max)>H2_OUT_SIZE-H2_OUT_RESERVE)
+        return 0;
+    e=workload_pick();
+    r=&h2_requests[e];
+
+    for(i=0; h->streams[i].id; i++)
+        ;
+    s=&h->streams[i];
+
+    //报头块先写到帧头后面，长度确定了再写帧头
+    h2_out(h);
+    p=(unsigned char *)h->out+h->olen+9;
+    memcpy(p,up,ulen);
+    len=ulen+h2_block(r,b,p+ulen);
+    h2_headers_out(h,len,entries[e].blen?0:H2_END_STREAM,h->next_id);
+    h->table_update=0;
+    if(b==H2_BLOCK_FIRST)
+        h->hpack=H2_BLOCK_INDEXED;
+
+    s->id=h->next_id;
+    s->entry=e;
+    s->sent=0;
+    s->window=h->init_window;
+    s->unacked=0;
+    s->stalled=0;
+    s->replied=0;
+    s->start=now_us();
+    s->phase=s->start;
+    http_resp_init(&s->resp,entries[e].head);
+    h->nstreams++;
+    st->h2_streams++;
+
+    //正文紧跟在HEADERS后面，窗口不够的部分等服务器的WINDOW_UPDATE
+    if(s->sent<entries[e].blen)
+        h2_send_body(h,s);
+
+    //流号用完了，这个连接上不再开新的流
+    if(h->next_id>H2_MAX_ID-2)
+        h->closing=1;
+    else
+        h->next_id+=2;
+    return 1;
+}
+
+//往发送缓冲区里放请求：还没发完的正文、新的流，然后发出去
+//流都结束了而这个连接不能再开新的流时关闭连接，返回-1表示连接已经关闭
+static int h2_pump(int epfd,struct conn *c)
+{
+    struct h2_conn *h=c->h2;
+    int i;
+
+    if(h->ready)
+    {
+        h->more=0;
+        for(i=0; i<streams; i++)
+            if(h->streams[i].id && h->streams[i].sent<entries[h->streams[i].entry].blen)
+                h2_send_body(h,&h->streams[i]);
+
+        while(h->nstreams<h->limit && h2_more(c) && h2_stream_open(h))
+            ;
+
+        //定时器不会晚于进行中的流最早的期限，到期时再改到剩下的流中最早的
+        if(request_timeout>0 && h->nstreams>0 && !timer_armed(&c->timer))
+            conn_deadline(c,request_timeout);
+
+        //GOAWAY之后、流号用完或者负载降下来了，最后一个流结束就关闭连接，由epoll引擎决定重连还是停下
+        if(h->nstreams==0 && !h2_more(c) && !timeout && h->olen==0)
+        {
+            conn_close(c);
+            return -1;
+        }
+    }
+
+    return h2_flush(epfd,c);
+}
+
+//流结束了：回复完整，和HTTP/1.1的回复一样按条目和状态码记录并检查
+static void h2_stream_done(struct h2_conn *h,struct h2_stream *s)
+{
+    phase_record(&hs->transfer,s->phase);
+    s->resp.state=RESP_DONE;
+    resp_complete(&s->resp);
+    request_done(s->entry,s->start,1,&s->resp);
+    s->id=0;
+    h->nstreams--;
+}
+
+//流在回复结束前被服务器放弃了
+static void h2_stream_fail(struct h2_conn *h,struct h2_stream *s,long long *reason)
+{
+    request_fail(s->entry,1);
+    (*reason)++;
+    s->id=0;
+    h->nstreams--;
+}
+
+//连接的定时器到期了：还没收到服务器的SETTINGS时连接超时，否则超过--timeout的流都算失败
+//定时器改到剩下的流中最早的期限，空出来的流立刻开新的
+static void h2_timer(int epfd,struct conn *c)
+{
+    struct h2_conn *h=c->h2;
+    struct h2_stream *s;
+    long long now=now_us(),first=0,t;
+    int i;
+
+    if(!h->ready)
+    {
+        h2_fail(c,&st->timeouts);
+        return;
+    }
+
+    for(i=0; i<streams; i++)
+    {
+        s=&h->streams[i];
+        if(s->id==0)
+            continue;
+        t=s->start+request_timeout*1000LL;
+        if(t>now)
+        {
+            if(first==0 || t<first)
+                first=t;
+            continue;
+        }
+
+        //告诉服务器不用再回复了，发送缓冲区满了就不告诉，后面的回复按不认识的流号丢掉
+        if(h2_room(h,4))
+            h2_put_u32(h2_frame(h,4,H2_RST_STREAM,0,s->id),H2_CANCEL);
+        h2_stream_fail(h,s,&st->timeouts);
+    }
+
+    if(first>0)
+        timer_add(&wheel,&c->timer,first);
+    h2_pump(epfd,c);
+}
+
+//去掉DATA和HEADERS的填充，成功返回0
+static int h2_unpad(int flags,const unsigned char **p,int *len)
+{
+    int pad;
+
+    if(!(flags&H2_PADDED))
+        return 0;
+    if(*len<1)
+        return -1;
+    pad=**p;
+    if(pad>=*len)
+        return -1;
+    (*p)++;
+    *len-=1+pad;
+    return 0;
+}
+
+//一个完整的报头块：解码，第一个最终回复的报头表示服务器开始回复了，带END_STREAM时流结束
+static int h2_headers(struct conn *c,int id,int flags,const unsigned char *p,int len)
+{
+    struct h2_conn *h=c->h2;
+    struct h2_stream *s;
+    int status;
+
+    status=hpack_decode(&h->table,p,len);
+    if(status<0)
+        return h2_protocol_error(c);
+
+    if(h2_bad_id(h,id))
+        return h2_protocol_error(c);
+    s=h2_find(h,id);
+    if(s==NULL)
+        return 0;
+
+    if(!s->replied)
+    {
+        //1xx只是中间的回复，真正的回复在后面
+        if(status>=100 && status<200 && !(flags&H2_END_STREAM))
+            return 0;
+        s->replied=1;
+        s->resp.status=status;
+        phase_record(&hs->ttfb,s->phase);
+        s->phase=now_us();
+    }
+
+    if(flags&H2_END_STREAM)
+        h2_stream_done(h,s);
+    return 0;
+}
+
+//回复的正文，用掉的窗口累计到一半时还给服务器
+static int h2_data(struct conn *c,int id,int flags,const unsigned char *p,int len)
+{
+    struct h2_conn *h=c->h2;
+    struct h2_stream *s;
+    int n=len;
+
+    h->unacked+=len;
+    if(h->unacked>=H2_WINDOW/2)
+    {
+        h2_window_update(h,0,h->unacked);
+        h->unacked=0;
+    }
+
+    if(h2_bad_id(h,id) || h2_unpad(flags,&p,&n))
+        return h2_protocol_error(c);
+    s=h2_find(h,id);
+    if(s==NULL)
+        return 0;
+    if(!s->replied)
+        return h2_protocol_error(c);
+
+    resp_body(&s->resp,(const char *)p,n);
+    if(flags&H2_END_STREAM)
+    {
+        h2_stream_done(h,s);
+        return 0;
+    }
+
+    s->unacked+=len;
+    if(s->unacked>=H2_WINDOW/2)
+    {
+        h2_window_update(h,id,s->unacked);
+        s->unacked=0;
+    }
+    return 0;
+}
+
+//服务器的SETTINGS：按它的限制调整，然后应答，第一个SETTINGS到了连接才算建立好
+static int h2_settings(struct conn *c,int flags,const unsigned char *p,int len)
+{
+    struct h2_conn *h=c->h2;
+    unsigned int v;
+    int id,i,k;
+
+    if(flags&H2_ACK)
+        return len?h2_protocol_error(c):0;
+    if(len%6)
+        return h2_protocol_error(c);
+
+    for(k=0; k<len; k+=6)
+    {
+        id=p[k]<<8|p[k+1];
+        v=h2_u32(p+k+2);
+        switch(id)
+        {
+        case H2_SET_HEADER_TABLE_SIZE:
+            //表变小了要在下一个报头块前面告诉服务器，放不下共有的字段时不再引用动态表
+            if(v<(unsigned int)h->table_max)
+            {
+                h->table_max=v;
+                h->table_update=1;
+                if(h->hpack==H2_BLOCK_INDEXED && h2_common_size>h->table_max)
+                    h->hpack=H2_BLOCK_PLAIN;
+            }
+            break;
+
+        case H2_SET_MAX_CONCURRENT_STREAMS:
+            h->limit=v<(unsigned int)streams?(int)v:streams;
+            st->h2_max_streams=v>INT_MAX?INT_MAX:(int)v;
+            break;
+
+        case H2_SET_INITIAL_WINDOW_SIZE:
+            //已经开着的流的窗口跟着一起变
+            if(v>H2_MAX_ID)
+                return h2_protocol_error(c);
+            for(i=0; i<streams; i++)
+                if(h->streams[i].id)
+                    h->streams[i].window+=(int)v-h->init_window;
+            h->init_window=v;
+            break;
+
+        case H2_SET_MAX_FRAME_SIZE:
+            if(v<H2_FRAME_MAX || v>0xffffff)
+                return h2_protocol_error(c);
+            h->frame_max=v;
+            break;
+        }
+    }
+
+    h2_frame(h,0,H2_SETTINGS,H2_ACK,0);
+    if(!h->ready)
+    {
+        h->ready=1;
+        st->h2_conns++;
+        phase_record(&hs->h2_setup,c->phase);
+    }
+    return 0;
+}
+
+//处理一个完整的帧，出错时连接已经关闭，返回-1
+static int h2_frame_in(struct conn *c,const unsigned char *f,int len)
+{
+    struct h2_conn *h=c->h2;
+    struct h2_stream *s;
+    const unsigned char *p=f+9;
+    int type=f[3],flags=f[4],id=h2_u32(f+5)&H2_MAX_ID,i;
+    unsigned int v;
+
+    //报头块没有结束时只能接着收同一个流的CONTINUATION，第一个帧必须是SETTINGS
+    if(h->hstream && (type!=H2_CONTINUATION || id!=h->hstream))
+        return h2_protocol_error(c);
+    if(!h->ready && type!=H2_SETTINGS)
+        return h2_protocol_error(c);
+
+    //应答和WINDOW_UPDATE总是放得下，除非服务器发来的控制帧多得不正常
+    if(!h2_room(h,H2_OUT_RESERVE/2))
+        return h2_protocol_error(c);
+
+    //回复的字节数记在流对应的条目上
+    if(type==H2_DATA || type==H2_HEADERS || type==H2_CONTINUATION)
+    {
+        s=h2_find(h,id);
+        if(s!=NULL && id!=0)
+            request_bytes(s->entry,9+len);
+    }
+
+    switch(type)
+    {
+    case H2_DATA:
+        return h2_data(c,id,flags,p,len);
+
+    case H2_HEADERS:
+        if(h2_unpad(flags,&p,&len))
+            return h2_protocol_error(c);
+        if(flags&H2_PRIO)
+        {
+            if(len<5)
+                return h2_protocol_error(c);
+            p+=5;
+            len-=5;
+        }
+        if(flags&H2_END_HEADERS)
+            return h2_headers(c,id,flags,p,len);
+
+        //报头块分在几个帧里，先拼起来
+        h->hstream=id;
+        h->hflags=flags;
+        h->hlen=0;
+        /* fall through */
+    case H2_CONTINUATION:
+        if(h->hstream==0)
+            return h2_protocol_error(c);
+        if(h->hlen+len>h->hcap)
+        {
+            h->hcap=h->hlen+len;
+            h->hbuf=realloc(h->hbuf,h->hcap);
+            if(h->hbuf==NULL)
+            {
+                h->hcap=0;
+                return h2_protocol_error(c);
+            }
+        }
+        memcpy(h->hbuf+h->hlen,p,len);
+        h->hlen+=len;
+        if(type==H2_CONTINUATION && (flags&H2_END_HEADERS))
+        {
+            h->hstream=0;
+            return h2_headers(c,id,h->hflags,(unsigned char *)h->hbuf,h->hlen);
+        }
+        return 0;
+
+    case H2_RST_STREAM:
+        if(len!=4 || h2_bad_id(h,id))
+            return h2_protocol_error(c);
+        s=h2_find(h,id);
+        if(s!=NULL)
+            h2_stream_fail(h,s,&st->h2_reset);
+        return 0;
+
+    case H2_SETTINGS:
+        if(id!=0)
+            return h2_protocol_error(c);
+        return h2_settings(c,flags,p,len);
+
+    case H2_PING:
+        if(len!=8 || id!=0)
+            return h2_protocol_error(c);
+        if(!(flags&H2_ACK))
+            memcpy(h2_frame(h,8,H2_PING,H2_ACK,0),p,8);
+        return 0;
+
+    case H2_GOAWAY:
+        //编号更大的流服务器没有处理，这个连接不再开新的流
+        if(len<8 || id!=0)
+            return h2_protocol_error(c);
+        st->h2_goaway++;
+        h->closing=1;
+        v=h2_u32(p)&H2_MAX_ID;
+        for(i=0; i<streams; i++)
+            if(h->streams[i].id>(int)v)
+                h2_stream_fail(h,&h->streams[i],&st->h2_unprocessed);
+        return 0;
+
+    case H2_WINDOW_UPDATE:
+        if(len!=4)
+            return h2_protocol_error(c);
+        v=h2_u32(p)&H2_MAX_ID;
+        if(v==0)
+            return h2_protocol_error(c);
+        if(id==0)
+        {
+            h->window+=v;
+            if(h->window>H2_MAX_ID)
+                return h2_protocol_error(c);
+            return 0;
+        }
+        s=h2_find(h,id);
+        if(s!=NULL)
+        {
+            if((long long)s->window+v>H2_MAX_ID)
+                return h2_protocol_error(c);
+            s->window+=v;
+        }
+        return 0;
+
+    case H2_PUSH_PROMISE:
+        //SETTINGS里已经关掉了推送
+        return h2_protocol_error(c);
+    }
+
+    //PRIORITY和不认识的帧忽略
+    return 0;
+}
+
+//收到的帧都处理完了，没有留下不完整的帧，接收缓冲区还回池里
+static void h2_in_release(struct h2_conn *h)
+{
+    if(h->ilen>0)
+        return;
+    slab_free(&h2_in_slab,h->in);
+    h->in=NULL;
+}
+
+//读服务器发来的帧，处理所有完整的帧，连接被关闭时返回-1
+static int h2_read(struct conn *c)
+{
+    struct h2_conn *h=c->h2;
+    unsigned char *p;
+    int n,len,pos=0;
+
+    //数据到了才从池里取接收缓冲区
+    if(h->in==NULL)
+        h->in=slab_alloc(&h2_in_slab);
+    n=SYSCALL(read(c->fd,h->in+h->ilen,H2_IN_SIZE-h->ilen));
+    if(n<0)
+    {
+        if(errno==EAGAIN || errno==EINTR)
+        {
+            h2_in_release(h);
+            return 0;
+        }
+        h2_fail(c,&st->read_failed);
+        return -1;
+    }
+
+    //服务器关闭了连接，没有流在进行时(比如GOAWAY之后)不算失败
+    if(n==0)
+    {
+        if(h->ready && h->nstreams==0)
+            conn_close(c);
+        else
+            h2_fail(c,&st->read_failed);
+        return -1;
+    }
+
+    h->ilen+=n;
+    while(h->ilen-pos>=9)
+    {
+        p=(unsigned char *)h->in+pos;
+        len=p[0]<<16|p[1]<<8|p[2];
+        if(len>H2_FRAME_MAX)
+            return h2_protocol_error(c);
+        if(h->ilen-pos<9+len)
+            break;
+        if(h2_frame_in(c,p,len))
+            return -1;
+        pos+=9+len;
+    }
+
+    memmove(h->in,h->in+pos,h->ilen-pos);
+    h->ilen-=pos;
+    h2_in_release(h);
+    return 0;
+}
+
+//epoll引擎把CONN_H2状态的连接上的事件交给这里
+static void h2_event(int epfd,struct conn *c,int events)
+{
+    if((events&(EPOLLIN|EPOLLERR|EPOLLHUP)) && h2_read(c))
+        return;
+    h2_pump(epfd,c);
+}
+
+//HTTP/2连接上的情况：连接和流的个数、每个连接的吞吐、建立的耗时，以及服务器放弃的流
+static void h2_print(const struct stats *t,const struct hists *h)
+{
+    if(!h2c)
+        return;
+
+    printf("HTTP/2:%lld connections,%lld streams,%.1f streams per connection\n",
+           t->h2_conns,t->h2_streams,t->h2_conns?t->h2_streams/(double)t->h2_conns:0.0);
+    printf("Per connection:%.1f streams/s,%.0f bytes/s\n",
+           t->speed/(double)benchtime/clients,t->bytes/(double)benchtime/clients);
+    hist_print_line("h2 setup",&h->h2_setup);
+    printf("Streams reset by server:%lld,GOAWAY received:%lld,unprocessed after GOAWAY:%lld\n",
+           t->h2_reset,t->h2_goaway,t->h2_unprocessed);
+    printf("Protocol errors:%lld,flow-control stalls:%lld",t->h2_protocol,t->h2_stalls);
+    if(t->h2_max_streams>0)
+        printf(",server allows %d concurrent streams",t->h2_max_streams);
+    printf("\n");
+}
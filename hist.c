@@ -0,0 +1,178 @@
+/*
+
+请求延迟直方图：
+
+每个请求的耗时都要记录下来，但是不能把每个值都存下来
+所以按数值大小分桶计数，桶的宽度随数值增大而增大(对数-线性分桶，类似HdrHistogram)：
+
+    0~127微秒        每微秒一个桶，精确记录
+    128~255微秒      每2微秒一个桶
+    256~511微秒      每4微秒一个桶
+    ...
+    每翻一倍的区间都分成64个桶，所以任何值的相对误差都不超过1/64
+
+这样记录一次只是一次下标计算和一次加法
+两个直方图合并就是对应的桶相加，合并之后的百分位数仍然是准确的
+(不能把每个子进程的百分位数求平均)
+
+*/
+
+#define HIST_SUB_BITS 6                      //每个区间分成2^6=64个桶
+#define HIST_SUB_COUNT (1<<HIST_SUB_BITS)
+#define HIST_MAX_BITS 40                     //最大记录到2^40微秒，约12天
+#define HIST_BUCKETS ((HIST_MAX_BITS-HIST_SUB_BITS)*HIST_SUB_COUNT+HIST_SUB_COUNT)
+
+struct histogram
+{
+    long long count;  //记录的总次数
+    long long sum;    //所有值的和，用来算平均值
+    long long max;    //最大值，单独精确记录
+    long long buckets[HIST_BUCKETS];
+};
+
+//单调时钟，单位微秒，不受系统时间被修改的影响
+static long long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+//值所在的桶的下标
+static int hist_index(long long v)
+{
+    int m,shift;
+
+    if(v<0)
+        v=0;
+
+    //小于128的值每个值一个桶
+    if(v<2*HIST_SUB_COUNT)
+        return (int)v;
+
+    //m是最高位的位置，v>>shift的结果落在[64,128)之间
+    m=63-__builtin_clzll((unsigned long long)v);
+    if(m>=HIST_MAX_BITS)
+        return HIST_BUCKETS-1;
+    shift=m-HIST_SUB_BITS;
+
+    return shift*HIST_SUB_COUNT+(int)(v>>shift);
+}
+
+//桶内的最大值，报告百分位数时用它，保证不会低估
+static long long hist_value(int idx)
+{
+    int shift;
+
+    if(idx<2*HIST_SUB_COUNT)
+        return idx;
+
+    shift=idx/HIST_SUB_COUNT-1;
+    return ((long long)(idx%HIST_SUB_COUNT+HIST_SUB_COUNT+1)<<shift)-1;
+}
+
+//记录n次值v，流水线上同一批完成的回复延迟相同
+static void hist_record_n(struct histogram *h,long long v,int n)
+{
+    if(v<0)
+        v=0;
+
+    h->buckets[hist_index(v)]+=n;
+    h->count+=n;
+    h->sum+=v*n;
+    if(v>h->max)
+        h->max=v;
+}
+
+//把src合并到dst中，合并就是对应的桶相加
+//src没有记录过时什么也不做，共享内存里没用到的直方图不会因为读一遍就被分配出来
+static void hist_merge(struct histogram *dst,const struct histogram *src)
+{
+    int i;
+
+    if(src->count==0)
+        return;
+    for(i=0; i<HIST_BUCKETS; i++)
+        dst->buckets[i]+=src->buckets[i];
+    dst->count+=src->count;
+    dst->sum+=src->sum;
+    if(src->max>dst->max)
+        dst->max=src->max;
+}
+
+//合并到几个进程同时在合并的dst中，用原子加法，只加不为0的桶
+static void hist_merge_atomic(struct histogram *dst,const struct histogram *src)
+{
+    long long max;
+    int i;
+
+    if(src->count==0)
+        return;
+    for(i=0; i<HIST_BUCKETS; i++)
+        if(src->buckets[i]!=0)
+            __atomic_fetch_add(&dst->buckets[i],src->buckets[i],__ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->count,src->count,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->sum,src->sum,__ATOMIC_RELAXED);
+
+    max=__atomic_load_n(&dst->max,__ATOMIC_RELAXED);
+    while(src->max>max && !__atomic_compare_exchange_n(&dst->max,&max,src->max,0,__ATOMIC_RELAXED,__ATOMIC_RELAXED))
+        ;
+}
+
+//百分位数，p取值0~100
+static long long hist_percentile(const struct histogram *h,double p)
+{
+    long long want,seen=0;
+    int i;
+
+    if(h->count==0)
+        return 0;
+
+    //至少要有want个值小于等于结果
+    want=(long long)(p/100.0*h->count+0.5);
+    if(want<1)
+        want=1;
+
+    for(i=0; i<HIST_BUCKETS; i++)
+    {
+        seen+=h->buckets[i];
+        if(seen>=want)
+            break;
+    }
+
+    //桶的上界可能超过实际的最大值
+    if(i>=HIST_BUCKETS || hist_value(i)>h->max)
+        return h->max;
+    return hist_value(i);
+}
+
+//打印延迟分布，单位毫秒
+static void hist_print(const struct histogram *h)
+{
+    printf("Latency distribution:\n");
+    if(h->count==0)
+    {
+        printf("no successful requests\n");
+        return;
+    }
+    printf("mean:%.3f ms\n",h->sum/(double)h->count/1000.0);
+    printf("p50:%.3f ms\n",hist_percentile(h,50)/1000.0);
+    printf("p90:%.3f ms\n",hist_percentile(h,90)/1000.0);
+    printf("p99:%.3f ms\n",hist_percentile(h,99)/1000.0);
+    printf("p99.9:%.3f ms\n",hist_percentile(h,99.9)/1000.0);
+    printf("max:%.3f ms\n",h->max/1000.0);
+}
+
+//一行打印一个阶段的耗时分布，单位毫秒
+static void hist_print_line(const char *name,const struct histogram *h)
+{
+    if(h->count==0)
+    {
+        printf("%-9s no samples\n",name);
+        return;
+    }
+    printf("%-9s mean:%.3f p50:%.3f p90:%.3f p99:%.3f max:%.3f ms\n",name,
+           h->sum/(double)h->count/1000.0,hist_percentile(h,50)/1000.0,
+           hist_percentile(h,90)/1000.0,hist_percentile(h,99)/1000.0,h->max/1000.0);
+}
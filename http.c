@@ -0,0 +1,452 @@
+/*
+
+http回复报文的增量解析：
+
+长连接上一个连接要依次收多个回复，不能再靠"读到对端关闭"来判断回复结束
+必须根据回复报文本身找到结尾：
+
+    HTTP/1.1 200 OK                状态行
+    Content-Length: 1234           有长度：正文就是这么多字节
+    Transfer-Encoding: chunked     分块：每块前面是十六进制长度，长度为0的块表示结束
+                                   空行，报头结束
+    ...正文...
+
+HEAD请求的回复、204、304以及1xx都没有正文
+两者都没有时只能读到对端关闭为止，这样的连接不能复用
+
+数据是一段一段从socket读上来的，报文可能在任意位置被截断
+所以解析器是一个状态机，每次喂给它一段数据，它记住解析到哪里了
+状态行逐字节解析，不拷贝；报头只保留每行开头的一小段用来识别关心的字段
+
+服务器飞快地回503也是"读到了完整的回复"，所以每个完整的回复还要：
+    按状态码分类(2xx/3xx/4xx/5xx)，分别计数，由调用的地方记录各类的延迟
+    按--expect-status/--expect-length/--expect-crc32检查，不通过的算作失败
+不复用的连接也用同一个解析器，只是回复一直读到对端关闭
+
+--drain时正文不读到用户空间：解析器知道接下来多少字节是正文，
+就用recv(MSG_TRUNC)让内核直接丢掉，只返回丢掉的字节数，不拷贝
+报头和分块长度行仍然要读上来解析，要算正文的校验和时正文也要读上来
+
+*/
+
+#define RESP_STATUS      0  //状态行
+#define RESP_HEADER      1  //报头行
+#define RESP_BODY        2  //按Content-Length读正文
+#define RESP_CHUNK_SIZE  3  //分块长度行
+#define RESP_CHUNK_DATA  4  //分块数据
+#define RESP_CHUNK_END   5  //分块数据后面的\r\n
+#define RESP_TRAILER     6  //最后一块之后的尾部报头
+#define RESP_UNTIL_CLOSE 7  //正文一直到对端关闭
+#define RESP_DONE        8  //一个完整的回复
+#define RESP_ERROR       9  //格式错误，不再解析
+
+//--drain时一次最多丢掉这么多字节
+#define DRAIN_MAX (1<<30)
+
+//状态码的分类，0是解析不出状态码的回复，1~5是1xx~5xx
+#define STATUS_CLASSES 6
+
+//报头行只保留开头这么多字节，足够识别下面几个字段
+#define RESP_LINE_SIZE 48
+
+struct http_resp
+{
+    unsigned char state;
+    unsigned char head;     //对应的请求是HEAD，回复没有正文
+    unsigned char chunked;  //Transfer-Encoding: chunked
+    unsigned char close;    //回复结束后服务器会关闭连接
+    unsigned char has_len;  //有Content-Length
+    short pos;              //状态行中已经解析到的位置
+    int status;             //状态码
+    long long remain;       //正文或当前分块还剩多少字节
+    int llen;               //line中已保存的字节数
+    char line[RESP_LINE_SIZE];
+    long long body;         //已经收到的正文字节数(分块时不含分块的长度行)
+    unsigned int crc;       //正文的CRC-32，只在--expect-crc32时计算
+
+    //已经完整、还没有被request_done()统计的回复
+    int ncls[STATUS_CLASSES];//各类状态码的个数
+    int nbad;                //其中没有通过检查的个数
+};
+
+//CRC-32(和zlib、gzip相同的多项式)的查找表，--expect-crc32时才生成
+static unsigned int crc_table[256];
+
+static void crc32_init(void)
+{
+    unsigned int c;
+    int i,k;
+
+    for(i=0; i<256; i++)
+    {
+        c=i;
+        for(k=0; k<8; k++)
+            c=c&1?0xedb88320U^(c>>1):c>>1;
+        crc_table[i]=c;
+    }
+}
+
+//开始解析下一个回复，流水线上前面回复的统计留着
+static void resp_next(struct http_resp *r)
+{
+    r->state=RESP_STATUS;
+    r->chunked=0;
+    r->close=0;
+    r->has_len=0;
+    r->pos=0;
+    r->status=0;
+    r->remain=0;
+    r->llen=0;
+    r->body=0;
+    r->crc=0xffffffffU;
+}
+
+//开始解析一次请求的回复 head为1表示请求是HEAD
+static void http_resp_init(struct http_resp *r,int head)
+{
+    r->head=head;
+    memset(r->ncls,0,sizeof(r->ncls));
+    r->nbad=0;
+    resp_next(r);
+}
+
+//收到一段正文，只计数和算校验和，不拷贝
+static void resp_body(struct http_resp *r,const char *p,long long n)
+{
+    const unsigned char *q=(const unsigned char *)p;
+    unsigned int c;
+
+    r->body+=n;
+    if(!expect_crc_set)
+        return;
+
+    c=r->crc;
+    while(n-->0)
+        c=crc_table[(c^*q++)&0xff]^(c>>8);
+    r->crc=c;
+}
+
+//回复是否通过了--expect-*的检查，不完整的回复只在没有检查时算通过
+static int resp_check(const struct http_resp *r)
+{
+    if(r->state!=RESP_DONE)
+        return !expect;
+    if(expect_status>=100 && r->status!=expect_status)
+        return 0;
+    if(expect_status>0 && expect_status<10 && r->status/100!=expect_status)
+        return 0;
+    if(r->body<expect_min_len || (expect_max_len>=0 && r->body>expect_max_len))
+        return 0;
+    if(expect_crc_set && (r->crc^0xffffffffU)!=expect_crc)
+        return 0;
+    return 1;
+}
+
+//一个回复结束了，记下它的分类和检查结果
+static void resp_complete(struct http_resp *r)
+{
+    r->ncls[r->status>=100 && r->status<600?r->status/100:0]++;
+    if(!resp_check(r))
+        r->nbad++;
+}
+
+//逐字节解析状态行，如 HTTP/1.1 200 OK
+//返回1表示状态行结束，-1表示格式错误
+static int resp_status_char(struct http_resp *r,char ch)
+{
+    //"HTTP/1.x"的前7个字节
+    static const char proto[]="HTTP/1.";
+
+    if(ch=='\n')
+        return r->status>=100?1:-1;
+
+    if(r->pos<7)
+    {
+        if(ch!=proto[r->pos])
+            return -1;
+    }
+    //HTTP/1.0默认不保持连接
+    else if(r->pos==7)
+        r->close=(ch=='0');
+    //三位状态码
+    else if(r->pos>=9 && r->pos<=11)
+    {
+        if(ch<'0' || ch>'9')
+            return -1;
+        r->status=r->status*10+(ch-'0');
+    }
+
+    if(r->pos<12)
+        r->pos++;
+    return 0;
+}
+
+//处理一行完整的报头，line已经去掉了行尾的\r
+static void resp_header_line(struct http_resp *r)
+{
+    char *v;
+
+    r->line[r->llen]='\0';
+
+    v=strchr(r->line,':');
+    if(v==NULL)
+        return;
+    v++;
+    while(*v==' ' || *v=='\t')
+        v++;
+
+    if(strncasecmp(r->line,"Content-Length:",15)==0)
+    {
+        r->has_len=1;
+        r->remain=atoll(v);
+    }
+    else if(strncasecmp(r->line,"Transfer-Encoding:",18)==0)
+    {
+        //chunked可能跟在其他编码后面，如 gzip, chunked
+        for(; *v; v++)
+            if(strncasecmp(v,"chunked",7)==0)
+                r->chunked=1;
+    }
+    else if(strncasecmp(r->line,"Connection:",11)==0)
+    {
+        if(strncasecmp(v,"close",5)==0)
+            r->close=1;
+        else if(strncasecmp(v,"keep-alive",10)==0)
+            r->close=0;
+    }
+}
+
+//报头结束，根据状态码和报头决定正文怎么读
+static void resp_headers_done(struct http_resp *r)
+{
+    //1xx是临时回复，后面还跟着真正的回复(101协议切换除外)
+    if(r->status<200 && r->status!=101)
+    {
+        resp_next(r);
+        return;
+    }
+
+    //这些回复没有正文
+    if(r->head || r->status==204 || r->status==304)
+        r->state=RESP_DONE;
+    else if(r->chunked)
+        r->state=RESP_CHUNK_SIZE;
+    else if(r->has_len)
+        r->state=r->remain>0?RESP_BODY:RESP_DONE;
+    else
+    {
+        //不知道正文多长，只能读到对端关闭
+        r->state=RESP_UNTIL_CLOSE;
+        r->close=1;
+    }
+}
+
+/*
+喂给解析器一段数据
+返回值：
+    >=0 消耗掉的字节数，r->state==RESP_DONE表示一个回复完整了
+        剩下没有消耗的字节属于下一个回复(流水线)
+    -1  回复格式错误，r->state变为RESP_ERROR
+*/
+static int http_resp_parse(struct http_resp *r,const char *buf,int len)
+{
+    int i=0;
+    long long n;
+    char ch;
+
+    while(i<len && r->state!=RESP_DONE)
+    {
+        switch(r->state)
+        {
+        case RESP_STATUS:
+            ch=buf[i++];
+            if(ch=='\r')
+                break;
+            switch(resp_status_char(r,ch))
+            {
+            case -1:
+                goto bad;
+            case 1:
+                r->state=RESP_HEADER;
+                r->llen=0;
+                break;
+            }
+            break;
+
+        case RESP_HEADER:
+        case RESP_TRAILER:
+        case RESP_CHUNK_SIZE:
+        case RESP_CHUNK_END:
+            //这几种都是按行处理的
+            ch=buf[i++];
+            if(ch=='\r')
+                break;
+            if(ch!='\n')
+            {
+                //超出部分直接丢弃，只关心行的开头
+                if(r->llen<RESP_LINE_SIZE-1)
+                    r->line[r->llen++]=ch;
+                break;
+            }
+
+            //一行结束
+            if(r->state==RESP_HEADER)
+            {
+                if(r->llen==0)
+                    resp_headers_done(r);
+                else
+                    resp_header_line(r);
+            }
+            else if(r->state==RESP_TRAILER)
+            {
+                if(r->llen==0)
+                    r->state=RESP_DONE;
+            }
+            else if(r->state==RESP_CHUNK_END)
+            {
+                if(r->llen!=0)
+                    goto bad;
+                r->state=RESP_CHUNK_SIZE;
+            }
+            else
+            {
+                //十六进制的分块长度，后面可能有;扩展
+                r->line[r->llen]='\0';
+                if(r->llen==0)
+                    goto bad;
+                r->remain=strtoll(r->line,NULL,16);
+                if(r->remain<0)
+                    goto bad;
+                r->state=r->remain>0?RESP_CHUNK_DATA:RESP_TRAILER;
+            }
+            r->llen=0;
+            break;
+
+        case RESP_BODY:
+        case RESP_CHUNK_DATA:
+            //正文不用逐字节看，直接跳过
+            n=len-i;
+            if(n>r->remain)
+                n=r->remain;
+            resp_body(r,buf+i,n);
+            i+=n;
+            r->remain-=n;
+            if(r->remain==0)
+                r->state=r->state==RESP_BODY?RESP_DONE:RESP_CHUNK_END;
+            break;
+
+        case RESP_UNTIL_CLOSE:
+            resp_body(r,buf+i,len-i);
+            i=len;
+            break;
+
+        case RESP_ERROR:
+            return -1;
+        }
+    }
+
+    return i;
+
+bad:
+    r->state=RESP_ERROR;
+    return -1;
+}
+
+//对端关闭了连接，返回1表示此时回复正好完整
+static int http_resp_eof(struct http_resp *r)
+{
+    if(r->state==RESP_UNTIL_CLOSE)
+    {
+        r->state=RESP_DONE;
+        resp_complete(r);
+    }
+    return r->state==RESP_DONE;
+}
+
+//不复用的连接读到对端关闭，回复就到此为止
+//不完整或格式错误的回复也要分类，有--expect-*检查时它们算作失败
+static void http_resp_end(struct http_resp *r)
+{
+    if(r->state!=RESP_DONE && !http_resp_eof(r))
+        resp_complete(r);
+}
+
+//一个回复完整了，流水线上还有请求时开始解析下一个回复
+static void resp_finish(struct http_resp *r,int *inflight)
+{
+    resp_complete(r);
+    (*inflight)--;
+
+    //要求关闭时后面的请求不会再有回复了
+    if(!r->close && *inflight>0)
+        resp_next(r);
+}
+
+/*
+流水线：一个连接上连续发出了多个请求，回复按顺序一个接一个地回来
+把一段数据依次喂给当前的回复，一个完整了就接着解析下一个
+*inflight是还没收到完整回复的请求数
+返回值：-1 格式错误，否则为这段数据中完整的回复个数
+某个回复要求关闭连接时(r->close)停止，后面的请求不会再有回复了
+*/
+static int http_resp_feed(struct http_resp *r,const char *buf,int len,int *inflight)
+{
+    int done=0,k;
+
+    while(len>0 && *inflight>0)
+    {
+        k=http_resp_parse(r,buf,len);
+        if(k<0)
+            return -1;
+        buf+=k;
+        len-=k;
+
+        if(r->state!=RESP_DONE)
+            break;
+
+        resp_finish(r,inflight);
+        done++;
+        if(r->close)
+            break;
+    }
+
+    return done;
+}
+
+//当前可以在内核里直接丢掉的正文字节数，0表示接下来的数据要读上来交给http_resp_feed()
+static int http_resp_discard(const struct http_resp *r)
+{
+    if(!drain || expect_crc_set)
+        return 0;
+
+    switch(r->state)
+    {
+    case RESP_BODY:
+    case RESP_CHUNK_DATA:
+        return r->remain<DRAIN_MAX?(int)r->remain:DRAIN_MAX;
+    case RESP_UNTIL_CLOSE:
+        return DRAIN_MAX;
+    }
+    return 0;
+}
+
+//内核丢掉了n个字节的正文(不超过http_resp_discard()的返回值)，返回完整的回复个数
+static int http_resp_skip(struct http_resp *r,int n,int *inflight)
+{
+    r->body+=n;
+    if(r->state==RESP_UNTIL_CLOSE)
+        return 0;
+
+    r->remain-=n;
+    if(r->remain>0)
+        return 0;
+    if(r->state==RESP_CHUNK_DATA)
+    {
+        r->state=RESP_CHUNK_END;
+        return 0;
+    }
+
+    r->state=RESP_DONE;
+    resp_finish(r,inflight);
+    return 1;
+}
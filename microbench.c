@@ -0,0 +1,241 @@
+/*
+
+微基准测试：make bench
+
+压测机自己的每个请求路径变慢了，测出来的服务器吞吐就跟着变低，而且看不出是谁的问题
+这里单独测量客户端每个请求都要走的几段代码：
+
+    build_request      构造请求报文
+    workload_pick      按权重抽下一个请求
+    request_template   渲染一个带随机数和序号的请求模板
+    resp_length        解析一个带Content-Length的回复
+    resp_chunked       解析一个分块的回复
+    resp_pipeline16    解析流水线上一次收到的16个回复，按每个回复计
+    resp_split16       同一个回复每次只收到16字节，每段都要进一次状态机
+    hist_record        记录一次延迟
+    stats_sum64        汇总64个槽位的计数器，父进程每秒做一次
+    hists_sum8         汇总8组直方图，测试结束时每个阶段做一次
+
+直接包含webbench.c，测的就是webbench里的同一份代码，不是拷贝
+每项跑若干轮，每轮至少BENCH_ROUND_NS，取最快的一轮，最快的一轮受调度和中断的干扰最小
+
+输出每行一项："名字 数值 单位"，单位是ns/op(越小越好)
+make bench把端到端的环回测试(req/s，越大越好)接在后面写到bench_output.txt，
+make bench-check BASELINE=旧的bench_output.txt 逐项比较，变慢超过TOLERANCE%时失败
+
+*/
+
+#define main webbench_main
+#include "webbench.c"
+#undef main
+
+#define BENCH_ROUNDS 5
+#define BENCH_ROUND_NS 200000000LL  //每轮至少200毫秒
+
+//防止编译器把结果没被用到的计算优化掉
+static volatile long long bench_sink;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+/*
+反复调用fn，每次调用做ops个操作，返回每个操作的纳秒数(各轮中最快的)
+先跑一轮估计出每轮要调用多少次
+*/
+static double bench_run(void (*fn)(void),int ops)
+{
+    long long t,n,i,calls=1;
+    double best=0,ns;
+    int r;
+
+    //估计：调用次数加倍直到一次跑够1/10轮
+    while(1)
+    {
+        t=now_ns();
+        for(i=0; i<calls; i++)
+            fn();
+        t=now_ns()-t;
+        if(t>=BENCH_ROUND_NS/10)
+            break;
+        calls*=2;
+    }
+    n=calls*(BENCH_ROUND_NS/(t>0?t:1));
+    if(n<1)
+        n=1;
+
+    for(r=0; r<BENCH_ROUNDS; r++)
+    {
+        t=now_ns();
+        for(i=0; i<n; i++)
+            fn();
+        t=now_ns()-t;
+        ns=(double)t/((double)n*ops);
+        if(r==0 || ns<best)
+            best=ns;
+    }
+    return best;
+}
+
+static void bench_print(const char *name,double ns)
+{
+    printf("%-24s %12.2f ns/op\n",name,ns);
+    fflush(stdout);
+}
+
+static void b_build_request(void)
+{
+    build_request("http://www.example.com:8080/static/images/logo.png?v=20240101");
+    bench_sink+=request[0];
+}
+
+static void b_workload_pick(void)
+{
+    bench_sink+=workload_pick();
+}
+
+static char bench_tbuf[REQUEST_SIZE];
+static struct request_msg bench_msg;
+
+static void b_request_template(void)
+{
+    request_prepare(nentries-1,bench_tbuf,&bench_msg);
+    bench_sink+=bench_msg.len;
+}
+
+//解析buf中的n个回复
+static const char *resp_buf;
+static int resp_len,resp_n,resp_seg;
+
+static void b_resp(void)
+{
+    struct http_resp r;
+    int inflight=resp_n,i,k;
+
+    http_resp_init(&r,0);
+    for(i=0; i<resp_len; i+=resp_seg)
+    {
+        k=resp_len-i<resp_seg?resp_len-i:resp_seg;
+        if(http_resp_feed(&r,resp_buf+i,k,&inflight)<0)
+            abort();
+    }
+    bench_sink+=r.ncls[2];
+}
+
+static struct histogram bench_hist;
+static long long bench_v=1;
+
+static void b_hist_record(void)
+{
+    //值在1微秒到1秒之间变化，落在不同的桶里
+    bench_v=bench_v*1103515245+12345;
+    hist_record_n(&bench_hist,(bench_v>>16)%1000000,1);
+}
+
+static struct stats *bench_slots;
+static struct stats bench_total;
+static struct hists *bench_hists;
+static struct hists bench_hists_total;
+
+static void b_stats_sum(void)
+{
+    stats_sum(&bench_total,bench_slots,64);
+    bench_sink+=bench_total.speed;
+}
+
+static void b_hists_sum(void)
+{
+    hists_sum(&bench_hists_total,bench_hists,8);
+    bench_sink+=bench_hists_total.latency.count;
+}
+
+//设置回复解析的输入，seg是每次喂给解析器的字节数
+static void resp_setup(const char *one,int n,int seg)
+{
+    static char *buf;
+    int len=strlen(one),i;
+
+    free(buf);
+    buf=malloc(len*n+1);
+    if(buf==NULL)
+        exit(3);
+    for(i=0; i<n; i++)
+        memcpy(buf+i*len,one,len);
+    resp_buf=buf;
+    resp_len=len*n;
+    resp_n=n;
+    resp_seg=seg>0?seg:resp_len;
+}
+
+int main(void)
+{
+    static const char length_resp[]=
+        "HTTP/1.1 200 OK\r\nServer: nginx\r\nDate: Mon, 01 Jan 2024 00:00:00 GMT\r\n"
+        "Content-Type: text/html\r\nContent-Length: 64\r\nConnection: keep-alive\r\n\r\n"
+        "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghijk\n";
+    static const char chunked_resp[]=
+        "HTTP/1.1 200 OK\r\nServer: nginx\r\nContent-Type: text/html\r\n"
+        "Transfer-Encoding: chunked\r\n\r\n"
+        "20\r\nabcdefghijklmnopqrstuvwxyzabcdef\r\n20\r\nabcdefghijklmnopqrstuvwxyzabcdef\r\n0\r\n\r\n";
+    int i;
+
+    printf("# webbench microbenchmarks "PROGRAM_VERSION",best of %d rounds\n",BENCH_ROUNDS);
+
+    http10=1;
+    proxyport=80;
+    bench_print("build_request",bench_run(b_build_request,1));
+
+    //四个权重不同的条目
+    keepalive=1;
+    http10=2;
+    pipeline=1;
+    workload_add("http://www.example.com/",METHOD_GET,5);
+    workload_add("http://www.example.com/a.css",METHOD_GET,3);
+    workload_add("http://www.example.com/b.js",METHOD_GET,1);
+    workload_add("http://www.example.com/c.png",METHOD_HEAD,1);
+    workload_alias();
+    rng=1;
+    bench_print("workload_pick",bench_run(b_workload_pick,1));
+
+    //最后一个条目带变量，不参与上面的抽样
+    workload_add("http://www.example.com/img/{{rand:1-100000}}.jpg?v={{seq}}",METHOD_GET,1);
+    tmpl_setup();
+    bench_print("request_template",bench_run(b_request_template,1));
+
+    resp_setup(length_resp,1,0);
+    bench_print("resp_length",bench_run(b_resp,1));
+    resp_setup(chunked_resp,1,0);
+    bench_print("resp_chunked",bench_run(b_resp,1));
+    resp_setup(length_resp,16,0);
+    bench_print("resp_pipeline16",bench_run(b_resp,16));
+    resp_setup(length_resp,1,16);
+    bench_print("resp_split16",bench_run(b_resp,1));
+
+    bench_print("hist_record",bench_run(b_hist_record,1));
+
+    bench_slots=stats_alloc(64);
+    if(bench_slots==NULL)
+        exit(3);
+    for(i=0; i<64; i++)
+        bench_slots[i].speed=i;
+    bench_print("stats_sum64",bench_run(b_stats_sum,1));
+
+    //每组都记过延迟和各阶段的耗时，其他直方图没用到
+    bench_hists=hists_alloc(8);
+    if(bench_hists==NULL)
+        exit(3);
+    for(i=0; i<8; i++)
+    {
+        hist_record_n(&bench_hists[i].latency,i*1000,i+1);
+        hist_record_n(&bench_hists[i].connect_time,i*100,i+1);
+        hist_record_n(&bench_hists[i].ttfb,i*500,i+1);
+        hist_record_n(&bench_hists[i].transfer,i*400,i+1);
+    }
+    bench_print("hists_sum8",bench_run(b_hists_sum,1));
+
+    return 0;
+}
@@ -0,0 +1,522 @@
+/*
+
+机器可读的结果输出：
+
+文本结果是给人看的，回归测试的看板要解析它很麻烦
+--output json|csv 把完整的结果按固定格式写出来：
+    config    本次测试的参数
+    totals    总数
+    memory    同时打开的最多连接数、子进程占用的内存(Pss)和其中连接状态、缓冲区的部分，单位字节
+    failures  各类失败的个数
+    status    按状态码分类的回复数和延迟，单位微秒
+    latency   延迟分布，单位微秒
+    phases    建立连接、等第一个字节、传输三个阶段各自的耗时分布，单位微秒
+    series    每秒采样的时间序列，从预热开始
+    stages    --warmup/--ramp/--steps时每个阶段各自的结果，预热阶段不计入totals
+    entries   --workload中每个条目的结果
+    placement --cpus时每个子进程所在的核和NUMA节点
+
+--agents时processes是代理的个数，各个代理的结果已经合并在一起
+
+csv是整齐的长表格式，每行一个值：
+    section,second,name,value
+second只有series中才有，entry和stage中这一列是条目和阶段的序号，placement中是子进程的编号
+
+*/
+
+static const char *engine_names[]={"fork","epoll","uring"};
+static const char *http_names[]={"0.9","1.0","1.1"};
+
+//写一个json字符串，转义引号、反斜杠和控制字符，NULL写成null
+static void json_string(FILE *f,const char *s)
+{
+    if(s==NULL)
+    {
+        fprintf(f,"null");
+        return;
+    }
+
+    fputc('"',f);
+    for(; *s; s++)
+    {
+        if(*s=='"' || *s=='\\')
+            fprintf(f,"\\%c",*s);
+        else if((unsigned char)*s<0x20)
+            fprintf(f,"\\u%04x",*s);
+        else
+            fputc(*s,f);
+    }
+    fputc('"',f);
+}
+
+//一个直方图写成json对象，indent是缩进，last为0时后面加逗号
+static void json_hist(FILE *f,const char *name,const struct histogram *h,const char *indent,int last)
+{
+    fprintf(f,"%s\"%s\": {\n",indent,name);
+    fprintf(f,"%s  \"count\": %lld,\n",indent,h->count);
+    fprintf(f,"%s  \"mean\": %.1f,\n",indent,h->count?h->sum/(double)h->count:0.0);
+    fprintf(f,"%s  \"p50\": %lld,\n",indent,hist_percentile(h,50));
+    fprintf(f,"%s  \"p90\": %lld,\n",indent,hist_percentile(h,90));
+    fprintf(f,"%s  \"p99\": %lld,\n",indent,hist_percentile(h,99));
+    fprintf(f,"%s  \"p99_9\": %lld,\n",indent,hist_percentile(h,99.9));
+    fprintf(f,"%s  \"max\": %lld\n",indent,h->max);
+    fprintf(f,"%s}%s\n",indent,last?"":",");
+}
+
+//第s个阶段的结果写成json对象
+static void json_stage(FILE *f,int s,int last)
+{
+    static struct hists h;
+    struct stats t;
+    const struct stage *g=&stages[s];
+    double sec=(g->end-g->start)/1000000.0;
+
+    stats_sum(&t,slots+s*nprocs,nprocs);
+    hists_sum(&h,hist_slots+s*nhists,nhists);
+    fprintf(f,"    {\n");
+    fprintf(f,"      \"name\": ");
+    json_string(f,g->name);
+    fprintf(f,",\n");
+    fprintf(f,"      \"start\": %.3f,\n",g->start/1000000.0);
+    fprintf(f,"      \"end\": %.3f,\n",g->end/1000000.0);
+    fprintf(f,"      \"load_from\": %g,\n",g->from);
+    fprintf(f,"      \"load_to\": %g,\n",g->to);
+    fprintf(f,"      \"counted\": %s,\n",s>=first_stage?"true":"false");
+    fprintf(f,"      \"success\": %lld,\n",t.speed);
+    fprintf(f,"      \"failed\": %lld,\n",t.failed);
+    fprintf(f,"      \"bytes\": %lld,\n",t.bytes);
+    fprintf(f,"      \"requests_per_sec\": %.2f,\n",t.speed/sec);
+    fprintf(f,"      \"bytes_per_sec\": %.2f,\n",t.bytes/sec);
+    json_hist(f,"latency_us",&h.latency,"      ",1);
+    fprintf(f,"    }%s\n",last?"":",");
+}
+
+static void write_json(FILE *f)
+{
+    struct entry_stats es;
+    int i,k;
+
+    fprintf(f,"{\n");
+    fprintf(f,"  \"version\": \"%s\",\n",PROGRAM_VERSION);
+
+    fprintf(f,"  \"config\": {\n");
+    fprintf(f,"    \"url\": ");
+    json_string(f,target_url);
+    fprintf(f,",\n");
+    fprintf(f,"    \"method\": \"%s\",\n",method_names[method]);
+    fprintf(f,"    \"http\": \"%s\",\n",http_names[http10]);
+    fprintf(f,"    \"engine\": \"%s\",\n",engine_names[engine]);
+    fprintf(f,"    \"clients\": %d,\n",clients);
+    fprintf(f,"    \"processes\": %d,\n",nprocs);
+    fprintf(f,"    \"time\": %d,\n",benchtime);
+    fprintf(f,"    \"warmup\": %d,\n",warmup);
+    fprintf(f,"    \"ramp\": %d,\n",ramp);
+    fprintf(f,"    \"steps\": %d,\n",steps);
+    fprintf(f,"    \"force\": %s,\n",force?"true":"false");
+    fprintf(f,"    \"reload\": %s,\n",force_reload?"true":"false");
+    fprintf(f,"    \"keepalive\": %s,\n",keepalive?"true":"false");
+    fprintf(f,"    \"pipeline\": %d,\n",pipeline);
+    fprintf(f,"    \"cpus\": ");
+    json_string(f,pinned?(cpus_arg!=NULL?cpus_arg:"all"):NULL);
+    fprintf(f,",\n    \"irq_cpus\": ");
+    json_string(f,irq_cpus_arg);
+    fprintf(f,",\n    \"numa\": %s,\n",numa?"true":"false");
+    fprintf(f,"    \"rate\": %g,\n",rate);
+    fprintf(f,"    \"bind\": ");
+    json_string(f,bind_arg);
+    fprintf(f,",\n");
+    fprintf(f,"    \"agents\": ");
+    json_string(f,agents_arg);
+    fprintf(f,",\n");
+    fprintf(f,"    \"workload\": ");
+    if(workload_file!=NULL)
+        json_string(f,workload_file);
+    else
+        fprintf(f,"null");
+    fprintf(f,",\n");
+    fprintf(f,"    \"body\": ");
+    if(body_file!=NULL)
+    {
+        json_string(f,body_file);
+        fprintf(f,",\n    \"body_bytes\": %lld",(long long)body_len);
+    }
+    else
+        fprintf(f,"null");
+    fprintf(f,",\n");
+    fprintf(f,"    \"proxy\": ");
+    if(proxyhost!=NULL)
+    {
+        json_string(f,proxyhost);
+        fprintf(f,",\n    \"proxy_port\": %d\n",proxyport);
+    }
+    else
+        fprintf(f,"null\n");
+    fprintf(f,"  },\n");
+
+    fprintf(f,"  \"totals\": {\n");
+    fprintf(f,"    \"success\": %lld,\n",total.speed);
+    fprintf(f,"    \"failed\": %lld,\n",total.failed);
+    fprintf(f,"    \"bytes\": %lld,\n",total.bytes);
+    fprintf(f,"    \"requests_per_sec\": %.2f,\n",total.speed/(double)benchtime);
+    fprintf(f,"    \"bytes_per_sec\": %.2f,\n",total.bytes/(double)benchtime);
+    fprintf(f,"    \"unsent\": %lld,\n",total.unsent);
+    fprintf(f,"    \"syscalls\": %lld,\n",total.syscalls);
+    fprintf(f,"    \"syscalls_per_request\": %.2f\n",
+            total.speed+total.failed?total.syscalls/(double)(total.speed+total.failed):0.0);
+    fprintf(f,"  },\n");
+
+    //客户端的内存，字节
+    fprintf(f,"  \"memory\": {\n");
+    fprintf(f,"    \"peak_connections\": %lld,\n",total.conns_peak);
+    fprintf(f,"    \"process_bytes\": %lld,\n",total.mem_pss);
+    fprintf(f,"    \"connection_state_bytes\": %lld,\n",total.mem_state);
+    fprintf(f,"    \"bytes_per_connection\": %lld\n",total.conns_peak?total.mem_pss/total.conns_peak:0);
+    fprintf(f,"  },\n");
+
+    fprintf(f,"  \"failures\": {\n");
+    fprintf(f,"    \"connect\": %lld,\n",total.connect_failed);
+    fprintf(f,"    \"connect_timeout\": %lld,\n",total.connect_timeout);
+    fprintf(f,"    \"timeout\": %lld,\n",total.timeouts);
+    fprintf(f,"    \"addr_unavail\": %lld,\n",total.addr_unavail);
+    fprintf(f,"    \"send\": %lld,\n",total.send_failed);
+    fprintf(f,"    \"write_shutdown\": %lld,\n",total.wclose_failed);
+    fprintf(f,"    \"read\": %lld,\n",total.read_failed);
+    fprintf(f,"    \"invalid\": %lld,\n",total.invalid);
+    fprintf(f,"    \"close\": %lld\n",total.sclose_failed);
+    fprintf(f,"  },\n");
+
+    fprintf(f,"  \"status\": {");
+    for(i=0,k=0; i<STATUS_CLASSES; i++)
+    {
+        if(total.status[i]==0)
+            continue;
+        fprintf(f,"%s\n    \"%s\": {\"count\": %lld, \"mean_us\": %.1f, \"max_us\": %lld}",
+                k++?",":"",status_names[i],total.status[i],
+                total.status_latency[i]/(double)total.status[i],total.status_max[i]);
+    }
+    fprintf(f,"\n  },\n");
+
+    json_hist(f,"latency_us",&hist_total.latency,"  ",0);
+
+    fprintf(f,"  \"phases_us\": {\n");
+    json_hist(f,"connect",&hist_total.connect_time,"    ",0);
+    json_hist(f,"ttfb",&hist_total.ttfb,"    ",0);
+    json_hist(f,"transfer",&hist_total.transfer,"    ",1);
+    fprintf(f,"  },\n");
+
+    fprintf(f,"  \"tls\": ");
+    if(tls)
+    {
+        fprintf(f,"{\n");
+        fprintf(f,"    \"version\": \"%s\",\n",tls_version_name(total.tls_version));
+        fprintf(f,"    \"resumption\": \"%s\",\n",tls_resume_names[tls_resume]);
+        fprintf(f,"    \"full\": %lld,\n",total.tls_full);
+        fprintf(f,"    \"resumed\": %lld,\n",total.tls_resumed);
+        fprintf(f,"    \"failed\": %lld,\n",total.tls_failed);
+        fprintf(f,"    \"cpu_full_us\": %.1f,\n",total.tls_full?total.tls_cpu_full/(double)total.tls_full:0.0);
+        fprintf(f,"    \"cpu_resumed_us\": %.1f,\n",total.tls_resumed?total.tls_cpu_resumed/(double)total.tls_resumed:0.0);
+        json_hist(f,"full_us",&hist_total.handshake_full,"    ",0);
+        json_hist(f,"resumed_us",&hist_total.handshake_resumed,"    ",1);
+        fprintf(f,"  },\n");
+    }
+    else
+        fprintf(f,"null,\n");
+
+    fprintf(f,"  \"h2\": ");
+    if(h2c)
+    {
+        fprintf(f,"{\n");
+        fprintf(f,"    \"streams_per_conn\": %d,\n",streams);
+        fprintf(f,"    \"connections\": %lld,\n",total.h2_conns);
+        fprintf(f,"    \"streams\": %lld,\n",total.h2_streams);
+        fprintf(f,"    \"reset\": %lld,\n",total.h2_reset);
+        fprintf(f,"    \"goaway\": %lld,\n",total.h2_goaway);
+        fprintf(f,"    \"unprocessed\": %lld,\n",total.h2_unprocessed);
+        fprintf(f,"    \"protocol_errors\": %lld,\n",total.h2_protocol);
+        fprintf(f,"    \"flow_control_stalls\": %lld,\n",total.h2_stalls);
+        fprintf(f,"    \"server_max_streams\": %d,\n",total.h2_max_streams);
+        json_hist(f,"setup_us",&hist_total.h2_setup,"    ",1);
+        fprintf(f,"  },\n");
+    }
+    else
+        fprintf(f,"null,\n");
+
+    fprintf(f,"  \"series\": [");
+    for(i=0; i<nseries; i++)
+        fprintf(f,"%s\n    {\"second\": %d, \"stage\": \"%s\", \"requests\": %lld, \"bytes\": %lld, \"errors\": %lld}",
+                i?",":"",i+1,stages[series[i].stage].name,series[i].requests,series[i].bytes,series[i].errors);
+    fprintf(f,"\n  ],\n");
+
+    fprintf(f,"  \"stages\": [\n");
+    for(i=0; i<nstages; i++)
+        json_stage(f,i,i==nstages-1);
+    fprintf(f,"  ],\n");
+
+    fprintf(f,"  \"entries\": [");
+    for(i=0; i<nentries; i++)
+    {
+        workload_sum(&es,i,first_stage*nprocs,(nstages-first_stage)*nprocs);
+        fprintf(f,"%s\n    {\"url\": ",i?",":"");
+        json_string(f,entries[i].url);
+        fprintf(f,", \"method\": \"%s\", \"weight\": %g, \"success\": %lld, \"failed\": %lld, "
+                "\"bytes\": %lld, \"mean_us\": %.1f, \"max_us\": %lld}",
+                method_names[entries[i].method],entries[i].weight,es.speed,es.failed,es.bytes,
+                es.speed?es.latency_sum/(double)es.speed:0.0,es.latency_max);
+    }
+    fprintf(f,"\n  ],\n");
+
+    fprintf(f,"  \"placement\": [");
+    for(i=0; pinned && i<nprocs; i++)
+        fprintf(f,"%s\n    {\"worker\": %d, \"cpu\": %d, \"node\": %d}",
+                i?",":"",i,slots[i].cpu,slots[i].node);
+    fprintf(f,"\n  ]\n");
+
+    fprintf(f,"}\n");
+}
+
+//URL中可能有逗号和引号，按csv的规则用引号括起来
+static void csv_string(FILE *f,const char *s)
+{
+    fputc('"',f);
+    for(; *s; s++)
+    {
+        if(*s=='"')
+            fputc('"',f);
+        fputc(*s,f);
+    }
+    fputc('"',f);
+}
+
+//csv中一行一个值
+static void csv_row(FILE *f,const char *section,const char *name,long long v)
+{
+    fprintf(f,"%s,,%s,%lld\n",section,name,v);
+}
+
+//一个直方图在csv中的各行
+static void csv_hist(FILE *f,const char *section,const struct histogram *h)
+{
+    csv_row(f,section,"count",h->count);
+    fprintf(f,"%s,,mean,%.1f\n",section,h->count?h->sum/(double)h->count:0.0);
+    csv_row(f,section,"p50",hist_percentile(h,50));
+    csv_row(f,section,"p90",hist_percentile(h,90));
+    csv_row(f,section,"p99",hist_percentile(h,99));
+    csv_row(f,section,"p99_9",hist_percentile(h,99.9));
+    csv_row(f,section,"max",h->max);
+}
+
+static void write_csv(FILE *f)
+{
+    static struct hists h;
+    struct stats t;
+    struct entry_stats es;
+    double sec;
+    int i;
+
+    fprintf(f,"section,second,name,value\n");
+
+    fprintf(f,"config,,version,%s\n",PROGRAM_VERSION);
+
+    fprintf(f,"config,,url,");
+    csv_string(f,target_url);
+    fprintf(f,"\n");
+
+    fprintf(f,"config,,method,%s\n",method_names[method]);
+    fprintf(f,"config,,http,%s\n",http_names[http10]);
+    fprintf(f,"config,,engine,%s\n",engine_names[engine]);
+    csv_row(f,"config","clients",clients);
+    csv_row(f,"config","processes",nprocs);
+    csv_row(f,"config","time",benchtime);
+    csv_row(f,"config","warmup",warmup);
+    csv_row(f,"config","ramp",ramp);
+    csv_row(f,"config","steps",steps);
+    csv_row(f,"config","force",force);
+    csv_row(f,"config","reload",force_reload);
+    csv_row(f,"config","keepalive",keepalive);
+    csv_row(f,"config","pipeline",pipeline);
+    if(pinned)
+    {
+        fprintf(f,"config,,cpus,%s\n",cpus_arg!=NULL?cpus_arg:"all");
+        if(irq_cpus_arg!=NULL)
+            fprintf(f,"config,,irq_cpus,%s\n",irq_cpus_arg);
+        csv_row(f,"config","numa",numa);
+    }
+    fprintf(f,"config,,rate,%g\n",rate);
+    if(bind_arg!=NULL)
+    {
+        fprintf(f,"config,,bind,");
+        csv_string(f,bind_arg);
+        fprintf(f,"\n");
+    }
+    if(agents_arg!=NULL)
+    {
+        fprintf(f,"config,,agents,");
+        csv_string(f,agents_arg);
+        fprintf(f,"\n");
+    }
+    if(workload_file!=NULL)
+    {
+        fprintf(f,"config,,workload,");
+        csv_string(f,workload_file);
+        fprintf(f,"\n");
+    }
+    if(body_file!=NULL)
+    {
+        fprintf(f,"config,,body,");
+        csv_string(f,body_file);
+        fprintf(f,"\n");
+        csv_row(f,"config","body_bytes",body_len);
+    }
+    if(proxyhost!=NULL)
+    {
+        fprintf(f,"config,,proxy,%s\n",proxyhost);
+        csv_row(f,"config","proxy_port",proxyport);
+    }
+
+    csv_row(f,"totals","success",total.speed);
+    csv_row(f,"totals","failed",total.failed);
+    csv_row(f,"totals","bytes",total.bytes);
+    fprintf(f,"totals,,requests_per_sec,%.2f\n",total.speed/(double)benchtime);
+    fprintf(f,"totals,,bytes_per_sec,%.2f\n",total.bytes/(double)benchtime);
+    csv_row(f,"totals","unsent",total.unsent);
+    csv_row(f,"totals","syscalls",total.syscalls);
+    fprintf(f,"totals,,syscalls_per_request,%.2f\n",
+            total.speed+total.failed?total.syscalls/(double)(total.speed+total.failed):0.0);
+
+    csv_row(f,"memory","peak_connections",total.conns_peak);
+    csv_row(f,"memory","process_bytes",total.mem_pss);
+    csv_row(f,"memory","connection_state_bytes",total.mem_state);
+    csv_row(f,"memory","bytes_per_connection",total.conns_peak?total.mem_pss/total.conns_peak:0);
+
+    csv_row(f,"failures","connect",total.connect_failed);
+    csv_row(f,"failures","connect_timeout",total.connect_timeout);
+    csv_row(f,"failures","timeout",total.timeouts);
+    csv_row(f,"failures","addr_unavail",total.addr_unavail);
+    csv_row(f,"failures","send",total.send_failed);
+    csv_row(f,"failures","write_shutdown",total.wclose_failed);
+    csv_row(f,"failures","read",total.read_failed);
+    csv_row(f,"failures","invalid",total.invalid);
+    csv_row(f,"failures","close",total.sclose_failed);
+
+    for(i=0; i<STATUS_CLASSES; i++)
+    {
+        if(total.status[i]==0)
+            continue;
+        fprintf(f,"status,,%s_count,%lld\n",status_names[i],total.status[i]);
+        fprintf(f,"status,,%s_mean_us,%.1f\n",status_names[i],total.status_latency[i]/(double)total.status[i]);
+        fprintf(f,"status,,%s_max_us,%lld\n",status_names[i],total.status_max[i]);
+    }
+
+    csv_hist(f,"latency_us",&hist_total.latency);
+    csv_hist(f,"connect_us",&hist_total.connect_time);
+    csv_hist(f,"ttfb_us",&hist_total.ttfb);
+    csv_hist(f,"transfer_us",&hist_total.transfer);
+
+    if(tls)
+    {
+        fprintf(f,"tls,,version,%s\n",tls_version_name(total.tls_version));
+        fprintf(f,"tls,,resumption,%s\n",tls_resume_names[tls_resume]);
+        csv_row(f,"tls","full",total.tls_full);
+        csv_row(f,"tls","resumed",total.tls_resumed);
+        csv_row(f,"tls","failed",total.tls_failed);
+        fprintf(f,"tls,,cpu_full_us,%.1f\n",total.tls_full?total.tls_cpu_full/(double)total.tls_full:0.0);
+        fprintf(f,"tls,,cpu_resumed_us,%.1f\n",total.tls_resumed?total.tls_cpu_resumed/(double)total.tls_resumed:0.0);
+        csv_hist(f,"tls_full_us",&hist_total.handshake_full);
+        csv_hist(f,"tls_resumed_us",&hist_total.handshake_resumed);
+    }
+
+    if(h2c)
+    {
+        fprintf(f,"h2,,streams_per_conn,%d\n",streams);
+        csv_row(f,"h2","connections",total.h2_conns);
+        csv_row(f,"h2","streams",total.h2_streams);
+        csv_row(f,"h2","reset",total.h2_reset);
+        csv_row(f,"h2","goaway",total.h2_goaway);
+        csv_row(f,"h2","unprocessed",total.h2_unprocessed);
+        csv_row(f,"h2","protocol_errors",total.h2_protocol);
+        csv_row(f,"h2","flow_control_stalls",total.h2_stalls);
+        fprintf(f,"h2,,server_max_streams,%d\n",total.h2_max_streams);
+        csv_hist(f,"h2_setup_us",&hist_total.h2_setup);
+    }
+
+    for(i=0; i<nseries; i++)
+    {
+        fprintf(f,"series,%d,requests,%lld\n",i+1,series[i].requests);
+        fprintf(f,"series,%d,bytes,%lld\n",i+1,series[i].bytes);
+        fprintf(f,"series,%d,errors,%lld\n",i+1,series[i].errors);
+        fprintf(f,"series,%d,stage,%s\n",i+1,stages[series[i].stage].name);
+    }
+
+    for(i=0; i<nstages; i++)
+    {
+        stats_sum(&t,slots+i*nprocs,nprocs);
+        hists_sum(&h,hist_slots+i*nhists,nhists);
+        sec=(stages[i].end-stages[i].start)/1000000.0;
+        fprintf(f,"stage,%d,name,%s\n",i,stages[i].name);
+        fprintf(f,"stage,%d,start,%.3f\n",i,stages[i].start/1000000.0);
+        fprintf(f,"stage,%d,end,%.3f\n",i,stages[i].end/1000000.0);
+        fprintf(f,"stage,%d,load_from,%g\n",i,stages[i].from);
+        fprintf(f,"stage,%d,load_to,%g\n",i,stages[i].to);
+        fprintf(f,"stage,%d,counted,%d\n",i,i>=first_stage);
+        fprintf(f,"stage,%d,success,%lld\n",i,t.speed);
+        fprintf(f,"stage,%d,failed,%lld\n",i,t.failed);
+        fprintf(f,"stage,%d,bytes,%lld\n",i,t.bytes);
+        fprintf(f,"stage,%d,requests_per_sec,%.2f\n",i,t.speed/sec);
+        fprintf(f,"stage,%d,latency_mean_us,%.1f\n",i,h.latency.count?h.latency.sum/(double)h.latency.count:0.0);
+        fprintf(f,"stage,%d,latency_p50_us,%lld\n",i,hist_percentile(&h.latency,50));
+        fprintf(f,"stage,%d,latency_p99_us,%lld\n",i,hist_percentile(&h.latency,99));
+        fprintf(f,"stage,%d,latency_max_us,%lld\n",i,h.latency.max);
+    }
+
+    for(i=0; i<nentries; i++)
+    {
+        workload_sum(&es,i,first_stage*nprocs,(nstages-first_stage)*nprocs);
+        fprintf(f,"entry,%d,url,",i);
+        csv_string(f,entries[i].url);
+        fprintf(f,"\n");
+        fprintf(f,"entry,%d,method,%s\n",i,method_names[entries[i].method]);
+        fprintf(f,"entry,%d,weight,%g\n",i,entries[i].weight);
+        fprintf(f,"entry,%d,success,%lld\n",i,es.speed);
+        fprintf(f,"entry,%d,failed,%lld\n",i,es.failed);
+        fprintf(f,"entry,%d,bytes,%lld\n",i,es.bytes);
+        fprintf(f,"entry,%d,mean_us,%.1f\n",i,es.speed?es.latency_sum/(double)es.speed:0.0);
+        fprintf(f,"entry,%d,max_us,%lld\n",i,es.latency_max);
+    }
+
+    for(i=0; pinned && i<nprocs; i++)
+    {
+        fprintf(f,"placement,%d,cpu,%d\n",i,slots[i].cpu);
+        fprintf(f,"placement,%d,node,%d\n",i,slots[i].node);
+    }
+}
+
+//按--output写出完整结果，成功返回0
+static int write_result(void)
+{
+    FILE *f=stdout;
+
+    if(output_file!=NULL)
+    {
+        f=fopen(output_file,"w");
+        if(f==NULL)
+        {
+            perror(" Failed to open output file ");
+            return 3;
+        }
+    }
+    else
+        printf("\n");
+
+    if(output==OUTPUT_JSON)
+        write_json(f);
+    else
+        write_csv(f);
+
+    if(f!=stdout && fclose(f))
+    {
+        perror(" Failed to write output file ");
+        return 3;
+    }
+
+    return 0;
+}
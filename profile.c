@@ -0,0 +1,220 @@
+#include <math.h>
+
+/*
+
+负载曲线：
+
+以前子进程fork之后休眠1秒，然后满负荷跑benchtime秒，
+冷缓存、JIT预热、连接池建立的过程全都混在结果里
+
+现在一次测试分成若干阶段，每个阶段的负载比例(0~1)可以不同：
+
+    --warmup 5        先满负荷预热5秒，预热阶段的结果不计入总结果
+    --ramp 10         -t时间中的前10秒负载从0线性增加到满负荷(ramp)，之后保持满负荷(steady)
+    --steps 4         -t时间平均分成4个台阶，第k个台阶的负载是k/4
+
+闭环模式下负载是同时工作的客户端数：负载为f时只有前 ceil(f*clients) 个客户端工作，
+其余的关掉连接等着，全局第j个客户端是第j/nprocs个子进程的第j%nprocs个连接
+开环模式下负载是请求速率：速率为rate*f，请求的计划发出时间按速率曲线的积分算
+
+每个阶段有自己的一组统计槽，子进程过了阶段的结束时间就换到下一组槽位上记，
+各阶段的吞吐和延迟分布单独汇总，能看出负载加到多少时吞吐不再增长
+
+*/
+
+#define MAX_STAGES 64
+
+struct stage
+{
+    char name[16];
+    long long start,end;  //相对bench_start的时间，微秒
+    double from,to;       //负载比例，阶段内从from线性变到to
+    double count;         //开环模式下阶段开始之前计划发出的请求总数
+};
+
+int warmup=0;           //--warmup 预热的秒数
+int ramp=0;             //--ramp 负载线性增加的秒数
+int steps=0;            //--steps 台阶数
+int runtime;            //子进程一共要跑的秒数，warmup+benchtime
+
+struct stage stages[MAX_STAGES];
+int nstages=0;
+int first_stage=0;      //第一个计入总结果的阶段，有预热时是1
+int stage_cur=0;        //子进程当前所在的阶段
+
+static void stage_add(const char *name,double from,double to,long long len)
+{
+    struct stage *s=&stages[nstages];
+
+    snprintf(s->name,sizeof(s->name),"%s",name);
+    s->start=nstages>0?stages[nstages-1].end:0;
+    s->end=s->start+len;
+    s->from=from;
+    s->to=to;
+    nstages++;
+}
+
+//按--warmup/--ramp/--steps排出各个阶段，参数错误返回2
+static int profile_setup(void)
+{
+    char name[16];
+    int i;
+
+    if(ramp>0 && steps>0)
+    {
+        fprintf(stderr,"Option parameter error,--ramp and --steps can't be used together\n");
+        return 2;
+    }
+    if(ramp>=benchtime || steps>benchtime || steps>=MAX_STAGES)
+    {
+        fprintf(stderr,"Option parameter error,--ramp and --steps must fit in the %d s test time\n",benchtime);
+        return 2;
+    }
+
+    if(warmup>0)
+    {
+        stage_add("warmup",1,1,warmup*1000000LL);
+        first_stage=1;
+    }
+
+    if(ramp>0)
+    {
+        stage_add("ramp",0,1,ramp*1000000LL);
+        stage_add("steady",1,1,(benchtime-ramp)*1000000LL);
+    }
+    else if(steps>0)
+    {
+        for(i=1; i<=steps; i++)
+        {
+            snprintf(name,sizeof(name),"step %d",i);
+            stage_add(name,(double)i/steps,(double)i/steps,
+                      benchtime*1000000LL*i/steps-benchtime*1000000LL*(i-1)/steps);
+        }
+    }
+    else
+        stage_add("run",1,1,benchtime*1000000LL);
+
+    //开环模式下每个阶段开始之前的计划请求数
+    for(i=1; i<nstages; i++)
+        stages[i].count=stages[i-1].count+
+                        rate*(stages[i-1].from+stages[i-1].to)/2*(stages[i-1].end-stages[i-1].start)/1000000.0;
+
+    runtime=warmup+benchtime;
+    return 0;
+}
+
+//是否给了负载曲线，没有时只有一个满负荷的阶段
+static int profiled(void)
+{
+    return nstages>1;
+}
+
+//时刻t(相对bench_start，微秒)所在的阶段，测试开始前算第一个，结束后算最后一个
+static int profile_stage(long long t)
+{
+    int i;
+
+    for(i=0; i<nstages-1; i++)
+        if(t<stages[i].end)
+            return i;
+    return nstages-1;
+}
+
+//时刻t在阶段s中的负载比例
+static double stage_load(int s,long long t)
+{
+    const struct stage *g=&stages[s];
+
+    if(t<=g->start)
+        return g->from;
+    if(t>=g->end)
+        return g->to;
+    return g->from+(g->to-g->from)*(t-g->start)/(double)(g->end-g->start);
+}
+
+//闭环模式下时刻t同时工作的客户端数，至少有一个
+static int profile_clients(long long t)
+{
+    double f=stage_load(profile_stage(t),t)*clients;
+    int n=(int)f;
+
+    if(n<f)
+        n++;
+    return n<1?1:n;
+}
+
+//全局第id个客户端从时刻t起最早什么时候开始工作，测试结束前都不用工作时返回-1
+static long long profile_wake(int id,long long t)
+{
+    const struct stage *g;
+    double need=(double)id/clients;
+    long long a;
+    int i;
+
+    if(id==0)
+        return t;
+
+    for(i=0; i<nstages; i++)
+    {
+        g=&stages[i];
+        if(g->end<=t)
+            continue;
+        a=t>g->start?t:g->start;
+        if(stage_load(i,a)>need)
+            return a;
+
+        //负载在这个阶段中间涨过了需要的比例
+        if(g->to>need)
+            return g->start+(long long)((need-g->from)/(g->to-g->from)*(g->end-g->start))+1;
+    }
+
+    return -1;
+}
+
+//开环模式：到时刻t为止全局应该已经发出的请求数，速率曲线的积分
+static double profile_count(long long t)
+{
+    const struct stage *g=&stages[profile_stage(t)];
+    double u,d;
+
+    if(t<g->start)
+        t=g->start;
+    if(t>g->end)
+        t=g->end;
+    u=(t-g->start)/1000000.0;
+    d=(g->end-g->start)/1000000.0;
+    return g->count+rate*(g->from*u+(g->to-g->from)*u*u/(2*d));
+}
+
+//开环模式：全局第j个请求计划发出的时间，测试结束前都不用发时返回一个很远的时间
+static long long profile_time(double j)
+{
+    const struct stage *g;
+    double a,b,x,u,d;
+    int i;
+
+    for(i=0; i<nstages; i++)
+    {
+        g=&stages[i];
+        if(i<nstages-1 && stages[i+1].count<=j)
+            continue;
+
+        //阶段内速率从rate*from线性变到rate*to，解 a*u+b*u*u/2=x
+        d=(g->end-g->start)/1000000.0;
+        a=rate*g->from;
+        b=rate*(g->to-g->from)/d;
+        x=j-g->count;
+        if(b==0)
+            u=a>0?x/a:d+1;
+        else if(x<=0)
+            u=0;
+        else
+            u=2*x/(a+sqrt(a*a+2*b*x));
+
+        if(u>d && i==nstages-1)
+            break;
+        return g->start+(long long)(u*1000000.0);
+    }
+
+    return LLONG_MAX/2;
+}
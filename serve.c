@@ -0,0 +1,582 @@
+#include <sys/uio.h>
+#include <netinet/tcp.h>
+
+/*
+
+参考服务器：
+
+压测结果偏低时，先要知道是服务器慢还是压测机自己就只能打这么多
+webbench --serve 在本机起一个极简、极快的HTTP服务器，用来标定客户端：
+
+    webbench --serve 8000 -w 4 --serve-size 1024        4个工作进程，回复1024字节的正文
+    webbench -e epoll -k -c 200 http://127.0.0.1:8000/   在同一台或另一台机器上测它
+
+服务器几乎不做事，测出来的就是这台压测机(和网络)的上限，
+没有网络的机器上也可以拿它回归测试各个压测引擎
+
+每个工作进程用SO_REUSEPORT各自监听同一个端口，由内核把新连接分给它们，
+进程之间没有共享的accept队列和锁，可以用--cpus绑核
+每个进程一个边沿触发的epoll循环，回复报文事先构造好，正文所有连接共用一块内存，
+流水线上的多个回复用一次writev发出去
+
+按请求决定是否保持连接：HTTP/1.1默认保持，HTTP/1.0要有Connection: keep-alive，
+HTTP/0.9只回正文然后关闭，请求的Content-Length正文读出来丢掉
+--serve-delay给每个回复加上固定的延迟，模拟应用处理时间
+延迟都一样，先到的请求一定先到期，所以到期队列只是一个先进先出的环
+
+父进程每秒打印一次这一秒回复的请求数和字节数，Ctrl-C结束
+
+*/
+
+#define SERVE_IN_SIZE 8192   //每个连接的请求缓冲区，请求头不能超过这么大
+#define SERVE_QUEUE 256      //每个连接最多排队的回复数，流水线更深时等回复发出去再解析
+#define SERVE_IOV 64         //一次writev最多的分段数
+
+//排队回复的标志
+#define RESP_HEAD  1         //HEAD请求，只回头部
+#define RESP_CLOSE 2         //发完这个回复关闭连接
+#define RESP_HTTP09 4        //HTTP/0.9，没有头部
+
+int serve_port=0;            //--serve 参考服务器监听的端口
+long long serve_size=64;     //--serve-size 回复正文的字节数
+double serve_delay=0;        //--serve-delay 每个回复的延迟，毫秒
+
+struct sconn
+{
+    int fd;
+    unsigned gen;            //连接的编号，槽位复用后延迟队列里的旧条目据此作废
+    int len;                 //请求缓冲区里的字节数
+    long long skip;          //还要丢掉的请求正文字节数
+    int queued;              //已经解析出来还没发完的回复数
+    int ready;               //其中到了发送时间的个数
+    int qhead;               //flags环里第一个排队的回复
+    long long off;           //第一个回复已经发出的字节数
+    int closing;             //已经排了要关闭连接的回复，后面的请求不再解析
+    unsigned char flags[SERVE_QUEUE];
+    char in[SERVE_IN_SIZE];
+    struct sconn *next;      //空闲链表
+};
+
+//延迟队列的条目
+struct sdelay
+{
+    struct sconn *c;
+    unsigned gen;
+    long long due;           //到期时间，微秒
+};
+
+static char *serve_body;     //所有连接共用的正文
+static char serve_keep[160],serve_close[160];//保持连接和关闭连接的回复头部
+static int serve_keep_len,serve_close_len;
+
+static struct sconn *sconn_free;//用过的连接槽位不还给malloc，延迟队列里的指针一直有效
+static unsigned sconn_gen;
+
+static struct sdelay *delayq;//延迟队列，环形，满了就扩大一倍
+static int delayq_size,delayq_head,delayq_len;
+
+static volatile sig_atomic_t serve_stop=0;
+
+//构造回复头部和正文，正文是可见字符的循环，方便用--expect-crc32检查
+static int serve_prepare(void)
+{
+    long long i;
+
+    serve_body=malloc(serve_size>0?serve_size:1);
+    if(serve_body==NULL)
+        return -1;
+    for(i=0; i<serve_size; i++)
+        serve_body[i]='a'+i%26;
+    if(serve_size>0)
+        serve_body[serve_size-1]='\n';
+
+    serve_keep_len=snprintf(serve_keep,sizeof(serve_keep),
+                            "HTTP/1.1 200 OK\r\nServer: WebBench "PROGRAM_VERSION"\r\n"
+                            "Content-Length: %lld\r\nConnection: keep-alive\r\n\r\n",serve_size);
+    serve_close_len=snprintf(serve_close,sizeof(serve_close),
+                             "HTTP/1.1 200 OK\r\nServer: WebBench "PROGRAM_VERSION"\r\n"
+                             "Content-Length: %lld\r\nConnection: close\r\n\r\n",serve_size);
+    return 0;
+}
+
+//一个回复的头部和正文
+static void serve_resp(int f,const char **hdr,long long *hlen,long long *blen)
+{
+    if(f&RESP_HTTP09)
+    {
+        *hdr=NULL;
+        *hlen=0;
+    }
+    else if(f&RESP_CLOSE)
+    {
+        *hdr=serve_close;
+        *hlen=serve_close_len;
+    }
+    else
+    {
+        *hdr=serve_keep;
+        *hlen=serve_keep_len;
+    }
+    *blen=(f&RESP_HEAD)?0:serve_size;
+}
+
+static struct sconn *sconn_new(int fd)
+{
+    struct sconn *c=sconn_free;
+
+    if(c!=NULL)
+        sconn_free=c->next;
+    else if((c=malloc(sizeof(*c)))==NULL)
+        return NULL;
+
+    c->fd=fd;
+    c->gen=++sconn_gen;
+    c->len=0;
+    c->skip=0;
+    c->queued=0;
+    c->ready=0;
+    c->qhead=0;
+    c->off=0;
+    c->closing=0;
+    return c;
+}
+
+static void sconn_close(struct sconn *c)
+{
+    SYSCALL(close(c->fd));
+    c->fd=-1;
+    c->gen=++sconn_gen;
+    c->next=sconn_free;
+    sconn_free=c;
+}
+
+//排一个到期的回复
+static int delay_push(struct sconn *c,long long due)
+{
+    struct sdelay *q;
+    int i;
+
+    if(delayq_len==delayq_size)
+    {
+        q=malloc(sizeof(*q)*(delayq_size?delayq_size*2:1024));
+        if(q==NULL)
+            return -1;
+        for(i=0; i<delayq_len; i++)
+            q[i]=delayq[(delayq_head+i)%delayq_size];
+        free(delayq);
+        delayq=q;
+        delayq_size=delayq_size?delayq_size*2:1024;
+        delayq_head=0;
+    }
+
+    q=&delayq[(delayq_head+delayq_len)%delayq_size];
+    q->c=c;
+    q->gen=c->gen;
+    q->due=due;
+    delayq_len++;
+    return 0;
+}
+
+//在[p,end)中找n个字节的str，找不到返回NULL
+static char *serve_find(char *p,const char *end,const char *str,size_t n)
+{
+    for(; p+n<=end; p++)
+    {
+        p=memchr(p,str[0],end-p-n+1);
+        if(p==NULL)
+            return NULL;
+        if(!memcmp(p,str,n))
+            return p;
+    }
+    return NULL;
+}
+
+//从line开始的一行是不是name头部，是的话返回值的开始
+static const char *header_value(const char *line,const char *end,const char *name)
+{
+    size_t n=strlen(name);
+
+    if((size_t)(end-line)<=n || strncasecmp(line,name,n) || line[n]!=':')
+        return NULL;
+    for(line+=n+1; line<end && (*line==' ' || *line=='\t'); line++)
+        ;
+    return line;
+}
+
+//值里有没有word，不区分大小写
+static int value_has(const char *v,const char *end,const char *word)
+{
+    size_t n=strlen(word);
+
+    for(; v+n<=end; v++)
+        if(!strncasecmp(v,word,n))
+            return 1;
+    return 0;
+}
+
+//解析缓冲区里所有完整的请求，每个请求排一个回复，请求格式错误返回-1
+static int serve_parse(struct sconn *c,long long now)
+{
+    char *p=c->in,*end=c->in+c->len,*h,*eol,*line,*next;
+    const char *v;
+    long long n,body;
+    int f,v11,close_hdr,keep_hdr;
+
+    while(!c->closing && c->queued<SERVE_QUEUE)
+    {
+        //上一个请求的正文
+        if(c->skip>0)
+        {
+            n=end-p<c->skip?end-p:c->skip;
+            p+=n;
+            c->skip-=n;
+            if(c->skip>0)
+                break;
+        }
+
+        eol=serve_find(p,end,"\r\n",2);
+        if(eol==NULL)
+            break;
+
+        f=0;
+        if(eol-p>=5 && !memcmp(p,"HEAD ",5))
+            f|=RESP_HEAD;
+
+        //请求行里没有HTTP/版本号的是HTTP/0.9，只有这一行
+        v=serve_find(p,eol," HTTP/",6);
+        if(v==NULL)
+        {
+            f=RESP_HTTP09|RESP_CLOSE;
+            p=eol+2;
+        }
+        else
+        {
+            h=serve_find(p,end,"\r\n\r\n",4);
+            if(h==NULL)
+                break;
+
+            v11=eol-v>=9 && !memcmp(v," HTTP/1.1",9);
+            close_hdr=keep_hdr=0;
+            body=0;
+            for(line=eol+2; line<h+2; line=next)
+            {
+                next=serve_find(line,h+2,"\r\n",2)+2;
+                if((v=header_value(line,next-2,"Connection"))!=NULL)
+                {
+                    close_hdr|=value_has(v,next-2,"close");
+                    keep_hdr|=value_has(v,next-2,"keep-alive");
+                }
+                else if((v=header_value(line,next-2,"Content-Length"))!=NULL)
+                    body=atoll(v);
+            }
+
+            if(v11?close_hdr:!keep_hdr)
+                f|=RESP_CLOSE;
+            c->skip=body>0?body:0;
+            p=h+4;
+        }
+
+        c->flags[(c->qhead+c->queued)%SERVE_QUEUE]=f;
+        c->queued++;
+        if(f&RESP_CLOSE)
+            c->closing=1;
+        if(serve_delay>0)
+        {
+            if(delay_push(c,now+(long long)(serve_delay*1000)))
+                return -1;
+        }
+        else
+            c->ready++;
+    }
+
+    //没解析完的半个请求挪到缓冲区开头
+    c->len=end-p;
+    memmove(c->in,p,c->len);
+
+    //能解析的时候缓冲区满了还是不到一个完整的请求头
+    if(c->len==SERVE_IN_SIZE && c->queued<SERVE_QUEUE && !c->closing)
+        return -1;
+    return 0;
+}
+
+/*
+发出所有到期的回复，连续的几个回复拼成一次writev
+返回-1表示连接要关闭(出错或者发完了要关闭的回复)，0表示发完了或者socket写满了
+*/
+static int serve_write(struct sconn *c)
+{
+    struct iovec iov[SERVE_IOV];
+    const char *hdr;
+    long long hlen,blen,off,n;
+    int k,niov,f;
+
+    while(c->ready>0)
+    {
+        //从第一个回复已经发出的地方开始，头部和正文各占一段
+        niov=0;
+        off=c->off;
+        for(k=0; k<c->ready && niov<=SERVE_IOV-2; k++)
+        {
+            serve_resp(c->flags[(c->qhead+k)%SERVE_QUEUE],&hdr,&hlen,&blen);
+            if(off<hlen)
+            {
+                iov[niov].iov_base=(char *)hdr+off;
+                iov[niov++].iov_len=hlen-off;
+                off=0;
+            }
+            else
+                off-=hlen;
+            if(off<blen)
+            {
+                iov[niov].iov_base=serve_body+off;
+                iov[niov++].iov_len=blen-off;
+            }
+            off=0;
+        }
+
+        n=SYSCALL(writev(c->fd,iov,niov));
+        if(n<0)
+            return (errno==EAGAIN || errno==EINTR)?0:-1;
+        st->bytes+=n;
+
+        //写出去的字节依次算到各个回复上
+        while(c->ready>0)
+        {
+            f=c->flags[c->qhead];
+            serve_resp(f,&hdr,&hlen,&blen);
+            if(n<hlen+blen-c->off)
+            {
+                c->off+=n;
+                break;
+            }
+            n-=hlen+blen-c->off;
+            c->off=0;
+            c->qhead=(c->qhead+1)%SERVE_QUEUE;
+            c->queued--;
+            c->ready--;
+            st->speed++;
+            if(f&RESP_CLOSE)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+解析缓冲区里的请求、发出到期的回复、再从socket读，直到socket读空或者写满
+边沿触发只通知一次，所以每次都要做到EAGAIN为止
+回复排满时先不读，发出去一些(EPOLLOUT或者延迟到期)之后再回到这里接着读
+连接要关闭时返回-1
+*/
+static int serve_io(struct sconn *c)
+{
+    int n,full;
+
+    while(1)
+    {
+        if(serve_parse(c,serve_delay>0?now_us():0))
+            return -1;
+        full=c->queued>=SERVE_QUEUE;
+        if(serve_write(c))
+            return -1;
+        if(c->queued>=SERVE_QUEUE || c->closing)
+            return 0;
+
+        //刚腾出了位置，缓冲区里可能还有没解析的请求
+        if(full)
+            continue;
+
+        n=SYSCALL(read(c->fd,c->in+c->len,SERVE_IN_SIZE-c->len));
+        if(n<0)
+            return (errno==EAGAIN || errno==EINTR)?0:-1;
+        if(n==0)
+            return -1;
+        c->len+=n;
+    }
+}
+
+//接受所有排队的新连接
+static void serve_accept(int epfd,int ls)
+{
+    struct epoll_event ev;
+    struct sconn *c;
+    int fd,one=1;
+
+    while(1)
+    {
+        //直接得到非阻塞的socket，省去一次fcntl调用
+        fd=SYSCALL(accept4(ls,NULL,NULL,SOCK_NONBLOCK));
+        if(fd<0)
+        {
+            if(errno==EMFILE || errno==ENFILE)
+                perror(" accept failed ");
+            return;
+        }
+        setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+
+        c=sconn_new(fd);
+        if(c==NULL)
+        {
+            SYSCALL(close(fd));
+            continue;
+        }
+        ev.events=EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET;
+        ev.data.ptr=c;
+        if(SYSCALL(epoll_ctl(epfd,EPOLL_CTL_ADD,fd,&ev)))
+            sconn_close(c);
+    }
+}
+
+//工作进程的事件循环，不会返回
+static void serve_worker(int id)
+{
+    struct epoll_event ev,events[256];
+    struct sdelay *d;
+    long long now;
+    int ls,epfd,n,i,wait;
+
+    st=&slots[id];
+    affinity_apply(id);
+
+    ls=SocketListen(serve_port,1);
+    epfd=epoll_create1(0);
+    if(ls<0 || epfd<0)
+    {
+        perror(" Failed to start the server ");
+        exit(3);
+    }
+    fcntl(ls,F_SETFL,O_NONBLOCK);
+
+    //监听socket用水平触发，一次accept不完下次还会通知
+    ev.events=EPOLLIN;
+    ev.data.ptr=NULL;
+    epoll_ctl(epfd,EPOLL_CTL_ADD,ls,&ev);
+
+    while(1)
+    {
+        //发出到期的回复，连接已经关了的条目直接丢掉
+        wait=-1;
+        if(delayq_len>0)
+        {
+            now=now_us();
+            while(delayq_len>0)
+            {
+                d=&delayq[delayq_head];
+                if(d->due>now)
+                {
+                    wait=(d->due-now+999)/1000;
+                    break;
+                }
+                delayq_head=(delayq_head+1)%delayq_size;
+                delayq_len--;
+                if(d->c->gen!=d->gen)
+                    continue;
+                d->c->ready++;
+                if(serve_io(d->c))
+                    sconn_close(d->c);
+            }
+        }
+
+        n=SYSCALL(epoll_wait(epfd,events,sizeof(events)/sizeof(events[0]),wait));
+        for(i=0; i<n; i++)
+        {
+            if(events[i].data.ptr==NULL)
+                serve_accept(epfd,ls);
+            else if((events[i].events&(EPOLLERR|EPOLLHUP)) || serve_io(events[i].data.ptr))
+                sconn_close(events[i].data.ptr);
+        }
+    }
+}
+
+static void serve_signal(int sig)
+{
+    serve_stop=sig;
+}
+
+//--serve：启动参考服务器，父进程每秒打印一次吞吐，直到收到SIGINT或SIGTERM
+static int serve(void)
+{
+    struct sigaction sa;
+    struct stats total,last;
+    pid_t *pids;
+    int i,sec;
+
+    if(workers<=0)
+        workers=pinned?ncpu_list:sysconf(_SC_NPROCESSORS_ONLN);
+    if(workers<=0)
+        workers=1;
+    nprocs=workers;
+
+    slots=stats_alloc(workers);
+    pids=calloc(workers,sizeof(pid_t));
+    if(slots==NULL || pids==NULL || serve_prepare())
+    {
+        perror(" Failed to allocate the server state ");
+        return 3;
+    }
+    raise_nofile(65536);
+
+    //先试一下端口能不能监听，免得每个工作进程各报一遍错
+    i=SocketListen(serve_port,1);
+    if(i<0)
+    {
+        perror(" Failed to listen ");
+        return 3;
+    }
+    close(i);
+
+    printf("Serving %lld byte responses on port %d with %d workers",serve_size,serve_port,workers);
+    if(serve_delay>0)
+        printf(",%g ms delay",serve_delay);
+    printf("\n");
+    fflush(stdout);
+
+    for(i=0; i<workers; i++)
+    {
+        pids[i]=fork();
+        if(pids[i]==0)
+        {
+            signal(SIGPIPE,SIG_IGN);
+            serve_worker(i);
+        }
+        if(pids[i]<0)
+        {
+            perror(" Failed to create subprocesses ");
+            while(--i>=0)
+                kill(pids[i],SIGTERM);
+            return 3;
+        }
+    }
+
+    memset(&sa,0,sizeof(sa));
+    sa.sa_handler=serve_signal;
+    sigaction(SIGINT,&sa,NULL);
+    sigaction(SIGTERM,&sa,NULL);
+
+    memset(&last,0,sizeof(last));
+    for(sec=1; !serve_stop; sec++)
+    {
+        sleep(1);
+        stats_sum(&total,slots,workers);
+        printf("[%4ds] served %lld requests/s, %lld bytes/s\n",sec,total.speed-last.speed,total.bytes-last.bytes);
+        fflush(stdout);
+        last=total;
+
+        //有工作进程意外退出(比如被OOM杀掉)就停下来
+        if(waitpid(-1,NULL,WNOHANG)>0)
+        {
+            fprintf(stderr,"A server worker exited unexpectedly\n");
+            serve_stop=SIGTERM;
+        }
+    }
+
+    for(i=0; i<workers; i++)
+        kill(pids[i],SIGTERM);
+    while(wait(NULL)>0)
+        ;
+
+    stats_sum(&total,slots,workers);
+    printf("Served %lld requests, %lld bytes, %lld system calls in total\n",total.speed,total.bytes,total.syscalls);
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+
+连接状态的内存：
+
+fork引擎每个客户端是一个进程，有自己的栈、页表和一份全局变量，一个连接要几百KB
+要保持上百万个基本空闲的长连接时，epoll和uring引擎每个连接占用的内存只有这些：
+
+    struct conn          每个槽位固定一份，只放连接一直要用的状态，一百字节出头
+    回复的解析状态        有请求在进行时才从池里取，槽位进入空闲队列时还回去
+    模板渲染的缓冲区      只在发送请求时占用，发完就还
+    HTTP/2的连接状态      第一次连上时才分配，收发缓冲区只在有不完整的帧、没发完的数据时占用
+    uring的接收缓冲区     注册成一个缓冲区环，内核在数据到达时才取一个，处理完马上还回去
+    epoll的接收缓冲区     本来就是所有连接共用一个
+
+池(slab)：每种固定大小的对象一个，向系统一次要一大块(SLAB_BYTES)切成对象，
+还回来的对象串在空闲链表上，下次先用它们，取和还都是O(1)，也没有malloc每个对象的头部
+池只增不减，大小就是测试中同时用到的最多对象数
+
+测试结束时每个工作进程记下同时打开的最多连接数、连接状态和缓冲区占用的字节数、进程实际占用的内存(Pss)，
+报告中给出平均每个连接的字节数，内核里的socket和它的缓冲区不算在内
+
+*/
+
+//每次向系统要的内存，对象比它大时一次要一个
+#define SLAB_BYTES (256*1024)
+
+//一种固定大小的对象的池
+struct slab
+{
+    int size;        //对象的大小，按16字节对齐
+    int per;         //一块切成几个对象
+    void *free;      //还回来的对象，每个对象开头放着下一个的地址
+    char *next;      //当前这一块还没切出去的部分
+    int left;        //当前这一块还剩几个对象
+};
+
+static long long mem_state=0;//本工作进程给连接状态和缓冲区分配的字节数，固定的数组和池都在内
+static int conns_open=0;     //本工作进程现在打开的连接数
+static int conns_peak=0;     //同时打开的最多连接数
+
+//size为0时(比如没有模板)池不会被用到，对象也要放得下空闲链表的指针
+static void slab_init(struct slab *s,int size)
+{
+    if(size<(int)sizeof(void *))
+        size=sizeof(void *);
+    s->size=(size+15)&~15;
+    s->per=SLAB_BYTES/s->size>0?SLAB_BYTES/s->size:1;
+    s->free=NULL;
+    s->next=NULL;
+    s->left=0;
+}
+
+//取一个对象，内容是上一次用剩的，调用的地方自己初始化
+static void *slab_alloc(struct slab *s)
+{
+    size_t len;
+    void *p;
+
+    if(s->free!=NULL)
+    {
+        p=s->free;
+        s->free=*(void **)p;
+        return p;
+    }
+
+    if(s->left==0)
+    {
+        len=(size_t)s->size*s->per;
+        s->next=mmap(NULL,len,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+        if(s->next==MAP_FAILED)
+        {
+            perror(" Failed to allocate connection state ");
+            exit(3);
+        }
+        s->left=s->per;
+    }
+
+    //只算切出去的对象，块里还没用到的部分不占内存
+    mem_state+=s->size;
+    p=s->next;
+    s->next+=s->size;
+    s->left--;
+    return p;
+}
+
+//还回一个对象，p为NULL时什么也不做
+static void slab_free(struct slab *s,void *p)
+{
+    if(p==NULL)
+        return;
+    *(void **)p=s->free;
+    s->free=p;
+}
+
+//分配每个槽位一份的数组，计入连接状态的内存，失败返回NULL
+static void *state_calloc(size_t n,size_t size)
+{
+    mem_state+=n*size;
+    return calloc(n,size);
+}
+
+//建立了一个连接
+static void conn_opened(void)
+{
+    if(++conns_open>conns_peak)
+        conns_peak=conns_open;
+}
+
+//进程实际占用的内存(Pss，和别的进程共享的页按共享的进程数分摊)，字节，内核不支持时用常驻内存
+static long long mem_pss(void)
+{
+    char line[128];
+    long long kb=-1,size,resident;
+    FILE *f;
+
+    f=fopen("/proc/self/smaps_rollup","r");
+    if(f!=NULL)
+    {
+        while(kb<0 && fgets(line,sizeof(line),f)!=NULL)
+            if(sscanf(line,"Pss: %lld kB",&kb)!=1)
+                kb=-1;
+        fclose(f);
+    }
+    if(kb>=0)
+        return kb*1024;
+
+    f=fopen("/proc/self/statm","r");
+    if(f==NULL)
+        return 0;
+    if(fscanf(f,"%lld %lld",&size,&resident)!=2)
+        resident=0;
+    fclose(f);
+    return resident*sysconf(_SC_PAGESIZE);
+}
+
+//子进程结束前记下连接数和内存，fork引擎每个进程就是一个连接
+static void mem_record(void)
+{
+    st->conns_peak+=engine==ENGINE_FORK?1:conns_peak;
+    st->mem_state+=mem_state;
+    st->mem_pss+=mem_pss();
+}
@@ -1,3 +1,8 @@
+//accept4是GNU扩展
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <fcntl.h>
@@ -10,6 +15,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <errno.h>
 
 /*
 
@@ -68,74 +74,264 @@ struct hostent
 
 */
 
-//host        ip地址或者主机名
-//clientPort  端口
-int Socket(const char *host, int clientPort)
+/*
+
+addrinfo分析：
+gethostbyname只能查IPv4地址，也不是线程安全的
+getaddrinfo同时支持IPv4和IPv6，一次返回所有地址，每个地址都可以直接交给connect
+
+struct addrinfo
 {
-    int sock;
-    unsigned long inaddr;
+    int ai_flags;
+    int ai_family;              //AF_INET或AF_INET6
 
-    struct sockaddr_in ad;//地址信息
-    struct hostent *hp;//主机信息
+    int ai_socktype;            //SOCK_STREAM
 
-    /*
+    int ai_protocol;
 
-    因为host可能是ip地址或者主机名
-    所以当host为主机名的时候需要通过主机名得到IP地址
+    socklen_t ai_addrlen;       //ai_addr的长度
 
-    */
-    //初始化地址
-    memset(&ad, 0, sizeof(ad));
+    struct sockaddr *ai_addr;   //可以直接用于connect的地址，端口号已经填好
 
-    //采用TCP/IP协议族
-    ad.sin_family = AF_INET;
+    char *ai_canonname;
 
-    //点分十进制IP转化为二进制IP
-    inaddr = inet_addr(host);
+    struct addrinfo *ai_next;   //下一个地址
+};
 
-    //输入为IP地址
-    if (inaddr != INADDR_NONE)
-        //将IP地址复制给ad的sin_addr属性
-        memcpy(&ad.sin_addr, &inaddr, sizeof(inaddr));
-    //输入不是IP地址，是主机名
-    else
+解析可能要读/etc/hosts、查DNS，很慢
+所以只在测试开始前解析一次，结果保存在struct addr数组里，之后每次连接直接用
+
+*/
+
+//一个解析好的地址，IPv4和IPv6都能放下
+struct addr
+{
+    struct sockaddr_storage sa;
+    socklen_t len;
+};
+
+//最多保存的地址数
+#define MAX_ADDRS 64
+
+//解析主机地址，填充到addrs数组中
+//host        ip地址(IPv6不带方括号)或者主机名
+//clientPort  端口
+//max         addrs数组的大小
+//成功返回地址个数，失败返回-1
+int Resolve(const char *host, int clientPort, struct addr *addrs, int max)
+{
+    struct addrinfo hints, *res, *ai;
+    char port[16];
+    int n = 0;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;        //IPv4和IPv6都要
+    hints.ai_socktype = SOCK_STREAM;    //TCP
+
+    snprintf(port, sizeof(port), "%d", clientPort);
+
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return -1;
+
+    for (ai = res; ai != NULL && n < max; ai = ai->ai_next)
     {
-        //通过主机名得到主机信息
-        hp = gethostbyname(host);
+        if (ai->ai_addrlen > sizeof(addrs[n].sa))
+            continue;
+        memcpy(&addrs[n].sa, ai->ai_addr, ai->ai_addrlen);
+        addrs[n].len = ai->ai_addrlen;
+        n++;
+    }
 
-        //没有得到主机信息
-        if (hp == NULL)
-            return -1;
-        //将IP地址复制给ad的sin_addr属性
-        memcpy(&ad.sin_addr, hp->h_addr, hp->h_length);
+    freeaddrinfo(res);
+
+    return n > 0 ? n : -1;
+}
+
+//把地址转成可以打印的字符串，如 127.0.0.1:80 或 [::1]:80
+void AddrString(const struct addr *ad, char *buf, int len)
+{
+    char ip[INET6_ADDRSTRLEN], port[16];
+
+    if (getnameinfo((const struct sockaddr *)&ad->sa, ad->len, ip, sizeof(ip),
+                    port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+    {
+        snprintf(buf, len, "?");
+        return;
     }
 
-    /*
-    将端口号从主机字节顺序变成网络字节顺序
-    就是整数在地址空间存储方式变为高字节存放在内存低字节处
+    if (ad->sa.ss_family == AF_INET6)
+        snprintf(buf, len, "[%s]:%s", ip, port);
+    else
+        snprintf(buf, len, "%s:%s", ip, port);
+}
 
-    网络字节顺序是TCP/IP中规定好的一种数据表示格式，与CPU和操作系统无关
-    从而可以保证数据在不同主机之间传输时能够被正确解释
-    网络字节顺序采用大尾顺序：高字节存储在内存低字节处
-    */
-    ad.sin_port = htons(clientPort);
+//用已经解析好的地址建立阻塞连接
+//成功返回socket，失败返回-1
+int SocketAddr(const struct addr *ad)
+{
+    int sock;
 
     /*
     AF_INET:     IPV4网络协议
+    AF_INET6:    IPV6网络协议
     SOCK_STRAM:  提供面向连接的稳定数据传输，即TCP协议
     */
-    //创建一个采用IPV4和TCP的socket
-    sock = socket(AF_INET, SOCK_STREAM, 0);
+    //按地址的协议族创建一个TCP的socket
+    sock = socket(ad->sa.ss_family, SOCK_STREAM, 0);
 
     //创建socket失败
     if (sock < 0)
         return sock;
 
     //建立连接 连接失败返回-1
-    if (connect(sock, (struct sockaddr *)&ad, sizeof(ad)) < 0)
+    if (connect(sock, (const struct sockaddr *)&ad->sa, ad->len) < 0)
+    {
+        close(sock);
         return -1;
+    }
 
     //创建成功 返回socket
     return sock;
 }
 
+//设置地址中的端口号
+void AddrSetPort(struct addr *ad, int port)
+{
+    if (ad->sa.ss_family == AF_INET6)
+        ((struct sockaddr_in6 *)&ad->sa)->sin6_port = htons(port);
+    else
+        ((struct sockaddr_in *)&ad->sa)->sin_port = htons(port);
+}
+
+//地址中的端口号
+int AddrPort(const struct addr *ad)
+{
+    if (ad->sa.ss_family == AF_INET6)
+        return ntohs(((const struct sockaddr_in6 *)&ad->sa)->sin6_port);
+    return ntohs(((const struct sockaddr_in *)&ad->sa)->sin_port);
+}
+
+//连接之前绑定本地地址
+//端口为0时告诉内核先不要选端口，到connect时再按完整的四元组选，
+//这样同一个本地端口可以连不同的目的地址，端口不会因为bind而提前用完
+//成功返回0，失败返回-1
+int SocketBind(int sock, const struct addr *local)
+{
+    int one = 1;
+
+    if (AddrPort(local) == 0)
+        setsockopt(sock, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+    else
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    return bind(sock, (const struct sockaddr *)&local->sa, local->len);
+}
+
+//用已经解析好的地址发起非阻塞连接，供事件驱动引擎使用
+//local不为NULL时先绑定这个本地地址
+//返回值：失败返回-1，errno是失败的原因
+//        成功返回socket，*inprogress为1表示连接还在进行中，需要等待可写事件
+int SocketNonblock(const struct addr *ad, const struct addr *local, int *inprogress)
+{
+    int sock, err;
+
+    //直接创建非阻塞socket，省去一次fcntl调用
+    sock = socket(ad->sa.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sock < 0)
+        return -1;
+
+    *inprogress = 0;
+    if (local != NULL && SocketBind(sock, local) < 0)
+    {
+        err = errno;
+        close(sock);
+        errno = err;
+        return -1;
+    }
+
+    if (connect(sock, (const struct sockaddr *)&ad->sa, ad->len) < 0)
+    {
+        //非阻塞连接通常返回EINPROGRESS，连接结果稍后由可写事件通知
+        if (errno != EINPROGRESS)
+        {
+            err = errno;
+            close(sock);
+            errno = err;
+            return -1;
+        }
+        *inprogress = 1;
+    }
+
+    return sock;
+}
+
+//监听队列的长度，内核会截到net.core.somaxconn
+//参考服务器要在测试开始时接住成千上万个同时到来的连接，队列满了客户端的SYN要等一秒多重传，
+//测出来的尾延迟就是服务器自己造成的
+#define LISTEN_BACKLOG 65535
+
+//在本机所有地址的port端口上监听，IPv6同时接受IPv4的连接，不支持IPv6时只监听IPv4
+//reuseport为1时多个进程可以各自监听同一个端口，由内核把新连接分给它们
+//成功返回socket，失败返回-1
+int SocketListen(int port, int reuseport)
+{
+    struct sockaddr_in6 a6;
+    struct sockaddr_in a4;
+    int sock, one = 1, zero = 0;
+
+    sock = socket(AF_INET6, SOCK_STREAM, 0);
+    if (sock >= 0)
+    {
+        setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (reuseport)
+            setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+        memset(&a6, 0, sizeof(a6));
+        a6.sin6_family = AF_INET6;
+        a6.sin6_addr = in6addr_any;
+        a6.sin6_port = htons(port);
+        if (bind(sock, (struct sockaddr *)&a6, sizeof(a6)) == 0 && listen(sock, LISTEN_BACKLOG) == 0)
+            return sock;
+        close(sock);
+    }
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+        return -1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (reuseport)
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    memset(&a4, 0, sizeof(a4));
+    a4.sin_family = AF_INET;
+    a4.sin_addr.s_addr = htonl(INADDR_ANY);
+    a4.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr *)&a4, sizeof(a4)) < 0 || listen(sock, LISTEN_BACKLOG) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+//只在解析好的地址ad上监听，比如只监听回环地址
+//成功返回socket，失败返回-1
+int SocketListenAddr(const struct addr *ad)
+{
+    int sock, one = 1;
+
+    sock = socket(ad->sa.ss_family, SOCK_STREAM, 0);
+    if (sock < 0)
+        return -1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(sock, (const struct sockaddr *)&ad->sa, ad->len) < 0 || listen(sock, LISTEN_BACKLOG) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
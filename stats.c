@@ -0,0 +1,351 @@
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <stddef.h>
+
+/*
+
+共享内存统计槽：
+
+以前子进程结束时才把结果写到管道，测试过程中什么都看不到，
+一个子进程意外退出，它的结果就丢了，总数也就不对了
+
+现在父进程在fork之前用mmap分配一块共享内存，每个子进程一个槽位
+子进程直接在自己的槽位上计数，父进程随时可以读：
+    测试过程中每秒采样一次，打印这一秒的请求数、字节数和错误数
+    测试结束后直接从槽位汇总，不再经过管道
+
+每个槽位只有一个子进程在写，不需要加锁
+槽位按64字节(缓存行)对齐，不同子进程的计数器不会落在同一个缓存行上，
+避免一个CPU写计数器时把其他CPU上的缓存行作废(伪共享)
+
+直方图不放在槽位里：一组直方图(struct hists)约125KB，fork引擎每个客户端每个阶段一个槽位，
+-c 10000 --steps 5时光直方图就要好几GB，汇总时读到的共享内存页也都会被真正分配出来
+所以槽位里只有计数器，直方图另外放在一块共享内存里，每个阶段nhists组：
+    epoll/uring引擎每个工作进程一组，直接记在里面
+    fork引擎每个CPU一组，子进程先记在自己的内存里，结束时用原子加法合并到第(编号 mod nhists)组，
+    异常退出的子进程计数器还在，直方图就没有了
+
+*/
+
+//计数器都是64位的，快速的服务器跑上几十秒，字节数就会超过int的范围
+struct stats
+{
+    long long speed;          //成功的请求数
+    long long failed;         //失败的请求数
+    long long bytes;          //读取到服务器回复的总字节数
+
+    long long connect_failed;
+    long long connect_timeout;//连接在--connect-timeout之内没有建立
+    long long timeouts;       //握手、发送或者等回复超过了--timeout
+    long long addr_unavail;   //本地地址或端口用完了(EADDRNOTAVAIL)，通常是TIME_WAIT占满了临时端口
+    long long send_failed;
+    long long wclose_failed;
+    long long read_failed;
+    long long invalid;        //回复没有通过--expect-*的检查
+    long long sclose_failed;
+
+    long long tls_failed;     //TLS握手失败
+    long long tls_full;       //完整握手和会话复用的简短握手的次数
+    long long tls_resumed;
+    long long tls_cpu_full;   //两种握手用掉的客户端CPU时间，微秒
+    long long tls_cpu_resumed;
+    int tls_version;          //协商出的TLS版本
+
+    long long h2_conns;       //--h2c时建立好(收到服务器SETTINGS)的连接数
+    long long h2_streams;     //开过的流数
+    long long h2_reset;       //被服务器RST_STREAM的流
+    long long h2_goaway;      //收到的GOAWAY
+    long long h2_unprocessed; //GOAWAY之后服务器没有处理的流
+    long long h2_stalls;      //请求正文因为发送窗口用完而停下的次数
+    long long h2_protocol;    //服务器违反协议而关闭的连接数
+    int h2_max_streams;       //服务器允许的最大并发流数，0表示没有限制
+
+    long long unsent;         //开环模式下到测试结束时已经到了计划时间却还没有发出的请求数
+    long long syscalls;       //发出的系统调用次数
+    long long conns_peak;     //同时打开的最多连接数，测试结束时记一次
+    long long mem_state;      //epoll/uring引擎给连接状态和缓冲区分配的字节数
+    long long mem_pss;        //测试结束时进程实际占用的内存(Pss)，字节
+    int cpu;                  //--cpus时子进程实际所在的核和NUMA节点
+    int node;
+
+    //按状态码分类的回复个数和延迟，下标0是解析不出状态码的回复，1~5是1xx~5xx
+    //失败的请求也在里面，用来看清楚高吞吐是不是全是错误页
+    long long status[STATUS_CLASSES];
+    long long status_latency[STATUS_CLASSES];//延迟的总和，微秒
+    long long status_max[STATUS_CLASSES];    //最大延迟，微秒
+} __attribute__((aligned(64)));
+
+//一组直方图，单位都是微秒，全部由struct histogram组成，可以当作数组逐个合并
+struct hists
+{
+    struct histogram latency;//成功请求的延迟分布
+
+    //请求各阶段的耗时分布，单位微秒，用来判断慢在哪一步：
+    //建立连接(服务器accept队列满了会慢)、发完请求到收到第一个字节(应用处理)、收完整个回复(传输)
+    //长连接复用时没有建立连接这一步，流水线时一批请求记一次
+    struct histogram connect_time;
+    struct histogram ttfb;
+    struct histogram transfer;
+
+    //TLS握手的耗时分布，从TCP连上到握手完成，完整握手和简短握手分开
+    struct histogram handshake_full;
+    struct histogram handshake_resumed;
+
+    //HTTP/2连接的建立耗时，从TCP连上到收到服务器的SETTINGS
+    struct histogram h2_setup;
+};
+
+#define HISTS_COUNT (int)(sizeof(struct hists)/sizeof(struct histogram))
+
+//状态码分类的名字，输出结果时用
+static const char *status_names[STATUS_CLASSES]={"other","1xx","2xx","3xx","4xx","5xx"};
+
+//每秒采样一次得到的时间序列
+struct sample
+{
+    long long requests; //这一秒成功的请求数
+    long long bytes;    //这一秒读取的字节数
+    long long errors;   //这一秒失败的请求数
+    int stage;          //这一秒结束时所在的阶段
+};
+
+struct sample *series;  //每秒一个采样
+int nseries=0;          //采样的个数
+
+//分配n个子进程共享的统计槽，fork之后父子进程看到的是同一块内存
+static struct stats *stats_alloc(int n)
+{
+    void *p;
+
+    //匿名共享映射的内容一开始都是0
+    p=mmap(NULL,sizeof(struct stats)*n,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+    if(p==MAP_FAILED)
+        return NULL;
+    return p;
+}
+
+//分配n组子进程共享的直方图
+static struct hists *hists_alloc(int n)
+{
+    void *p;
+
+    p=mmap(NULL,sizeof(struct hists)*n,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+    if(p==MAP_FAILED)
+        return NULL;
+    return p;
+}
+
+//汇总n个槽位的计数器到dst
+static void stats_sum(struct stats *dst,const struct stats *slots,int n)
+{
+    int i,k;
+
+    memset(dst,0,sizeof(*dst));
+
+    for(i=0; i<n; i++)
+    {
+        dst->speed+=slots[i].speed;
+        dst->failed+=slots[i].failed;
+        dst->bytes+=slots[i].bytes;
+
+        dst->connect_failed+=slots[i].connect_failed;
+        dst->connect_timeout+=slots[i].connect_timeout;
+        dst->timeouts+=slots[i].timeouts;
+        dst->addr_unavail+=slots[i].addr_unavail;
+        dst->send_failed+=slots[i].send_failed;
+        dst->wclose_failed+=slots[i].wclose_failed;
+        dst->read_failed+=slots[i].read_failed;
+        dst->invalid+=slots[i].invalid;
+        dst->sclose_failed+=slots[i].sclose_failed;
+
+        dst->tls_failed+=slots[i].tls_failed;
+        dst->tls_full+=slots[i].tls_full;
+        dst->tls_resumed+=slots[i].tls_resumed;
+        dst->tls_cpu_full+=slots[i].tls_cpu_full;
+        dst->tls_cpu_resumed+=slots[i].tls_cpu_resumed;
+        if(slots[i].tls_version>dst->tls_version)
+            dst->tls_version=slots[i].tls_version;
+
+        dst->h2_conns+=slots[i].h2_conns;
+        dst->h2_streams+=slots[i].h2_streams;
+        dst->h2_reset+=slots[i].h2_reset;
+        dst->h2_goaway+=slots[i].h2_goaway;
+        dst->h2_unprocessed+=slots[i].h2_unprocessed;
+        dst->h2_stalls+=slots[i].h2_stalls;
+        dst->h2_protocol+=slots[i].h2_protocol;
+        if(slots[i].h2_max_streams>dst->h2_max_streams)
+            dst->h2_max_streams=slots[i].h2_max_streams;
+
+        dst->unsent+=slots[i].unsent;
+        dst->syscalls+=slots[i].syscalls;
+        dst->conns_peak+=slots[i].conns_peak;
+        dst->mem_state+=slots[i].mem_state;
+        dst->mem_pss+=slots[i].mem_pss;
+
+        for(k=0; k<STATUS_CLASSES; k++)
+        {
+            dst->status[k]+=slots[i].status[k];
+            dst->status_latency[k]+=slots[i].status_latency[k];
+            if(slots[i].status_max[k]>dst->status_max[k])
+                dst->status_max[k]=slots[i].status_max[k];
+        }
+    }
+}
+
+//汇总n组直方图到dst
+static void hists_sum(struct hists *dst,const struct hists *h,int n)
+{
+    int i,k;
+
+    memset(dst,0,sizeof(*dst));
+    for(i=0; i<n; i++)
+        for(k=0; k<HISTS_COUNT; k++)
+            hist_merge((struct histogram *)dst+k,(const struct histogram *)&h[i]+k);
+}
+
+//每类状态码的回复数和延迟，没有回复的类不打印
+static void status_print(const struct stats *t)
+{
+    int k,i;
+
+    printf("Status codes:\n");
+    for(k=1; k<=STATUS_CLASSES; k++)
+    {
+        //解析不出状态码的回复放在最后
+        i=k%STATUS_CLASSES;
+        if(t->status[i]==0)
+            continue;
+        printf("%-9s %lld responses,mean:%.3f max:%.3f ms\n",status_names[i],t->status[i],
+               t->status_latency[i]/(double)t->status[i]/1000.0,t->status_max[i]/1000.0);
+    }
+}
+
+//第s个阶段的负载，闭环模式是同时工作的客户端数，开环模式是请求速率
+static void stage_load_print(int s)
+{
+    const struct stage *g=&stages[s];
+
+    if(rate>0)
+    {
+        if(g->from==g->to)
+            printf("target %g req/s",rate*g->to);
+        else
+            printf("target %g->%g req/s",rate*g->from,rate*g->to);
+        return;
+    }
+
+    if(g->from==g->to)
+        printf("%d clients",profile_clients(g->end-1));
+    else
+        printf("%d->%d clients",profile_clients(g->start),profile_clients(g->end-1));
+}
+
+/*
+有负载曲线时每个阶段单独汇总：
+    step 2     10.0 s  50 clients  12345 req/s  0 failed  mean 1.234 p50 1.100 p99 5.000 max 9.000 ms
+预热阶段也列出来，但不计入总结果
+每个阶段n个槽位、nh组直方图
+*/
+static void stages_print(const struct stats *slots,int n,const struct hists *hslots,int nh)
+{
+    static struct hists h;
+    struct stats t;
+    const struct stage *g;
+    double sec;
+    int s;
+
+    printf("Stages:\n");
+    for(s=0; s<nstages; s++)
+    {
+        g=&stages[s];
+        sec=(g->end-g->start)/1000000.0;
+        stats_sum(&t,slots+s*n,n);
+        hists_sum(&h,hslots+s*nh,nh);
+
+        printf("%-10s %6.1f s  ",g->name,sec);
+        stage_load_print(s);
+        printf("  %.0f req/s  %.0f bytes/s  %lld failed",t.speed/sec,t.bytes/sec,t.failed);
+        if(h.latency.count>0)
+            printf("  mean %.3f p50 %.3f p99 %.3f max %.3f ms",h.latency.sum/(double)h.latency.count/1000.0,
+                   hist_percentile(&h.latency,50)/1000.0,hist_percentile(&h.latency,99)/1000.0,
+                   h.latency.max/1000.0);
+        printf("%s\n",s<first_stage?"  (not counted)":"");
+    }
+}
+
+//回收已经结束的子进程，block为1时等待，返回回收的个数
+static int reap_children(int block)
+{
+    int status,n=0;
+    pid_t pid;
+
+    while((pid=waitpid(-1,&status,block?0:WNOHANG))>0)
+    {
+        n++;
+
+        //子进程异常退出，它槽位里已经记下的结果仍然有效
+        if(!WIFEXITED(status) || WEXITSTATUS(status)!=0)
+            fprintf(stderr,"A child process deaid\n");
+
+        if(block)
+            break;
+    }
+
+    return n;
+}
+
+/*
+父进程在测试过程中每秒采样一次所有槽位，打印这一秒的情况：
+    [  1s] 12345 requests/s,1234567 bytes/s,0 errors
+有负载曲线时后面带上所在的阶段，如 (step 2)
+直到所有子进程都结束，n是子进程数，每个阶段n个槽位
+*/
+static void monitor(struct stats *slots,int n)
+{
+    struct stats cur,prev;
+    struct timespec ts;
+    long long tick;
+    int left=n,k=0,s;
+
+    memset(&prev,0,sizeof(prev));
+    tick=bench_start;
+
+    //分配失败时只是不保存时间序列
+    series=calloc(runtime,sizeof(struct sample));
+
+    //预热和测试时间内按秒采样
+    while(left>0 && k<runtime)
+    {
+        tick+=1000000;
+        ts.tv_sec=tick/1000000;
+        ts.tv_nsec=tick%1000000*1000;
+        while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL)==EINTR)
+            ;
+
+        left-=reap_children(0);
+        k++;
+        s=profile_stage(k*1000000LL-1);
+
+        stats_sum(&cur,slots,nstages*n);
+        printf("[%3ds] %lld requests/s,%lld bytes/s,%lld errors",k,
+               cur.speed-prev.speed,cur.bytes-prev.bytes,cur.failed-prev.failed);
+        if(profiled())
+            printf(" (%s)",stages[s].name);
+        printf("\n");
+        fflush(stdout);
+
+        if(series!=NULL)
+        {
+            series[nseries].requests=cur.speed-prev.speed;
+            series[nseries].bytes=cur.bytes-prev.bytes;
+            series[nseries].errors=cur.failed-prev.failed;
+            series[nseries].stage=s;
+            nseries++;
+        }
+        prev=cur;
+    }
+
+    //时间到了，等剩下的子进程退出
+    while(left>0 && (k=reap_children(1))>0)
+        left-=k;
+}
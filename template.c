@@ -0,0 +1,363 @@
+#include <ctype.h>
+
+/*
+
+请求模板：
+
+固定的请求报文每个请求都一样，经过CDN或者缓存时每次都命中同一个缓存键，测到的只是命中的路径
+URL的路径、查询参数和--header的值里可以放变量，每个请求发出时填入新的值：
+
+    {{seq}}            序号，本次测试所有工作进程发出的请求各不相同
+    {{rand:LO-HI}}     LO到HI之间(含两端)均匀分布的随机整数
+    {{choice:a,b,c}}   从逗号分开的选项中随机选一个
+    {{worker}}         工作进程的编号，从0开始
+
+    webbench -k "http://cdn.example.com/img/{{rand:1-100000}}.jpg"
+    webbench --header "X-Tenant: {{choice:alpha,beta,gamma}}" "http://example.com/api?id={{seq}}"
+
+-r(--reload)就是在查询参数后面加上 _wb={{seq}}，每个请求都是一个新的缓存键
+序号在每个工作进程内递增，乘上进程数再加上进程编号，不用进程间同步也不会重复
+(分布式测试时各个代理的序号会重复，要区分时再加上别的变量)
+
+开始时把每个带变量的请求报文编译成一串片段：文字片段记下它在tmpl_text中的位置，变量片段记下类型和参数
+发送时按顺序拷贝文字、把数字直接写成十进制，不分配内存，也不调用printf一类的函数
+没有变量的条目不经过模板，仍然直接发arena里构造好的报文
+
+渲染出来的长度每次都可能不同，所以报文渲染到发送方自己的缓冲区里：
+fork引擎每个进程一个，epoll和uring引擎发送时从池里取一个(slab.c)，发完就还，HTTP/2在开流时编码进报头块
+有正文的模板请求不能用流水线，每一份报头的长度都不一样
+
+*/
+
+#define TMPL_TEXT   0  //原样拷贝的文字
+#define TMPL_SEQ    1
+#define TMPL_RAND   2
+#define TMPL_CHOICE 3
+#define TMPL_WORKER 4
+
+//模板的一个片段
+struct tmpl_seg
+{
+    int type;
+    int off,len;                //TEXT：文字在tmpl_text中的位置和长度；CHOICE：选项在tmpl_choices中的位置和个数
+    unsigned long long lo,span; //RAND：最小值和取值的个数，span为0表示整个64位的范围
+};
+
+//一个模板是tmpl_segs中连续的nseg个片段
+struct tmpl
+{
+    int seg,nseg;
+    int max;        //渲染出来的最大长度
+};
+
+//CHOICE的一个选项，文字在tmpl_text中
+struct tmpl_str
+{
+    int off,len;
+};
+
+static char *tmpl_text;           //所有文字片段和选项
+static int tmpl_text_len=0;
+static struct tmpl_seg *tmpl_segs;
+static int ntmpl_segs=0;
+static struct tmpl_str *tmpl_choices;
+static int ntmpl_choices=0;
+static struct tmpl *tmpls;
+static int ntmpls=0;
+
+static int tmpl_size=0;           //渲染一个请求(流水线时一批)要的缓冲区大小，0表示没有模板
+static unsigned long long tmpl_seq=0;//本进程已经用掉的序号
+
+//把s开始的len个字节加进tmpl_text，返回它的位置
+static int tmpl_text_add(const char *s,int len)
+{
+    int off=tmpl_text_len;
+
+    tmpl_text=workload_realloc(tmpl_text,tmpl_text_len+len);
+    memcpy(tmpl_text+off,s,len);
+    tmpl_text_len+=len;
+    return off;
+}
+
+static struct tmpl_seg *tmpl_seg_add(int type)
+{
+    struct tmpl_seg *g;
+
+    tmpl_segs=workload_realloc(tmpl_segs,sizeof(struct tmpl_seg)*(ntmpl_segs+1));
+    g=&tmpl_segs[ntmpl_segs++];
+    memset(g,0,sizeof(*g));
+    g->type=type;
+    return g;
+}
+
+//v写成十进制的位数
+static int tmpl_digits(unsigned long long v)
+{
+    int n=1;
+
+    while(v>=10)
+    {
+        v/=10;
+        n++;
+    }
+    return n;
+}
+
+//解析一个变量{{name:arg}}，s指向name，len是到}}之前的长度，返回渲染出来的最大长度，格式错误返回-1
+static int tmpl_var(const char *s,int len)
+{
+    struct tmpl_seg *g;
+    const char *arg=memchr(s,':',len),*end=s+len,*p;
+    char num[32],*q;
+    unsigned long long hi;
+    int nlen=arg!=NULL?arg-s:len,max=0;
+
+    if(nlen==3 && memcmp(s,"seq",3)==0 && arg==NULL)
+    {
+        tmpl_seg_add(TMPL_SEQ);
+        return 20;
+    }
+    if(nlen==6 && memcmp(s,"worker",6)==0 && arg==NULL)
+    {
+        tmpl_seg_add(TMPL_WORKER);
+        return 10;
+    }
+    if(arg==NULL || ++arg>=end)
+        return -1;
+
+    //rand:LO-HI，只支持非负整数
+    if(nlen==4 && memcmp(s,"rand",4)==0)
+    {
+        if(end-arg>=(int)sizeof(num) || !isdigit((unsigned char)*arg))
+            return -1;
+        memcpy(num,arg,end-arg);
+        num[end-arg]='\0';
+        g=tmpl_seg_add(TMPL_RAND);
+        errno=0;
+        g->lo=strtoull(num,&q,10);
+        if(*q!='-' || !isdigit((unsigned char)q[1]))
+            return -1;
+        hi=strtoull(q+1,&q,10);
+        if(*q!='\0' || errno || hi<g->lo)
+            return -1;
+        g->span=hi-g->lo+1;
+        return tmpl_digits(hi);
+    }
+
+    //choice:a,b,c，选项可以是空的
+    if(nlen==6 && memcmp(s,"choice",6)==0)
+    {
+        g=tmpl_seg_add(TMPL_CHOICE);
+        g->off=ntmpl_choices;
+        for(p=arg; p<=end; p=q+1)
+        {
+            q=memchr(p,',',end-p);
+            if(q==NULL)
+                q=(char *)end;
+            tmpl_choices=workload_realloc(tmpl_choices,sizeof(struct tmpl_str)*(ntmpl_choices+1));
+            tmpl_choices[ntmpl_choices].len=q-p;
+            tmpl_choices[ntmpl_choices++].off=tmpl_text_add(p,q-p);
+            g->len++;
+            if(q-p>max)
+                max=q-p;
+        }
+        return max;
+    }
+
+    return -1;
+}
+
+//在p到end之间找两个连着的字符c，"{{"或者"}}"
+static const char *tmpl_find(const char *p,const char *end,char c)
+{
+    while(p<end && (p=memchr(p,c,end-p))!=NULL && p+1<end)
+    {
+        if(p[1]==c)
+            return p;
+        p++;
+    }
+    return NULL;
+}
+
+/*
+把s开始的len个字节编译成模板，返回模板的编号，没有变量时返回-1
+变量写错了直接退出，错误信息里带上what(出错的请求)
+*/
+static int tmpl_compile(const char *s,int len,const char *what)
+{
+    struct tmpl *t;
+    const char *end=s+len,*p,*q;
+    int first=ntmpl_segs,max=0,n;
+
+    if(tmpl_find(s,end,'{')==NULL)
+        return -1;
+
+    for(p=s; p<end; p=q+2)
+    {
+        //变量之前的文字
+        q=tmpl_find(p,end,'{');
+        if(q==NULL)
+            q=end;
+        if(q>p)
+        {
+            tmpl_seg_add(TMPL_TEXT);
+            tmpl_segs[ntmpl_segs-1].len=q-p;
+            tmpl_segs[ntmpl_segs-1].off=tmpl_text_add(p,q-p);
+            max+=q-p;
+        }
+        if(q==end)
+            break;
+
+        p=q+2;
+        q=tmpl_find(p,end,'}');
+        if(q==NULL || (n=tmpl_var(p,q-p))<0)
+        {
+            fprintf(stderr,"Template error,%s: bad variable {{%.*s\n",what,q!=NULL?(int)(q-p+2):(int)(end-p),p);
+            exit(2);
+        }
+        max+=n;
+    }
+
+    tmpls=workload_realloc(tmpls,sizeof(struct tmpl)*(ntmpls+1));
+    t=&tmpls[ntmpls];
+    t->seg=first;
+    t->nseg=ntmpl_segs-first;
+    t->max=max;
+    return ntmpls++;
+}
+
+//把v写成十进制，返回写了几个字节
+static int tmpl_put_u64(char *dst,unsigned long long v)
+{
+    char tmp[20];
+    int n=0,i;
+
+    do
+    {
+        tmp[n++]='0'+v%10;
+        v/=10;
+    }while(v);
+    for(i=0; i<n; i++)
+        dst[i]=tmp[n-1-i];
+    return n;
+}
+
+//渲染第t个模板到dst，返回长度，dst至少要有tmpls[t].max字节
+static int tmpl_render(int t,char *dst)
+{
+    const struct tmpl_seg *g=&tmpl_segs[tmpls[t].seg],*end=g+tmpls[t].nseg;
+    const struct tmpl_str *c;
+    unsigned long long r;
+    char *p=dst;
+
+    for(; g<end; g++)
+    {
+        switch(g->type)
+        {
+        case TMPL_TEXT:
+            memcpy(p,tmpl_text+g->off,g->len);
+            p+=g->len;
+            break;
+
+        case TMPL_SEQ:
+            p+=tmpl_put_u64(p,tmpl_seq++*nprocs+worker_id);
+            break;
+
+        case TMPL_RAND:
+            r=workload_rand();
+            p+=tmpl_put_u64(p,g->lo+(g->span?r%g->span:r));
+            break;
+
+        case TMPL_CHOICE:
+            c=&tmpl_choices[g->off+(int)((workload_rand()>>32)%(unsigned)g->len)];
+            memcpy(p,tmpl_text+c->off,c->len);
+            p+=c->len;
+            break;
+
+        case TMPL_WORKER:
+            p+=tmpl_put_u64(p,worker_id);
+            break;
+        }
+    }
+
+    return p-dst;
+}
+
+//开始测试前编译所有带变量的条目，算出每个发送方要准备的缓冲区大小
+static void tmpl_setup(void)
+{
+    struct entry *e;
+    int i,one,size;
+
+    //主机和端口在开始时就解析好了，不能随请求变化
+    if(strstr(host,"{{")!=NULL)
+    {
+        fprintf(stderr,"Template error,%s: variables are only allowed in the path,query and headers\n",host);
+        exit(2);
+    }
+
+    for(i=0; i<nentries; i++)
+    {
+        e=&entries[i];
+
+        //没有正文时arena里是pipeline份一样的报文，模板只编译一份
+        one=e->blen>0?e->hlen:e->hlen/pipeline;
+        e->tmpl=tmpl_compile(arena+e->off,one,e->url);
+        if(e->tmpl<0)
+            continue;
+
+        if(e->blen>0 && pipeline>1)
+        {
+            fprintf(stderr,"Template error,%s: requests with a body and variables can't be pipelined\n",e->url);
+            exit(2);
+        }
+        size=tmpls[e->tmpl].max*(e->blen>0?1:pipeline);
+        if(size>tmpl_size)
+            tmpl_size=size;
+    }
+}
+
+//给n个发送方分配模板的缓冲区，第i个是返回值+i*tmpl_size，没有模板时返回NULL
+static char *tmpl_bufs(int n)
+{
+    char *p;
+
+    if(tmpl_size==0)
+        return NULL;
+    p=malloc((size_t)n*tmpl_size);
+    if(p==NULL)
+    {
+        perror(" Failed to allocate request buffers ");
+        exit(3);
+    }
+    return p;
+}
+
+/*
+准备第e个条目的一次发送：没有变量时直接用arena里的报文，
+有变量时渲染到buf(tmpl_bufs()分配的或者池里取的一个)，流水线时每一份都填入新的值
+*/
+static void request_prepare(int e,char *buf,struct request_msg *m)
+{
+    const struct entry *en=&entries[e];
+    int i,n=0;
+
+    if(en->tmpl<0)
+    {
+        m->head=arena+en->off;
+        m->hlen=en->hlen;
+        m->len=en->len;
+        return;
+    }
+
+    if(en->blen>0)
+        n=tmpl_render(en->tmpl,buf);
+    else
+    {
+        for(i=0; i<pipeline; i++)
+            n+=tmpl_render(en->tmpl,buf+n);
+    }
+    m->head=buf;
+    m->hlen=n;
+    m->len=n+en->blen;
+}
@@ -0,0 +1,164 @@
+/*
+
+定时器轮：
+
+epoll和uring引擎的一个工作进程上有成千上万个连接，每个连接在任何时候最多只有一个期限：
+    CONN_CONNECTING                 --connect-timeout(uring引擎用链接在connect后面的超时操作)
+    CONN_HANDSHAKE、CONN_WRITING    --timeout，从开始握手、开始发送请求算起
+    CONN_READING                    --timeout，从请求发完算起，这一批回复都要在期限内收完
+    CONN_IDLE                       --idle-timeout，开环模式下等下一个计划时间的长连接
+    CONN_H2                         还没收到服务器SETTINGS时是建立的期限，之后是最早开出的流的--timeout
+
+每个连接一个定时器，按到期的刻度(1毫秒一格)挂在WHEEL_SLOTS个格子中的一个上，
+格子号是刻度对WHEEL_SLOTS取模(hashed timing wheel)，同一个格子里的定时器串成双向链表：
+    加入、删除、改期限都只是改链表，O(1)，每个请求改两次期限也不费事
+    时间每过一格只看那一个格子，到期的取出来，转了不止一圈才到期的留着
+所以检查超时的开销和连接数无关，只和这段时间经过的格子数、格子里的定时器数有关
+定时器最多晚一格到期，不会提前
+
+*/
+
+#define WHEEL_SLOTS 4096    //格子数，2的幂，转一圈4.096秒
+#define WHEEL_TICK  1000    //一格的长度，微秒
+
+struct timer
+{
+    struct timer *prev,*next;//next为NULL表示不在轮子上
+    long long tick;          //到期的刻度
+};
+
+struct wheel
+{
+    struct timer slots[WHEEL_SLOTS];//每个格子的链表头
+    struct timer due;        //已经到期、还没取走的定时器
+    long long tick;          //下一个要检查的刻度，之前的格子都检查过了
+    int count;               //轮子上(包括due上)的定时器数
+};
+
+//本工作进程的定时器轮
+static struct wheel wheel;
+
+static void list_init(struct timer *head)
+{
+    head->prev=head->next=head;
+}
+
+//把t接到head链表的末尾
+static void list_add(struct timer *head,struct timer *t)
+{
+    t->prev=head->prev;
+    t->next=head;
+    head->prev->next=t;
+    head->prev=t;
+}
+
+static void list_del(struct timer *t)
+{
+    t->prev->next=t->next;
+    t->next->prev=t->prev;
+    t->prev=t->next=NULL;
+}
+
+//now(微秒)开始计时，之前的格子不用再看
+static void wheel_init(struct wheel *w,long long now)
+{
+    int i;
+
+    for(i=0; i<WHEEL_SLOTS; i++)
+        list_init(&w->slots[i]);
+    list_init(&w->due);
+    w->tick=now/WHEEL_TICK;
+    w->count=0;
+}
+
+static int timer_armed(const struct timer *t)
+{
+    return t->next!=NULL;
+}
+
+//取消定时器，不在轮子上时什么也不做
+static void timer_del(struct wheel *w,struct timer *t)
+{
+    if(t->next==NULL)
+        return;
+    list_del(t);
+    w->count--;
+}
+
+//定时器在at(微秒)到期，已经在轮子上时改成新的期限
+static void timer_add(struct wheel *w,struct timer *t,long long at)
+{
+    timer_del(w,t);
+
+    //已经过了的期限在下一次检查时到期
+    t->tick=(at+WHEEL_TICK-1)/WHEEL_TICK;
+    if(t->tick<w->tick)
+        t->tick=w->tick;
+    list_add(&w->slots[t->tick&(WHEEL_SLOTS-1)],t);
+    w->count++;
+}
+
+//检查从上次到now经过的格子，到期的定时器挪到due上
+static void wheel_advance(struct wheel *w,long long now)
+{
+    struct timer *head,*t,*next;
+    long long tick=now/WHEEL_TICK,last;
+    int full;
+
+    //隔了不止一圈时每个格子只看一遍
+    full=tick-w->tick>=WHEEL_SLOTS;
+    last=full?w->tick+WHEEL_SLOTS-1:tick;
+
+    for(; w->count>0 && w->tick<=last; w->tick++)
+    {
+        head=&w->slots[w->tick&(WHEEL_SLOTS-1)];
+        for(t=head->next; t!=head; t=next)
+        {
+            next=t->next;
+            if(t->tick<=(full?tick:w->tick))
+            {
+                list_del(t);
+                list_add(&w->due,t);
+            }
+        }
+    }
+
+    //轮子上没有定时器时中间的格子不用看
+    w->tick=tick+1;
+}
+
+//取出一个到now为止已经到期的定时器，没有了返回NULL
+static struct timer *timer_expired(struct wheel *w,long long now)
+{
+    struct timer *t;
+
+    if(w->due.next==&w->due)
+        wheel_advance(w,now);
+    if(w->due.next==&w->due)
+        return NULL;
+
+    t=w->due.next;
+    list_del(t);
+    w->count--;
+    return t;
+}
+
+//从now开始最多还要等多少毫秒就可能有定时器到期，wait是原来要等的毫秒数(-1表示一直等)，返回两者中小的那个
+//只往前看wait之内的格子，看到第一个不空的格子为止(里面的定时器可能还要再转几圈，早醒一次没有关系)
+static int timer_wait(struct wheel *w,long long now,int wait)
+{
+    long long tick,end;
+
+    if(w->count==0 || wait==0)
+        return wait;
+    if(w->due.next!=&w->due)
+        return 0;
+
+    end=w->tick+WHEEL_SLOTS;
+    if(wait>0 && now/WHEEL_TICK+wait*1000LL/WHEEL_TICK<end)
+        end=now/WHEEL_TICK+wait*1000LL/WHEEL_TICK;
+    for(tick=w->tick; tick<end; tick++)
+        if(w->slots[tick&(WHEEL_SLOTS-1)].next!=&w->slots[tick&(WHEEL_SLOTS-1)])
+            return wait_until(now,tick*WHEEL_TICK,wait);
+    return wait_until(now,end*WHEEL_TICK,wait);
+}
@@ -0,0 +1,316 @@
+/*
+
+HTTPS：
+
+https://的URL在TCP连接建立之后先做TLS握手，之后的请求和回复都经过TLS加密
+需要OpenSSL，用 make TLS=1 编译，没有编译进来时https://的URL直接报错
+
+TLS终结层的开销主要在握手上：完整握手要做一次非对称的密钥交换，
+会话复用(session resumption)时客户端带上上次的会话，双方跳过证书和密钥交换，
+两种握手的耗时和CPU差别很大，所以分开统计：
+
+    --tls-resume none     每个连接都是完整握手(默认)
+    --tls-resume id       复用会话ID，会话ID只存在于TLS 1.2，所以限制在TLS 1.2
+    --tls-resume ticket   复用会话票据(session ticket)，TLS 1.3和1.2都可以
+
+每个子进程记住服务器最近发来的会话，新连接都带上它，
+服务器接受时是简短握手，拒绝时退回完整握手，两种握手各自计数
+握手耗时从TCP连上到握手完成，不算在connect阶段里，请求的延迟仍然从建立连接开始算
+握手的CPU时间是握手过程中本进程(客户端)消耗的CPU，用来估算压测机能撑住多少新建连接
+
+不校验服务器证书，自签名证书的测试环境可以直接用
+TLS记录解密后才知道哪些是正文，--drain在HTTPS下不起作用
+
+*/
+
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+
+#define TLS_RESUME_NONE   0
+#define TLS_RESUME_ID     1
+#define TLS_RESUME_TICKET 2
+static const char *tls_resume_names[]={"none","id","ticket"};
+
+int tls=0;                        //目标是https://
+int tls_resume=TLS_RESUME_NONE;   //--tls-resume
+
+#ifdef WEBBENCH_TLS
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+//一个连接的TLS状态
+struct tls_conn
+{
+    SSL *ssl;
+    int done;           //握手完成了
+    int want;           //上一次操作在等可读(EPOLLIN)还是可写(EPOLLOUT)
+    long long start;    //握手开始的时间
+    long long cpu;      //握手到目前为止用掉的CPU时间，微秒
+};
+
+static SSL_CTX *tls_ctx;
+static SSL_SESSION *tls_session;  //本进程要复用的会话
+
+//每次发送最多从报文里凑这么多字节交给SSL_write，正好是一个TLS记录的上限
+#define TLS_WRITE_MAX 16384
+static char tls_wbuf[TLS_WRITE_MAX];
+
+//本线程用掉的CPU时间，微秒
+static long long cpu_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID,&ts);
+    return (long long)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+/*
+服务器发来新会话时记下来，TLS 1.2在握手结束时，TLS 1.3在握手之后收到票据时
+不能等到关闭连接时再取：服务器不发close_notify就断开，OpenSSL会把会话作废
+返回1表示会话归我们了
+*/
+static int tls_new_session(SSL *ssl,SSL_SESSION *s)
+{
+    (void)ssl;
+    if(tls_resume==TLS_RESUME_NONE || !SSL_SESSION_is_resumable(s))
+        return 0;
+    SSL_SESSION_free(tls_session);
+    tls_session=s;
+    return 1;
+}
+
+//fork之前创建所有子进程共用的SSL_CTX，失败返回3
+static int tls_setup(void)
+{
+    long opts=SSL_OP_NO_COMPRESSION;
+
+    tls_ctx=SSL_CTX_new(TLS_client_method());
+    if(tls_ctx==NULL)
+    {
+        ERR_print_errors_fp(stderr);
+        return 3;
+    }
+
+    SSL_CTX_set_verify(tls_ctx,SSL_VERIFY_NONE,NULL);
+
+    //写缓冲区每次都重新组装，重试时地址会变；一个记录写出去就返回，不等全部写完
+    SSL_CTX_set_mode(tls_ctx,SSL_MODE_ENABLE_PARTIAL_WRITE|SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    //会话由子进程自己保存和设置，不用OpenSSL的内部缓存，只要新会话的回调
+    SSL_CTX_set_session_cache_mode(tls_ctx,SSL_SESS_CACHE_CLIENT|SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(tls_ctx,tls_new_session);
+
+    //很多服务器不发close_notify就关闭连接，当作正常结束，不然会话会被作废
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    opts|=SSL_OP_IGNORE_UNEXPECTED_EOF;
+#endif
+    if(tls_resume!=TLS_RESUME_TICKET)
+        opts|=SSL_OP_NO_TICKET;
+    if(tls_resume==TLS_RESUME_ID)
+        SSL_CTX_set_max_proto_version(tls_ctx,TLS1_2_VERSION);
+    SSL_CTX_set_options(tls_ctx,opts);
+
+    return 0;
+}
+
+//为连接上的socket s准备TLS，握手由tls_handshake()完成，失败返回NULL
+static struct tls_conn *tls_new(int s)
+{
+    struct tls_conn *t;
+    int one=1;
+
+    t=calloc(1,sizeof(*t));
+    if(t==NULL)
+        return NULL;
+    t->ssl=SSL_new(tls_ctx);
+    if(t->ssl==NULL || !SSL_set_fd(t->ssl,s))
+    {
+        SSL_free(t->ssl);
+        free(t);
+        return NULL;
+    }
+
+    //主机名不是IP地址时带上SNI，虚拟主机据此选证书
+    if(strchr(host,':')==NULL && strspn(host,"0123456789.")!=strlen(host))
+        SSL_set_tlsext_host_name(t->ssl,host);
+
+    //握手的最后一段和第一个请求是分开写的，Nagle会让请求等服务器延迟的ACK
+    setsockopt(s,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+
+    SSL_set_connect_state(t->ssl);
+    if(tls_resume!=TLS_RESUME_NONE && tls_session!=NULL)
+        SSL_set_session(t->ssl,tls_session);
+
+    t->start=now_us();
+    t->want=EPOLLOUT;
+    return t;
+}
+
+//把OpenSSL的错误转成errno：要等socket时是EAGAIN，被信号打断是EINTR，其他是EIO
+static int tls_error(struct tls_conn *t,int ret)
+{
+    switch(SSL_get_error(t->ssl,ret))
+    {
+    case SSL_ERROR_WANT_READ:
+        t->want=EPOLLIN;
+        errno=EAGAIN;
+        break;
+    case SSL_ERROR_WANT_WRITE:
+        t->want=EPOLLOUT;
+        errno=EAGAIN;
+        break;
+    case SSL_ERROR_SYSCALL:
+        if(errno!=EINTR)
+            errno=EIO;
+        break;
+    default:
+        errno=EIO;
+        break;
+    }
+    ERR_clear_error();
+    return -1;
+}
+
+/*
+推进握手，阻塞的socket上一次就做完
+返回1表示握手完成，0表示要等socket(等什么在t->want里)，-1表示失败
+完成时按完整握手和简短握手分别记录耗时和CPU时间
+*/
+static int tls_handshake(struct tls_conn *t)
+{
+    long long cpu=cpu_us();
+    int r;
+
+    r=SSL_do_handshake(t->ssl);
+    t->cpu+=cpu_us()-cpu;
+    if(r!=1)
+    {
+        tls_error(t,r);
+        if(errno==EAGAIN)
+            return 0;
+        st->tls_failed++;
+        return -1;
+    }
+
+    t->done=1;
+    st->tls_version=SSL_version(t->ssl);
+    if(SSL_session_reused(t->ssl))
+    {
+        st->tls_resumed++;
+        st->tls_cpu_resumed+=t->cpu;
+        hist_record_n(&hs->handshake_resumed,now_us()-t->start,1);
+    }
+    else
+    {
+        st->tls_full++;
+        st->tls_cpu_full+=t->cpu;
+        hist_record_n(&hs->handshake_full,now_us()-t->start,1);
+    }
+    return 1;
+}
+
+//发出iov中的报文，一次最多一个TLS记录，返回写出的字节数，要等socket时返回-1并把errno设为EAGAIN
+static int tls_writev(struct tls_conn *t,const struct iovec *iov,int niov)
+{
+    int len=0,n,i,r;
+
+    for(i=0; i<niov && len<TLS_WRITE_MAX; i++)
+    {
+        n=iov[i].iov_len<(size_t)(TLS_WRITE_MAX-len)?(int)iov[i].iov_len:TLS_WRITE_MAX-len;
+        memcpy(tls_wbuf+len,iov[i].iov_base,n);
+        len+=n;
+    }
+
+    r=SSL_write(t->ssl,tls_wbuf,len);
+    if(r<=0)
+        return tls_error(t,r);
+    return r;
+}
+
+//读解密后的回复，对端关闭(有没有close_notify都一样)返回0
+static int tls_read(struct tls_conn *t,char *buf,int size)
+{
+    int r;
+
+    r=SSL_read(t->ssl,buf,size);
+    if(r>0)
+        return r;
+    if(SSL_get_error(t->ssl,r)==SSL_ERROR_ZERO_RETURN)
+        return 0;
+    tls_error(t,r);
+
+    //很多服务器不发close_notify就直接关闭连接，当作正常结束
+    if(errno==EIO && r==0)
+        return 0;
+    return -1;
+}
+
+//上一次操作要等的事件
+static int tls_want(const struct tls_conn *t)
+{
+    return t->want;
+}
+
+//释放连接的TLS状态，不发close_notify，和不复用连接时直接close一样
+static void tls_free(struct tls_conn *t)
+{
+    if(t==NULL)
+        return;
+    //标记为已经关闭，不然SSL_free会把这个连接的会话作废
+    SSL_set_shutdown(t->ssl,SSL_SENT_SHUTDOWN|SSL_RECEIVED_SHUTDOWN);
+    SSL_free(t->ssl);
+    free(t);
+}
+
+#else
+
+//没有编译TLS支持时，https://的URL在build_request()里就报错了，下面这些都不会被调用
+struct tls_conn;
+
+static int tls_setup(void)
+{
+    return 3;
+}
+
+#define tls_new(s) ((struct tls_conn *)NULL)
+#define tls_handshake(t) ((void)(t),-1)
+#define tls_writev(t,iov,niov) (errno=EIO,-1)
+#define tls_read(t,buf,size) (errno=EIO,-1)
+#define tls_want(t) 0
+#define tls_free(t) ((void)0)
+
+#endif
+
+//协议版本号的名字
+static const char *tls_version_name(int v)
+{
+    switch(v)
+    {
+    case 0x0301:
+        return "TLSv1.0";
+    case 0x0302:
+        return "TLSv1.1";
+    case 0x0303:
+        return "TLSv1.2";
+    case 0x0304:
+        return "TLSv1.3";
+    }
+    return "no handshake";
+}
+
+//握手的结果：完整和简短握手各自的次数、耗时分布和平均CPU时间
+static void tls_print(const struct stats *t,const struct hists *h)
+{
+    if(!tls)
+        return;
+
+    printf("TLS handshakes (%s,resumption %s):%lld full,%lld resumed,%lld failed\n",
+           tls_version_name(t->tls_version),tls_resume_names[tls_resume],
+           t->tls_full,t->tls_resumed,t->tls_failed);
+    hist_print_line("full",&h->handshake_full);
+    hist_print_line("resumed",&h->handshake_resumed);
+    printf("Handshake CPU:full %.1f us,resumed %.1f us per handshake\n",
+           t->tls_full?t->tls_cpu_full/(double)t->tls_full:0.0,
+           t->tls_resumed?t->tls_cpu_resumed/(double)t->tls_resumed:0.0);
+}
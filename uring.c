@@ -0,0 +1,863 @@
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <stdint.h>
+
+/*
+
+io_uring引擎：
+
+epollcore()里每一步都是一次系统调用：
+    epoll_wait得知可写 -> write -> epoll_ctl改成等可读 -> epoll_wait -> read -> close
+并发连接多了以后，进出内核的次数就成了客户端自己的瓶颈
+
+io_uring是内核和进程共享的两个环形队列：
+    提交队列(SQ)  进程把要做的操作(connect、发送、接收、close)填进去
+    完成队列(CQ)  内核把每个操作的结果放进来
+一个工作进程上所有连接的操作先攒在提交队列里，
+一次io_uring_enter把它们全部交给内核，同时等待完成，
+完成队列直接在共享内存里读，不需要系统调用
+这样一轮循环不管有多少个连接在动，都只进一次内核(新建socket除外)
+
+所有条目的请求报文(arena)在开始时一次性注册给内核(fixed buffers)，
+之后的发送不用每次都让内核去查找、锁定用户内存，注册失败时(如锁定内存的上限不够)改用普通的send操作
+接收缓冲区不再每个连接一个(上百万个连接时就是几个GB)，而是一个工作进程一个缓冲区环(provided buffers)：
+接收操作提交时不带缓冲区，数据到达时内核才从环里取一个，完成事件里带着它的编号，
+处理完马上放回环里，所以缓冲区的个数只和同时收到的数据有关，和连接数无关
+环里暂时没有缓冲区时接收操作失败(ENOBUFS)，放回缓冲区后重新提交
+带正文的请求用writev操作，报头和映射的正文组成的iovec放在每个连接自己的位置
+
+每个连接同一时刻只有一个操作在内核里，连接的状态和epollcore()相同，多了两个：
+    CONN_CLOSING     异步close已提交，等待结果，成功时这个请求才算成功
+    CONN_TIMEDOUT    超过了--timeout，已经提交了取消(IORING_OP_ASYNC_CANCEL)，在内核里的操作结束后关闭连接
+connect后面链接一个超时操作(IORING_OP_LINK_TIMEOUT)，到时间还没连上内核就取消connect
+发送和等回复的期限在定时器轮上(timer.c)，和epoll引擎一样
+等待完成时带上超时(IORING_ENTER_EXT_ARG)，最多等到下一个槽位轮到、下一个期限或者测试结束
+
+不依赖liburing，直接使用系统调用和内核头文件
+内核不支持io_uring、缺少需要的操作或者不能注册缓冲区环(5.19以前)时，自动改用epoll引擎
+
+*/
+
+#define CONN_CLOSING 4
+#define CONN_TIMEDOUT 7
+
+//接收缓冲区环中每个缓冲区的大小，和最多的缓冲区个数(2的幂)
+#define URING_RECV_SIZE 4096
+#define URING_RECV_BUFS 1024
+
+//内核允许的提交队列和完成队列的最大长度
+#define URING_MAX_SQ 32768
+#define URING_MAX_CQ 65536
+
+//进程这一侧看到的io_uring
+struct uring
+{
+    int fd;
+    unsigned *sq_head;       //内核已经取走的位置
+    unsigned *sq_tail;       //进程填到的位置
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sq_local;       //本地填到的位置，提交时才写回sq_tail
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;       //进程已经取走的位置
+    unsigned *cq_tail;       //内核放到的位置
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    char *sq_ring;           //两个队列和sqe数组的映射，uring_exit时解除
+    char *cq_ring;           //和sq_ring是同一块映射时不单独解除
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+};
+
+static struct uring ring;
+static char *uring_send;  //注册过的请求报文，是arena的副本
+static int uring_fixed;   //请求报文注册成功，发送用WRITE_FIXED
+static struct io_uring_buf_ring *uring_br;//接收缓冲区环，和内核共享
+static char *uring_bufs;  //环里的缓冲区，第i个在uring_bufs+i*URING_RECV_SIZE
+static unsigned uring_nbufs;//缓冲区的个数，也是环的长度
+static size_t uring_brlen;  //uring_br映射的长度，缓冲区在内
+static size_t uring_sendlen;//uring_send映射的长度
+static struct conn *uring_conns;
+static struct iovec *uring_iov;//带正文的请求，每个连接REQUEST_IOV个，操作完成前内核会读它
+static struct __kernel_timespec uring_cto;//connect的超时时间
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup,entries,p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+    return syscall(__NR_io_uring_enter,fd,to_submit,min_complete,flags,arg,argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr)
+{
+    return syscall(__NR_io_uring_register,fd,opcode,arg,nr);
+}
+
+//检查内核是否支持需要的全部操作，支持返回1
+static int uring_probe(int fd)
+{
+    static const int ops[]={IORING_OP_CONNECT,IORING_OP_CLOSE,IORING_OP_SEND,IORING_OP_RECV,
+                            IORING_OP_WRITE_FIXED,IORING_OP_LINK_TIMEOUT,
+                            IORING_OP_WRITEV,IORING_OP_ASYNC_CANCEL};
+    struct io_uring_probe *p;
+    unsigned i;
+    int ok=1;
+
+    p=calloc(1,sizeof(*p)+256*sizeof(struct io_uring_probe_op));
+    if(p==NULL)
+        return 0;
+
+    //比IORING_OP_CLOSE更老的内核连探测都不支持
+    if(sys_io_uring_register(fd,IORING_REGISTER_PROBE,p,256)<0)
+        ok=0;
+
+    for(i=0; ok && i<sizeof(ops)/sizeof(ops[0]); i++)
+        if(ops[i]>p->last_op || !(p->ops[ops[i]].flags&IO_URING_OP_SUPPORTED))
+            ok=0;
+
+    free(p);
+    return ok;
+}
+
+//父进程在fork之前检查io_uring是否可用，可用返回1
+static int uring_available(void)
+{
+    struct io_uring_params p;
+    int fd,ok;
+
+    memset(&p,0,sizeof(p));
+    fd=sys_io_uring_setup(1,&p);
+    if(fd<0)
+        return 0;
+
+    //等待完成时要能带超时
+    ok=(p.features&IORING_FEAT_EXT_ARG) && uring_probe(fd);
+    close(fd);
+    return ok;
+}
+
+//建立io_uring并映射两个队列，成功返回0
+static int uring_init(struct uring *r, unsigned entries, unsigned cq_entries)
+{
+    struct io_uring_params p;
+    size_t sqlen,cqlen;
+    char *sq,*cq;
+    unsigned i;
+
+    //失败时由uring_exit释放已经建好的部分
+    r->sq_ring=r->cq_ring=MAP_FAILED;
+    r->sqes=MAP_FAILED;
+
+    memset(&p,0,sizeof(p));
+
+    //只有本进程提交，完成事件的收尾工作推迟到本进程等待时再做，减少被打断的次数
+    p.flags=IORING_SETUP_CQSIZE|IORING_SETUP_SINGLE_ISSUER|IORING_SETUP_DEFER_TASKRUN;
+    p.cq_entries=cq_entries;
+    r->fd=sys_io_uring_setup(entries,&p);
+
+    //老内核不认识后两个标志
+    if(r->fd<0 && errno==EINVAL)
+    {
+        memset(&p,0,sizeof(p));
+        p.flags=IORING_SETUP_CQSIZE;
+        p.cq_entries=cq_entries;
+        r->fd=sys_io_uring_setup(entries,&p);
+    }
+    if(r->fd<0)
+        return -1;
+    if(!(p.features&IORING_FEAT_EXT_ARG))
+    {
+        errno=EOPNOTSUPP;
+        return -1;
+    }
+
+    sqlen=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+    cqlen=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+
+    //新内核上两个队列在同一块映射里
+    if(p.features&IORING_FEAT_SINGLE_MMAP)
+    {
+        if(cqlen>sqlen)
+            sqlen=cqlen;
+    }
+
+    sq=r->sq_ring=mmap(NULL,sqlen,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,r->fd,IORING_OFF_SQ_RING);
+    r->sq_len=sqlen;
+    if(sq==MAP_FAILED)
+        return -1;
+
+    if(p.features&IORING_FEAT_SINGLE_MMAP)
+        cq=sq;
+    else
+    {
+        cq=r->cq_ring=mmap(NULL,cqlen,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,r->fd,IORING_OFF_CQ_RING);
+        r->cq_len=cqlen;
+        if(cq==MAP_FAILED)
+            return -1;
+    }
+
+    r->sqes_len=p.sq_entries*sizeof(struct io_uring_sqe);
+    r->sqes=mmap(NULL,r->sqes_len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,r->fd,IORING_OFF_SQES);
+    if(r->sqes==MAP_FAILED)
+        return -1;
+
+    r->sq_head=(unsigned *)(sq+p.sq_off.head);
+    r->sq_tail=(unsigned *)(sq+p.sq_off.tail);
+    r->sq_mask=(unsigned *)(sq+p.sq_off.ring_mask);
+    r->sq_array=(unsigned *)(sq+p.sq_off.array);
+    r->sq_entries=p.sq_entries;
+    r->sq_local=*r->sq_tail;
+
+    r->cq_head=(unsigned *)(cq+p.cq_off.head);
+    r->cq_tail=(unsigned *)(cq+p.cq_off.tail);
+    r->cq_mask=(unsigned *)(cq+p.cq_off.ring_mask);
+    r->cqes=(struct io_uring_cqe *)(cq+p.cq_off.cqes);
+
+    //提交队列的第i项固定使用第i个sqe，之后就不用再填sq_array了
+    for(i=0; i<r->sq_entries; i++)
+        r->sq_array[i]=i;
+
+    return 0;
+}
+
+//把填好的操作交给内核，并等待至少wait个操作完成，最多等ms毫秒，-1表示一直等
+//返回-1表示出错，等到超时时errno是ETIME
+static int uring_submit(struct uring *r, unsigned wait, int ms)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned n;
+
+    __atomic_store_n(r->sq_tail,r->sq_local,__ATOMIC_RELEASE);
+    n=r->sq_local-__atomic_load_n(r->sq_head,__ATOMIC_ACQUIRE);
+
+    //总是带上GETEVENTS，推迟的完成事件要在这时才会放进完成队列
+    if(wait==0 || ms<0)
+        return SYSCALL(sys_io_uring_enter(r->fd,n,wait,IORING_ENTER_GETEVENTS,NULL,0));
+
+    ts.tv_sec=ms/1000;
+    ts.tv_nsec=ms%1000*1000000LL;
+    memset(&arg,0,sizeof(arg));
+    arg.ts=(uintptr_t)&ts;
+    return SYSCALL(sys_io_uring_enter(r->fd,n,wait,IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,&arg,sizeof(arg)));
+}
+
+//保证提交队列里至少有n个空位，满了先把已经填好的交给内核
+static void uring_space(struct uring *r, unsigned n)
+{
+    while(r->sq_local-__atomic_load_n(r->sq_head,__ATOMIC_ACQUIRE)+n>r->sq_entries)
+    {
+        if(uring_submit(r,0,-1)<0 && errno!=EINTR && errno!=EAGAIN && errno!=EBUSY)
+        {
+            perror(" io_uring_enter failed ");
+            exit(3);
+        }
+    }
+}
+
+//取一个空的sqe
+static struct io_uring_sqe *uring_sqe(struct uring *r, int op, struct conn *c)
+{
+    struct io_uring_sqe *sqe;
+
+    uring_space(r,1);
+    sqe=&r->sqes[r->sq_local&*r->sq_mask];
+    r->sq_local++;
+
+    memset(sqe,0,sizeof(*sqe));
+    sqe->opcode=op;
+    sqe->fd=c->fd;
+    sqe->user_data=(uintptr_t)c;
+    return sqe;
+}
+
+//发送请求报文中还没发出的部分
+static void uring_write(struct conn *c)
+{
+    struct io_uring_sqe *sqe;
+
+    struct iovec *iov;
+
+    //新的请求，有变量时填入这一次的值，发送的期限从这里开始
+    if(c->sent==0)
+    {
+        conn_prepare(c);
+        conn_deadline(c,request_timeout);
+    }
+
+    //报头和正文交替，用writev一次发出
+    if(entries[c->entry].blen>0)
+    {
+        iov=uring_iov+(c-uring_conns)*REQUEST_IOV;
+        sqe=uring_sqe(&ring,IORING_OP_WRITEV,c);
+        sqe->addr=(uintptr_t)iov;
+        sqe->len=request_iov(&entries[c->entry],&c->msg,c->sent,iov);
+        return;
+    }
+
+    //渲染出来的报文不在注册过的缓冲区里
+    if(entries[c->entry].tmpl>=0)
+    {
+        sqe=uring_sqe(&ring,IORING_OP_SEND,c);
+        sqe->addr=(uintptr_t)(c->msg.head+c->sent);
+        sqe->len=c->msg.len-c->sent;
+        return;
+    }
+
+    sqe=uring_sqe(&ring,uring_fixed?IORING_OP_WRITE_FIXED:IORING_OP_SEND,c);
+    sqe->addr=(uintptr_t)(uring_send+entries[c->entry].off+c->sent);
+    sqe->len=entries[c->entry].len-c->sent;
+    sqe->buf_index=0;
+}
+
+//把第i个接收缓冲区放回环里
+static void uring_buf_put(unsigned i)
+{
+    unsigned short tail=uring_br->tail;
+    struct io_uring_buf *b=&uring_br->bufs[tail&(uring_nbufs-1)];
+
+    //tail和第0项的resv是同一个位置，只填另外三个字段
+    b->addr=(uintptr_t)(uring_bufs+(size_t)i*URING_RECV_SIZE);
+    b->len=URING_RECV_SIZE;
+    b->bid=i;
+    __atomic_store_n(&uring_br->tail,tail+1,__ATOMIC_RELEASE);
+}
+
+//读取服务器回复，数据到达时内核才从缓冲区环里取一个缓冲区
+static void uring_read(struct conn *c)
+{
+    struct io_uring_sqe *sqe;
+    int n;
+
+    //--drain时正文用带MSG_TRUNC的recv在内核里丢掉，缓冲区不会被写入，用共用的那个就行
+    n=http_resp_discard(c->resp);
+    c->discard=n>0;
+    if(n>0)
+    {
+        sqe=uring_sqe(&ring,IORING_OP_RECV,c);
+        sqe->addr=(uintptr_t)epoll_buf;
+        sqe->len=n;
+        sqe->msg_flags=MSG_TRUNC;
+        return;
+    }
+
+    sqe=uring_sqe(&ring,IORING_OP_RECV,c);
+    sqe->flags=IOSQE_BUFFER_SELECT;
+    sqe->buf_group=0;
+    sqe->len=URING_RECV_SIZE;
+}
+
+//异步关闭连接，关闭成功时这个请求才算成功
+static void uring_close(struct conn *c)
+{
+    c->state=CONN_CLOSING;
+    timer_del(&wheel,&c->timer);
+    uring_sqe(&ring,IORING_OP_CLOSE,c);
+}
+
+//发送或者等回复超过了--timeout：还没收到回复的请求都算超时，取消在内核里的操作，操作结束后再关闭连接
+//取消操作自己的完成事件没有用，user_data为0
+static void uring_expire(void)
+{
+    struct io_uring_sqe *sqe;
+    struct timer *t;
+    struct conn *c;
+    int n;
+
+    while((t=timer_expired(&wheel,now_us()))!=NULL)
+    {
+        c=timer_conn(t);
+        n=c->state==CONN_READING?c->inflight:1;
+        request_fail(c->entry,n);
+        st->timeouts+=n;
+        c->state=CONN_TIMEDOUT;
+
+        sqe=uring_sqe(&ring,IORING_OP_ASYNC_CANCEL,c);
+        sqe->fd=-1;
+        sqe->addr=(uintptr_t)c;
+        sqe->user_data=0;
+    }
+}
+
+//为一个连接槽位发起新的连接，socket本身仍然要一次系统调用
+static void uring_open(struct conn *c)
+{
+    struct io_uring_sqe *sqe;
+    const struct addr *ad,*local;
+
+    ad=next_addr();
+    c->sent=0;
+    c->start=now_us();//请求从建立连接开始计时
+    c->phase=c->start;
+    c->entry=workload_pick();
+    c->fd=SYSCALL(socket(ad->sa.ss_family,SOCK_STREAM,0));
+
+    //连接失败
+    if(c->fd<0)
+    {
+        request_fail(c->entry,1);
+        st->connect_failed++;
+        idle_push(c);
+        return;
+    }
+
+    //--bind时connect之前先绑定本地地址，没有对应的io_uring操作，直接调用
+    local=next_local(ad);
+    if(local!=NULL)
+    {
+        st->syscalls+=2;//setsockopt和bind
+        if(SocketBind(c->fd,local)<0)
+        {
+            request_fail(c->entry,1);
+            connect_error(errno);
+            SYSCALL(close(c->fd));
+            c->fd=-1;
+            idle_push(c);
+            return;
+        }
+    }
+    conn_opened();
+
+    //阻塞的socket就可以，内核在socket就绪时自己完成操作
+    c->state=CONN_CONNECTING;
+
+    //connect和它的超时必须在同一次提交里
+    uring_space(&ring,2);
+    sqe=uring_sqe(&ring,IORING_OP_CONNECT,c);
+    sqe->addr=(uintptr_t)&ad->sa;
+    sqe->off=ad->len;
+    if(connect_timeout==0)
+        return;
+
+    //超时操作自己的完成事件没有用，user_data为0，直接丢掉
+    sqe->flags|=IOSQE_IO_LINK;
+    sqe=uring_sqe(&ring,IORING_OP_LINK_TIMEOUT,c);
+    sqe->fd=-1;
+    sqe->addr=(uintptr_t)&uring_cto;
+    sqe->len=1;
+    sqe->user_data=0;
+}
+
+//请求报文发完了，转入读阶段
+static void uring_sent(struct conn *c)
+{
+    conn_sent(c);
+
+    //http/0.9的特殊处理，与benchcore()相同，先关闭写的一半
+    if(http10==0 && SYSCALL(shutdown(c->fd,1)))
+    {
+        st->wclose_failed++;
+        conn_fail(c);
+        return;
+    }
+
+    //不复用的连接也解析回复，用来分类和检查，一直读到对端关闭
+    conn_resp(c,entries[c->entry].head);
+    c->inflight=keepalive?pipeline:1;
+
+    //不等待服务器回复，直接关闭
+    if(force)
+    {
+        uring_close(c);
+        return;
+    }
+
+    //请求发完了，开始等第一个字节
+    c->phase=now_us();
+    c->first=1;
+
+    c->state=CONN_READING;
+    conn_deadline(c,request_timeout);
+    uring_read(c);
+}
+
+//把读到buf里的n个字节交给解析器，丢掉的正文只推进解析的状态
+static int uring_feed(struct conn *c, const char *buf, int n)
+{
+    if(c->discard)
+        return http_resp_skip(c->resp,n,&c->inflight);
+    return http_resp_feed(c->resp,buf,n,&c->inflight);
+}
+
+//收到一次读取的结果，读到的数据在buf里，和conn_read()的处理相同
+static void uring_recvd(struct conn *c, const char *buf, int n)
+{
+    //缓冲区环暂时空了，本轮处理完的缓冲区放回去以后再读
+    if(n==-ENOBUFS)
+    {
+        uring_read(c);
+        return;
+    }
+
+    if(n<0)
+    {
+        st->read_failed++;
+        conn_fail(c);
+        return;
+    }
+
+    if(n>0 && c->first)
+    {
+        phase_record(&hs->ttfb,c->phase);
+        c->phase=now_us();
+        c->first=0;
+    }
+
+    if(!keepalive)
+    {
+        if(n>0)
+        {
+            request_bytes(c->entry,n);
+            uring_feed(c,buf,n);
+            uring_read(c);
+            return;
+        }
+        if(!c->first)
+            phase_record(&hs->transfer,c->phase);
+        http_resp_end(c->resp);
+        uring_close(c);
+        return;
+    }
+
+    //对端关闭时回复正好完整，算一次成功
+    if(n==0)
+    {
+        if(http_resp_eof(c->resp))
+        {
+            c->inflight--;
+            if(c->inflight==0)
+            {
+                if(!c->first)
+                    phase_record(&hs->transfer,c->phase);
+                uring_close(c);
+                return;
+            }
+            request_done(c->entry,c->start,1,c->resp);
+        }
+        conn_fail_inflight(c);
+        return;
+    }
+
+    request_bytes(c->entry,n);
+    n=uring_feed(c,buf,n);
+    if(n<0)
+    {
+        conn_fail_inflight(c);
+        return;
+    }
+    if(c->inflight==0)
+        phase_record(&hs->transfer,c->phase);
+
+    //服务器要求关闭，这个连接到此为止，后面的请求不会有回复了
+    if(c->resp->state==RESP_DONE && c->resp->close)
+    {
+        if(c->inflight>0)
+        {
+            request_done(c->entry,c->start,n,c->resp);
+            conn_fail_inflight(c);
+            return;
+        }
+
+        //最后一个回复在连接成功关闭后才算成功
+        if(n>1)
+            request_done(c->entry,c->start,n-1,c->resp);
+        uring_close(c);
+        return;
+    }
+
+    if(n>0)
+        request_done(c->entry,c->start,n,c->resp);
+    if(c->inflight>0)
+    {
+        uring_read(c);
+        return;
+    }
+
+    //负载降下来了，这个槽位停下
+    if(conn_park(c))
+        return;
+
+    //这一批回复都收到了，直接在同一个连接上发下一批请求
+    c->state=CONN_WRITING;
+    c->sent=0;
+    c->start=now_us();
+    c->entry=workload_pick();
+    uring_write(c);
+}
+
+//处理一个完成事件，res是操作的返回值，出错时是负的错误码，buf是接收操作从环里取到的缓冲区
+static void uring_complete(struct conn *c, int res, const char *buf)
+{
+    switch(c->state)
+    {
+    case CONN_CONNECTING:
+        //被链接的超时操作取消了
+        if(res==-ECANCELED)
+        {
+            st->connect_timeout++;
+            conn_fail(c);
+            break;
+        }
+        if(res<0)
+        {
+            connect_error(-res);
+            conn_fail(c);
+            break;
+        }
+        phase_record(&hs->connect_time,c->phase);
+        c->state=CONN_WRITING;
+        uring_write(c);
+        break;
+
+    case CONN_WRITING:
+        if(res<0)
+        {
+            st->send_failed++;
+            conn_fail(c);
+            break;
+        }
+        c->sent+=res;
+        if(c->sent<c->msg.len)
+            uring_write(c);
+        else
+            uring_sent(c);
+        break;
+
+    case CONN_READING:
+        uring_recvd(c,buf,res);
+        break;
+
+    case CONN_CLOSING:
+        //套接字关闭失败
+        if(res<0)
+        {
+            request_fail(c->entry,1);
+            st->sclose_failed++;
+        }
+        else
+            request_done(c->entry,c->start,1,c->resp);
+        c->fd=-1;
+        conns_open--;
+        break;
+
+    case CONN_TIMEDOUT:
+        //被取消的操作结束了(也可能在取消之前就完成了)，失败已经记过了
+        conn_close(c);
+        break;
+    }
+}
+
+//建立接收缓冲区环：连接少时和连接数一样多的缓冲区，最多URING_RECV_BUFS个，成功返回0
+static int uring_bufring(int nconns)
+{
+    struct io_uring_buf_reg reg;
+    size_t ringlen;
+    unsigned i;
+
+    for(uring_nbufs=1; uring_nbufs<URING_RECV_BUFS && uring_nbufs<(unsigned)nconns; uring_nbufs*=2)
+        ;
+
+    //环本身按页对齐，缓冲区跟在后面
+    ringlen=(uring_nbufs*sizeof(struct io_uring_buf)+4095)&~(size_t)4095;
+    uring_brlen=ringlen+(size_t)uring_nbufs*URING_RECV_SIZE;
+    uring_br=mmap(NULL,uring_brlen,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if(uring_br==MAP_FAILED)
+        return -1;
+    uring_bufs=(char *)uring_br+ringlen;
+    mem_state+=uring_brlen;
+
+    memset(&reg,0,sizeof(reg));
+    reg.ring_addr=(uintptr_t)uring_br;
+    reg.ring_entries=uring_nbufs;
+    reg.bgid=0;
+    if(sys_io_uring_register(ring.fd,IORING_REGISTER_PBUF_RING,&reg,1)<0)
+        return -1;
+
+    for(i=0; i<uring_nbufs; i++)
+        uring_buf_put(i);
+    return 0;
+}
+
+//释放uring_start建好的部分：队列的映射、io_uring、接收缓冲区环和请求报文的副本
+//关闭io_uring时内核注册的缓冲区也一起注销，errno保留建立失败时的原因
+static void uring_exit(void)
+{
+    int err=errno;
+
+    if(ring.sqes!=MAP_FAILED)
+        munmap(ring.sqes,ring.sqes_len);
+    if(ring.cq_ring!=MAP_FAILED)
+        munmap(ring.cq_ring,ring.cq_len);
+    if(ring.sq_ring!=MAP_FAILED)
+        munmap(ring.sq_ring,ring.sq_len);
+    if(ring.fd>=0)
+        close(ring.fd);
+    if(uring_br!=NULL && uring_br!=MAP_FAILED)
+        munmap(uring_br,uring_brlen);
+    if(uring_send!=NULL && uring_send!=MAP_FAILED)
+        munmap(uring_send,uring_sendlen);
+
+    ring.sq_ring=ring.cq_ring=MAP_FAILED;
+    ring.sqes=MAP_FAILED;
+    ring.fd=-1;
+    uring_br=NULL;
+    uring_send=NULL;
+    errno=err;
+}
+
+//建立io_uring，分配并注册缓冲区，成功返回0，失败时什么也不留下
+static int uring_start(int nconns)
+{
+    struct iovec iov;
+    unsigned entries;
+
+    //每个连接最多只有两个操作在内核里(connect和它的超时，或者超时的操作和它的取消)
+    entries=2*nconns+1<URING_MAX_SQ?2*nconns+1:URING_MAX_SQ;
+    if(uring_init(&ring,entries,2*nconns+1<URING_MAX_CQ?2*nconns+1:URING_MAX_CQ))
+    {
+        uring_exit();
+        return -1;
+    }
+
+    if(!uring_probe(ring.fd))
+    {
+        uring_exit();
+        errno=EOPNOTSUPP;
+        return -1;
+    }
+
+    if(uring_bufring(nconns))
+    {
+        uring_exit();
+        return -1;
+    }
+
+    //请求报文放在按页对齐的匿名内存里
+    uring_sendlen=(arena_len+4095)&~(size_t)4095;
+    uring_send=mmap(NULL,uring_sendlen,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if(uring_send==MAP_FAILED)
+    {
+        uring_exit();
+        return -1;
+    }
+    memcpy(uring_send,arena,arena_len);
+
+    iov.iov_base=uring_send;
+    iov.iov_len=arena_len;
+    uring_fixed=sys_io_uring_register(ring.fd,IORING_REGISTER_BUFFERS,&iov,1)==0;
+    if(!uring_fixed && worker_id==0)
+        perror(" Failed to register io_uring buffers, using plain send ");
+
+    return 0;
+}
+
+//一个工作进程用io_uring驱动nconns个并发连接，直到测试时间结束
+static void uringcore(int nconns)
+{
+    struct io_uring_cqe *cqe;
+    struct conn *c;
+    unsigned head,tail;
+    int i,retry,wait;
+
+    uring_conns=state_calloc(nconns,sizeof(struct conn));
+    idle=state_calloc(nconns,sizeof(struct conn *));
+    uring_iov=state_calloc((size_t)nconns*REQUEST_IOV,sizeof(struct iovec));
+    if(uring_conns==NULL || idle==NULL || uring_iov==NULL)
+    {
+        perror(" Failed to create io_uring worker ");
+        exit(3);
+    }
+
+    //这个工作进程建不起io_uring，改用epoll
+    if(uring_start(nconns))
+    {
+        if(worker_id==0)
+            perror(" Failed to set up io_uring, falling back to epoll engine ");
+        free(uring_conns);
+        free(idle);
+        free(uring_iov);
+        mem_state=0;
+        epollcore(nconns);
+        return;
+    }
+
+    uring_cto.tv_sec=connect_timeout/1000;
+    uring_cto.tv_nsec=connect_timeout%1000*1000000LL;
+
+    wheel_init(&wheel,now_us());
+    idle_size=nconns;
+    slab_init(&resp_slab,sizeof(struct http_resp));
+    slab_init(&tbuf_slab,tmpl_size);
+
+    //所有槽位先停着，按负载曲线轮到的立刻发起连接
+    conns_base=uring_conns;
+    for(i=0; i<nconns; i++)
+    {
+        uring_conns[i].fd=-1;
+        uring_conns[i].parked=1;
+    }
+
+    while(!run_over(now_us()))
+    {
+        stage_check(now_us());
+        uring_expire();
+
+        //新轮到的槽位进入空闲队列，在本轮最后发起连接
+        //等待不能错过下一个槽位轮到的时间、最早的期限和测试结束的时间
+        wait=conns_activate(nconns);
+        wait=timer_wait(&wheel,now_us(),wait);
+        wait=wait_until(now_us(),run_end(),wait);
+
+        //一次系统调用提交所有攒下的操作并等待完成
+        //有等待重连的槽位时只提交，不等待
+        if(uring_submit(&ring,nidle?0:1,wait)<0 && errno!=ETIME && errno!=EINTR && errno!=EAGAIN && errno!=EBUSY)
+        {
+            perror(" io_uring_enter failed ");
+            break;
+        }
+
+        //完成队列在共享内存里，直接读
+        head=*ring.cq_head;
+        while(head!=(tail=__atomic_load_n(ring.cq_tail,__ATOMIC_ACQUIRE)))
+        {
+            for(; head!=tail; head++)
+            {
+                cqe=&ring.cqes[head&*ring.cq_mask];
+                c=(struct conn *)(uintptr_t)cqe->user_data;
+                if(c==NULL)
+                    continue;
+
+                //接收操作从环里取了缓冲区，处理完就放回去(连接超时了也一样)
+                if(cqe->flags&IORING_CQE_F_BUFFER)
+                {
+                    uring_complete(c,cqe->res,uring_bufs+(size_t)(cqe->flags>>IORING_CQE_BUFFER_SHIFT)*URING_RECV_SIZE);
+                    uring_buf_put(cqe->flags>>IORING_CQE_BUFFER_SHIFT);
+                }
+                else
+                    uring_complete(c,cqe->res,NULL);
+
+                //本次请求已经结束，立刻为这个槽位发起下一次请求，负载降下来了就停下
+                if(c->fd<0 && !timeout && !c->parked && !conn_park(c))
+                    uring_open(c);
+            }
+            __atomic_store_n(ring.cq_head,head,__ATOMIC_RELEASE);
+        }
+
+        //连接失败的槽位在这里补发连接，再次失败的排在后面，留到下一轮
+        for(retry=nidle; retry>0 && !timeout; retry--)
+        {
+            c=idle_pop();
+            if(!conn_park(c))
+                uring_open(c);
+        }
+    }
+
+    //测试时间到了，还在进行中的请求既不算成功也不算失败
+    close(ring.fd);
+}
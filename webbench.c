@@ -9,6 +9,8 @@
 #include <signal.h>
 #include<string.h>
 #include<error.h>
+#include <limits.h>
+#include <poll.h>
 
 
 //用法和各参数的详细意义
@@ -16,35 +18,117 @@ static void usage(void)
 {
     fprintf(stderr,
             "webbench [parameter]... URL\n"
+            "webbench [parameter]... --workload <file>\n"
+            "webbench --serve <port> [-w n] [--serve-size bytes] [--serve-delay ms]\n"
             "  -f|--force               No waiting for server response \n"
-            "  -r|--reload              Re-request loading (no caching) \n"
+            "  -r|--reload              Bust caches: add a unique _wb={{seq}} query parameter to every request \n"
             "  -t|--time <sec>          Set run time in seconds, default 30 seconds \n"
             "  -p|--proxy <server:port> Setting the number of proxy servers \n"
             "  -c|--clients <n>         How many clients are created, default is 1 \n"
+            "  -e|--engine <name>       Client engine: fork (one process per client, default), epoll or uring \n"
+            "  -w|--workers <n>         Number of epoll/uring worker processes, default is one per CPU \n"
+            "  -k|--keep-alive          Reuse each connection for many requests \n"
+            "  --pipeline <depth>       Send depth requests back to back on each connection (implies -k) \n"
+            "  --rate <req/s>           Open-loop mode: send requests at a fixed rate across all clients \n"
+            "  --warmup <sec>           Run at full load for sec seconds first, excluded from the results \n"
+            "  --ramp <sec>             Ramp clients (or --rate) linearly from 0 over the first sec seconds \n"
+            "  --steps <n>              Split the run into n stages at 1/n,2/n,..,full load, each reported \n"
+            "  --all-addrs              Spread connections round-robin over every resolved address \n"
+            "  --bind <addr[:lo-hi],..> Bind new connections round-robin to these local addresses and port ranges \n"
+            "  --connect-timeout <ms>   Give up on a connection attempt after ms, default 5000, 0 waits forever \n"
+            "  --timeout <ms>           Fail a request whose handshake, send or response takes longer than ms \n"
+            "  --idle-timeout <ms>      Close keep-alive connections that stay idle for ms \n"
+            "  --drain                  Discard response bodies in the kernel and read the rest in large chunks \n"
+            "  --tls-resume <mode>      HTTPS session resumption: none (full handshakes, default), id or ticket \n"
+            "  --h2c                    Speak HTTP/2 over cleartext (prior knowledge) on the epoll engine, -c is connections \n"
+            "  --streams <n>            Concurrent HTTP/2 streams per connection with --h2c, default 1 \n"
+            "  --cpus <list>            Pin worker i to the (i mod n)-th CPU of the list, e.g. 0-3,8 \n"
+            "  --irq-cpus <list>        Keep these CPUs free for interrupt handling, no workers run there \n"
+            "  --numa                   Allocate each pinned worker's memory on its local NUMA node \n"
+            "  --workload <file>        Weighted list of requests, one \"[weight] [method] URL\" per line \n"
+            "  --header <\"Name: value\"> Add a request header, may be repeated \n"
+            "  URL and header values may contain {{seq}}, {{rand:lo-hi}}, {{choice:a,b,..}} and {{worker}} \n"
+            "  --output <json|csv>      Also write the full result in a machine-readable format \n"
+            "  --agent <[host:]port>    Run as an agent: wait for a coordinator to push and start tests, host defaults to 127.0.0.1 \n"
+            "  --agents <host:port,..>  Run the test on these agents at once and merge their results \n"
+            "  --agent-token <secret>   Shared secret of agents and coordinator, default $WEBBENCH_AGENT_TOKEN \n"
+            "  --agent-dir <dir>        Only read --workload and --body files inside dir on an agent, default current directory \n"
+            "  --serve <port>           Run the built-in reference HTTP server (-w workers) to calibrate the client \n"
+            "  --serve-size <bytes>     Response body size of --serve, default 64 \n"
+            "  --serve-delay <ms>       Delay every --serve response by ms, fractions allowed \n"
+            "  --output-file <file>     Where to write --output, default is standard output \n"
             "  -9|--http09              Using HTTP 0.9 protocol \n"
             "  -1|--http10              Using HTTP 1.0 protocol \n"
             "  -2|--http11              Using HTTP 1.1 protocol \n"
             "  -G|--get                 Using GET request method \n"
             "  -H|--head                Using HEAD request method \n"
             "  -O|--options             Using OPTIONS request method \n"
+            "  --post|--put             Using POST or PUT request method \n"
+            "  --body <file>            Send the file as the request body (implies --post unless --put) \n"
+            "  --content-type <type>    Content-Type of the body, default application/octet-stream \n"
+            "  --expect-status <code>   Count responses with another status (e.g. 200 or 2xx) as failed \n"
+            "  --expect-length <n[-m]>  Count responses whose body length is not n (or in n-m) as failed \n"
+            "  --expect-crc32 <hex>     Count responses whose body CRC-32 differs as failed \n"
             "  -?|-h|--help             Display help information \n"
             "  -V|--version             Display program version information \n"  );
 };
 
+//结果输出格式
+#define OUTPUT_TEXT 0
+#define OUTPUT_JSON 1
+#define OUTPUT_CSV  2
+
+//压测引擎
+#define ENGINE_FORK 0   //每个客户端一个进程，阻塞IO
+#define ENGINE_EPOLL 1  //少量工作进程，每个进程用epoll驱动大量非阻塞连接
+#define ENGINE_URING 2  //和epoll一样的工作进程，用io_uring批量提交和完成IO
+
 //支持的http请求方法
 #define METHOD_GET 0
 #define METHOD_HEAD 1
 #define METHOD_OPTIONS 2
 #define METHOD_TRACE 3
+#define METHOD_POST 4
+#define METHOD_PUT 5
+static const char *method_names[]={"GET","HEAD","OPTIONS","TRACE","POST","PUT"};
 
 //默认参数设置，一般需要自己传入命令行参数设置
 int method=METHOD_GET; //默认请求方法为get
 int clients=1;         //默认只模拟一个客户端
 int force=0;           //默认需要等待服务器响应
-int force_reload=0;    //失败时重新请求
+int force_reload=0;    //每个请求加上不同的查询参数，绕过缓存
 int proxyport=80;      //默认访问服务器端口为80
 char *proxyhost=NULL;  //默认无代理服务器
 int benchtime=30;      //默认模拟请求时间为30s
+int engine=ENGINE_FORK;//默认每个客户端一个进程
+int workers=0;         //epoll/uring引擎的工作进程数，0表示每个CPU一个
+int keepalive=0;       //默认每个请求一个连接，1表示长连接复用
+int pipeline=1;        //流水线深度，一次连续发出的请求数
+double rate=0;         //开环模式的目标请求速率(每秒)，0表示闭环：上一个请求结束才发下一个
+int all_addrs=0;       //默认只连接第一个可用的地址，1表示轮流连接解析到的所有地址
+int output=0;          //机器可读结果的格式，默认只打印文本
+char *output_file=NULL;//机器可读结果写到哪个文件，默认标准输出
+int connect_timeout=5000;//建立连接的超时时间(毫秒)，0表示一直等到内核放弃
+int request_timeout=0;  //--timeout：握手、发送请求、等回复各自的期限(毫秒)，0表示不限，最多等到测试结束
+int idle_timeout=0;     //--idle-timeout：长连接空闲超过这么久(毫秒)就关掉，下一个请求重新连接，0表示不关
+int drain=0;           //只关心速率：正文在内核里直接丢掉，其余用大的接收缓冲区
+int h2c=0;             //用明文的HTTP/2(h2c)代替HTTP/1.x
+int streams=1;         //HTTP/2每个连接上同时进行的流数
+
+//--header加上的请求报头
+#define MAX_HEADERS 32
+#define HEADERS_SIZE 4096      //所有--header加起来的最大长度
+char *headers[MAX_HEADERS];
+int nheaders=0;
+int headers_len=0;
+
+//对每个回复的检查，没有通过的回复算作失败
+int expect=0;                 //给了任何一个--expect-*选项
+int expect_status=0;          //期望的状态码，1~5表示整类(如2xx)，0不检查
+long long expect_min_len=0;   //正文长度的范围
+long long expect_max_len=-1;  //-1表示没有上限
+int expect_crc_set=0;         //是否检查正文的CRC-32
+unsigned int expect_crc=0;
 
 //支持的http版本号
 int http10=1;
@@ -55,36 +139,46 @@ int http10=1;
 */
 
 /* 内部 */
-int mypipe[2];                //管道用于父子进程通信
+int nprocs;                   //子进程数
+int worker_id;                //子进程的编号，从0开始
+long long bench_start;        //所有子进程共同的起始时间，开环模式按它计算每个请求计划发出的时间
 char host[MAXHOSTNAMELEN];    //存储服务器网络地址
-#define REQUEST_SIZE 2048     //最大请求次数
-char request[REQUEST_SIZE];   //存放http请求报文信息数组
+const char *target_url;       //命令行中的URL
+struct addr addrs[MAX_ADDRS]; //测试开始前解析好的服务器(或代理服务器)地址，子进程继承后直接使用
+int naddrs=0;                 //解析到的地址个数
+unsigned int addr_next=0;     //轮流使用地址时下一个要用的地址
+char *bind_arg=NULL;          //--bind给出的本地地址列表
+#define REQUEST_SIZE 8192     //请求报文的最大长度
+char request[REQUEST_SIZE];   //存放http请求报文信息数组，构造好后放进workload的arena
 
-//判断测试时长是否已经到达设定时间
-volatile int timeout=0;
-/*
+//测试时间已经到了，由run_over()设置
+//不用闹钟信号：每个引擎等待时都以测试结束的时间为上限，醒来后自己看时钟
+int timeout=0;
 
- volatile:
- 类型修饰符，作为指令关键字，
- 确保本指令不会因为编译器优化而省略
- 且每次要求重新读值，
- 编译器在用到这个变量的时候都必须小心的重新读取这个变量的值，
- 而不是使用保存在寄存器里的备份，保证每次读到的都是最新的
+//请求延迟直方图
+#include "hist.c"
 
-*/
+//http回复报文解析和检查
+#include "http.c"
+
+//预热、逐步加压和分台阶的负载曲线
+#include "profile.c"
 
-//测试结果
-int speed=0;  //成功得到服务器响应的子进程数量
-int failed=0; //没有成功得到服务器响应的子进程数量
-int bytes=0;  //所有子进程读取到服务器回复的总字节数
+//测试结果，放在父子进程共享的统计槽里
+#include "stats.c"
 
-int connect_failed=0;
-int send_failed=0;
-int wclose_failed=0;
-int read_failed=0;
-int sclose_failed=0;
+struct stats *slots;  //每个阶段每个子进程一个统计槽，第s个阶段的从slots[s*nprocs]开始
+struct stats *st;     //子进程自己的统计槽，所有计数都记在这里
+struct stats total;   //父进程汇总的结果
 
+struct hists *hist_slots;//每个阶段nhists组直方图，第s个阶段的从hist_slots[s*nhists]开始
+int nhists;              //每个阶段的直方图组数，epoll/uring每个工作进程一组，fork每个CPU一组
+struct hists *hs;        //子进程记录直方图的地方
+struct hists hist_total; //父进程汇总的直方图
+static struct hists *hist_own;//fork引擎的子进程自己的直方图，每个阶段一组，结束时才合并到共享内存
 
+//执行一次系统调用并计数，用来比较各个引擎平均每个请求要进入内核几次
+#define SYSCALL(call) (st->syscalls++,(call))
 
 //程序版本号
 #define PROGRAM_VERSION "1.5"
@@ -92,21 +186,407 @@ int sclose_failed=0;
 /* 函数声明 */
 
 //子进程真正相服务器发出请求报文并以其得到此期间的相关数据
-static void benchcore(const char* host,const int port, const char *req);
+static void benchcore(void);
 
 //父进程创建子进程，读取子进程测试得到的数据，然后统计处理
 static int bench(void);
 
+//输出汇总好的结果
+static int report(void);
+
+//分布式测试的代理收到命令行后重新解析参数
+int main(int argc, char *argv[]);
+
+//带超时的连接
+static int connect_timed(const struct addr *ad);
+
 //构造http请求报文
 static void build_request(const char *url);
 
-//闹钟信号处理函数
-static void alarm_handler(int signal)
+//HTTPS，需要用make TLS=1编译
+#include "tls.c"
+
+//多URL加权负载，所有请求报文预先构造好
+#include "workload.c"
+
+//请求模板，URL和报头中的变量在发送时填入
+#include "template.c"
+
+//CPU绑定和NUMA
+#include "affinity.c"
+
+//分布式测试的代理和协调者
+#include "agent.c"
+
+//机器可读的结果输出
+#include "output.c"
+
+/*
+运行控制：
+所有子进程从bench_start开始一起跑runtime秒(预热也在里面)，结束的时间是确定的，
+每个引擎在等待(epoll_wait、io_uring_enter、阻塞的读写和睡眠)时都不超过它，醒来后用run_over()判断
+以前用alarm()和SIGALRM，被信号打断的读写会先算成失败，最后再减回来
+*/
+static long long run_end(void)
+{
+    return bench_start+runtime*1000000LL;
+}
+
+//测试时间到了返回1，同时设置timeout
+static int run_over(long long now)
+{
+    if(now>=run_end())
+        timeout=1;
+    return timeout;
+}
+
+//从now到t还要等多少毫秒(向上取整)，wait是原来要等的毫秒数，-1表示一直等，返回两者中小的那个
+static int wait_until(long long now,long long t,int wait)
+{
+    long long ms=t>now?(t-now+999)/1000:0;
+
+    if(wait>=0 && wait<ms)
+        return wait;
+    return ms>INT_MAX?INT_MAX:(int)ms;
+}
+
+//now开始的一个阶段(握手、发送、等回复)最晚到什么时候：--timeout和测试结束中早的那个
+static long long request_deadline(long long now)
+{
+    if(request_timeout>0 && now+request_timeout*1000LL<run_end())
+        return now+request_timeout*1000LL;
+    return run_end();
+}
+
+/*
+开环模式：
+闭环时上一个请求结束才发下一个，服务器变慢时发压也跟着变慢，
+服务器自己的延迟尖峰就被掩盖了(coordinated omission)
+开环时所有请求按速率排好计划发出时间：
+没有负载曲线时全局第j个请求计划在 bench_start+j/rate 发出，有时按速率曲线的积分算，
+第k个子进程负责 j%nprocs==k 的那些
+延迟从计划发出的时间开始算，发晚了的时间也算在延迟里
+*/
+//本子进程第n个请求计划发出的时间
+static long long intended_time(long long n)
+{
+    return bench_start+profile_time((double)n*nprocs+worker_id);
+}
+
+//到now为止本子进程应该已经发出的请求数
+static long long intended_count(long long now)
+{
+    double n;
+
+    n=(profile_count(now-bench_start)-worker_id)/nprocs;
+    return n<0?0:(long long)n+1;
+}
+
+//本子进程第s个阶段的直方图，fork引擎记在自己的内存里
+static struct hists *hists_stage(int s)
+{
+    if(engine==ENGINE_FORK)
+        return &hist_own[s];
+    return &hist_slots[s*nhists+worker_id];
+}
+
+//fork引擎的子进程结束时把自己的直方图合并到共享的第(编号 mod nhists)组
+static void hists_flush(void)
+{
+    int s,k;
+
+    if(engine!=ENGINE_FORK)
+        return;
+    for(s=0; s<nstages; s++)
+        for(k=0; k<HISTS_COUNT; k++)
+            hist_merge_atomic((struct histogram *)&hist_slots[s*nhists+worker_id%nhists]+k,
+                              (const struct histogram *)&hist_own[s]+k);
+}
+
+//过了当前阶段的结束时间，之后的结果记到下一个阶段的统计槽里
+static void stage_check(long long now)
+{
+    while(stage_cur<nstages-1 && now-bench_start>=stages[stage_cur].end)
+    {
+        stage_cur++;
+        st=&slots[stage_cur*nprocs+worker_id];
+        est=&entry_slots[(stage_cur*nprocs+worker_id)*nentries];
+        hs=hists_stage(stage_cur);
+    }
+}
+
+//闭环模式下本子进程的nconns个连接中现在要工作的个数，第k个连接是全局第k*nprocs+worker_id个客户端
+static int active_conns(int nconns,long long now)
+{
+    int n=profile_clients(now-bench_start);
+
+    n=n>worker_id?(n-worker_id+nprocs-1)/nprocs:0;
+    return n<nconns?n:nconns;
+}
+
+//本子进程第k个连接最早什么时候轮到，测试结束前都轮不到时返回-1
+static long long active_wake(int k,long long now)
+{
+    long long t=profile_wake(k*nprocs+worker_id,now-bench_start);
+
+    return t<0?-1:bench_start+t;
+}
+
+//新连接要用的地址，不用每次都解析
+static const struct addr *next_addr(void)
+{
+    if(!all_addrs)
+        return &addrs[0];
+    return &addrs[addr_next++%naddrs];
+}
+
+/*
+--bind：建立连接之前先绑定本地地址
+
+每个请求一个连接时，从一个本地地址到同一个目的地址只有约2万8千个临时端口，
+跑上一阵就全被TIME_WAIT占住了，connect失败返回EADDRNOTAVAIL
+给多个本地地址，可用的端口就成倍增加，新连接轮流使用这些地址
+
+    --bind 10.0.0.1,10.0.0.2                 由内核在connect时选端口
+    --bind 10.0.0.1:20000-60000,[fd00::1]    自己在范围内轮流选端口
+
+有端口范围时，第k个子进程用范围中的第k、k+nprocs、k+2*nprocs……个端口，子进程之间不会抢端口
+*/
+struct local_addr
+{
+    struct addr a;
+    int lo,hi;       //端口范围，0表示由内核选
+    long long used;  //本子进程已经用过的端口数
+};
+
+struct local_addr locals[MAX_ADDRS];
+int nlocals=0;
+unsigned int local_next=0;    //下一个要用的本地地址，每个子进程从不同的地址开始
+
+//解析--bind的地址列表，格式错误返回-1
+static int bind_parse(char *list)
+{
+    char *item,*host,*range,*p;
+    struct local_addr *l;
+
+    for(item=strtok(list,","); item!=NULL; item=strtok(NULL,","))
+    {
+        if(nlocals>=MAX_ADDRS)
+            return -1;
+        l=&locals[nlocals];
+        l->lo=l->hi=0;
+        l->used=0;
+
+        //IPv6地址带端口范围时要写在方括号里
+        range=NULL;
+        host=item;
+        if(item[0]=='[')
+        {
+            p=strchr(item,']');
+            if(p==NULL || (p[1]!='\0' && p[1]!=':'))
+                return -1;
+            *p='\0';
+            host=item+1;
+            if(p[1]==':')
+                range=p+2;
+        }
+        else if((p=strchr(item,':'))!=NULL && strchr(p+1,':')==NULL)
+        {
+            *p='\0';
+            range=p+1;
+        }
+
+        if(range!=NULL)
+        {
+            l->lo=atoi(range);
+            p=strchr(range,'-');
+            l->hi=p!=NULL?atoi(p+1):l->lo;
+            if(l->lo<=0 || l->hi<l->lo || l->hi>65535)
+                return -1;
+        }
+
+        if(Resolve(host,0,&l->a,1)<0)
+            return -1;
+        nlocals++;
+    }
+
+    return nlocals>0?0:-1;
+}
+
+//新连接要绑定的本地地址，和目的地址同一个协议族，没有--bind时返回NULL
+static const struct addr *next_local(const struct addr *ad)
+{
+    struct local_addr *l;
+    int i,span;
+
+    for(i=0; i<nlocals; i++)
+    {
+        l=&locals[local_next++%nlocals];
+        if(l->a.sa.ss_family!=ad->sa.ss_family)
+            continue;
+        if(l->lo>0)
+        {
+            span=l->hi-l->lo+1;
+            AddrSetPort(&l->a,l->lo+(int)((worker_id+l->used*nprocs)%span));
+            l->used++;
+        }
+        return &l->a;
+    }
+
+    return NULL;
+}
+
+//连接失败的原因：超时、本地地址或端口用完了、其他
+static void connect_error(int err)
+{
+    if(err==ETIMEDOUT)
+        st->connect_timeout++;
+    else if(err==EADDRNOTAVAIL || err==EADDRINUSE)
+        st->addr_unavail++;
+    else
+        st->connect_failed++;
+}
+
+//第e个条目的n个请求成功完成，start是请求开始的时间，记录它们的延迟
+static void request_ok(int e,long long start,int n)
+{
+    long long t=now_us()-start;
+
+    st->speed+=n;
+    hist_record_n(&hs->latency,t,n);
+
+    est[e].speed+=n;
+    est[e].latency_sum+=t*n;
+    if(t>est[e].latency_max)
+        est[e].latency_max=t;
+}
+
+//第e个条目的n个请求失败了，失败的原因由调用的地方另外计数
+static void request_fail(int e,int n)
+{
+    st->failed+=n;
+    est[e].failed+=n;
+}
+
+/*
+第e个条目的n个回复完整了，start是请求开始的时间
+回复的分类和检查结果在解析时已经记在r里，这里按分类记录延迟，
+没有通过检查的算作失败，其余的才是成功
+*/
+static void request_done(int e,long long start,int n,struct http_resp *r)
+{
+    long long t=now_us()-start;
+    int k,bad;
+
+    for(k=0; k<STATUS_CLASSES; k++)
+    {
+        if(r->ncls[k]==0)
+            continue;
+        st->status[k]+=r->ncls[k];
+        st->status_latency[k]+=t*r->ncls[k];
+        if(t>st->status_max[k])
+            st->status_max[k]=t;
+        r->ncls[k]=0;
+    }
+
+    bad=r->nbad<n?r->nbad:n;
+    r->nbad-=bad;
+    if(n>bad)
+        request_ok(e,start,n-bad);
+    if(bad>0)
+    {
+        request_fail(e,bad);
+        st->invalid+=bad;
+    }
+}
+
+//读到了第e个条目的n个字节回复
+static void request_bytes(int e,int n)
+{
+    st->bytes+=n;
+    est[e].bytes+=n;
+}
+
+//--drain时的接收缓冲区，报头、分块长度行和不能丢掉的正文都读到这里
+#define DRAIN_BUF_SIZE 65536
+
+/*
+读一段回复，--drain时解析器知道是正文的部分用MSG_TRUNC在内核里丢掉
+*discard为1表示读到的是丢掉的正文，buf里没有内容，要交给http_resp_skip()
+t不为NULL时从TLS连接上读
+*/
+static int recv_resp(int s,struct tls_conn *t,char *buf,int size,const struct http_resp *r,int *discard)
+{
+    int n=http_resp_discard(r);
+
+    //HTTPS读的是解密后的数据，没有--drain
+    if(t!=NULL)
+    {
+        *discard=0;
+        return SYSCALL(tls_read(t,buf,size));
+    }
+
+    *discard=n>0;
+    if(n>0)
+        return SYSCALL(recv(s,buf,n,MSG_TRUNC));
+    return SYSCALL(read(s,buf,size));
+}
+
+//请求的一个阶段结束了，since是这个阶段开始的时间
+static void phase_record(struct histogram *h,long long since)
 {
-    //到达设定的测压时间，则调用闹钟信号处理函数
-    timeout=1;//timerexpired为1则会在循环中跳出测试
+    hist_record_n(h,now_us()-since,1);
 }
 
+//连接的期限(定时器轮)
+#include "timer.c"
+
+//连接状态的池和内存统计
+#include "slab.c"
+
+//事件驱动引擎
+#include "epoll.c"
+
+//io_uring引擎，不可用时自动改用epoll引擎
+#include "uring.c"
+
+//明文HTTP/2，在epoll引擎的连接上多路复用
+#include "h2.c"
+
+//标定客户端用的参考服务器
+#include "serve.c"
+
+//只有长选项的参数，用大于255的值和短选项区分开
+#define OPT_PIPELINE 256
+#define OPT_RATE 257
+#define OPT_OUTPUT 258
+#define OPT_OUTPUT_FILE 259
+#define OPT_CONNECT_TIMEOUT 260
+#define OPT_WORKLOAD 261
+#define OPT_BODY 262
+#define OPT_CONTENT_TYPE 263
+#define OPT_EXPECT_STATUS 264
+#define OPT_EXPECT_LENGTH 265
+#define OPT_EXPECT_CRC32 266
+#define OPT_CPUS 267
+#define OPT_IRQ_CPUS 268
+#define OPT_BIND 269
+#define OPT_WARMUP 270
+#define OPT_RAMP 271
+#define OPT_STEPS 272
+#define OPT_AGENT 273
+#define OPT_AGENTS 274
+#define OPT_SERVE 275
+#define OPT_SERVE_SIZE 276
+#define OPT_SERVE_DELAY 277
+#define OPT_TLS_RESUME 278
+#define OPT_STREAMS 279
+#define OPT_HEADER 280
+#define OPT_TIMEOUT 281
+#define OPT_IDLE_TIMEOUT 282
+#define OPT_AGENT_TOKEN 283
+#define OPT_AGENT_DIR 284
+
 //构造长选项和短选项的对应
 static const struct option long_options[]=
 {
@@ -120,9 +600,47 @@ static const struct option long_options[]=
     {"get",no_argument,&method,METHOD_GET},
     {"head",no_argument,&method,METHOD_HEAD},
     {"options",no_argument,&method,METHOD_OPTIONS},
+    {"post",no_argument,&method,METHOD_POST},
+    {"put",no_argument,&method,METHOD_PUT},
+    {"body",required_argument,NULL,OPT_BODY},
+    {"content-type",required_argument,NULL,OPT_CONTENT_TYPE},
+    {"header",required_argument,NULL,OPT_HEADER},
     {"version",no_argument,NULL,'V'},
     {"proxy",required_argument,NULL,'p'},
     {"clients",required_argument,NULL,'c'},
+    {"engine",required_argument,NULL,'e'},
+    {"workers",required_argument,NULL,'w'},
+    {"keep-alive",no_argument,NULL,'k'},
+    {"pipeline",required_argument,NULL,OPT_PIPELINE},
+    {"rate",required_argument,NULL,OPT_RATE},
+    {"warmup",required_argument,NULL,OPT_WARMUP},
+    {"ramp",required_argument,NULL,OPT_RAMP},
+    {"steps",required_argument,NULL,OPT_STEPS},
+    {"all-addrs",no_argument,&all_addrs,1},
+    {"bind",required_argument,NULL,OPT_BIND},
+    {"drain",no_argument,&drain,1},
+    {"cpus",required_argument,NULL,OPT_CPUS},
+    {"irq-cpus",required_argument,NULL,OPT_IRQ_CPUS},
+    {"numa",no_argument,&numa,1},
+    {"output",required_argument,NULL,OPT_OUTPUT},
+    {"output-file",required_argument,NULL,OPT_OUTPUT_FILE},
+    {"agent",required_argument,NULL,OPT_AGENT},
+    {"agents",required_argument,NULL,OPT_AGENTS},
+    {"agent-token",required_argument,NULL,OPT_AGENT_TOKEN},
+    {"agent-dir",required_argument,NULL,OPT_AGENT_DIR},
+    {"serve",required_argument,NULL,OPT_SERVE},
+    {"serve-size",required_argument,NULL,OPT_SERVE_SIZE},
+    {"serve-delay",required_argument,NULL,OPT_SERVE_DELAY},
+    {"tls-resume",required_argument,NULL,OPT_TLS_RESUME},
+    {"h2c",no_argument,&h2c,1},
+    {"streams",required_argument,NULL,OPT_STREAMS},
+    {"connect-timeout",required_argument,NULL,OPT_CONNECT_TIMEOUT},
+    {"timeout",required_argument,NULL,OPT_TIMEOUT},
+    {"idle-timeout",required_argument,NULL,OPT_IDLE_TIMEOUT},
+    {"workload",required_argument,NULL,OPT_WORKLOAD},
+    {"expect-status",required_argument,NULL,OPT_EXPECT_STATUS},
+    {"expect-length",required_argument,NULL,OPT_EXPECT_LENGTH},
+    {"expect-crc32",required_argument,NULL,OPT_EXPECT_CRC32},
     {NULL,0,NULL,0}
 };
 
@@ -136,6 +654,7 @@ int main(int argc, char *argv[])
     int opt=0;
     int options_index=0;
     char *tmp=NULL;
+    int i;
 
     //进行命令行参数的处理
 
@@ -150,18 +669,21 @@ int main(int argc, char *argv[])
     //"frt:p:c:?V912"中一个字符后面加一个冒号代表该命令后面接一个参数
     //比如t,p,c命令，后面都要接一个参数
     //连续两个冒号则表示参数可有可无
-    while((opt=getopt_long(argc,argv,"frt:p:c:?V912GHO",long_options,&options_index))!=EOF )
+    while((opt=getopt_long(argc,argv,"frt:p:c:e:w:k?V912GHO",long_options,&options_index))!=EOF )
     {
         switch(opt)
         {
+        case 0://只设置标志的长选项，getopt_long已经设置好了
+            break;
+
         case 'f':
             force=1;//不等待服务器响应
             printf("No waiting for server response\n");
             break;
 
-        case 'r'://重新请求加载(无缓存)
+        case 'r'://每个请求一个新的缓存键
             force_reload=1;
-            printf("Re-request loading (no caching)\n");
+            printf("Busting caches with a unique query parameter\n");
             break;
 
         case '9'://使用http/0.9协议来构造请求
@@ -193,10 +715,334 @@ int main(int argc, char *argv[])
             printf("clients=%d\n",clients);
             break;
 
+        case 'e'://选择压测引擎
+            if(strcasecmp(optarg,"fork")==0)
+                engine=ENGINE_FORK;
+            else if(strcasecmp(optarg,"epoll")==0)
+                engine=ENGINE_EPOLL;
+            else if(strcasecmp(optarg,"uring")==0)
+                engine=ENGINE_URING;
+            else
+            {
+                fprintf(stderr,"Option parameter error,Unknown engine %s\n",optarg);
+                return 2;
+            }
+            printf("Using %s engine\n",optarg);
+            break;
+
+        case 'w'://epoll/uring引擎的工作进程数
+            workers=atoi(optarg);
+            printf("workers=%d\n",workers);
+            break;
+
+        case 'k'://长连接，一个连接上发送多个请求
+            keepalive=1;
+            printf("Using keep-alive connections\n");
+            break;
+
+        case OPT_PIPELINE://流水线深度，需要长连接
+            pipeline=atoi(optarg);
+            if(pipeline<1)
+            {
+                fprintf(stderr,"Option parameter error,Pipeline depth %s must be at least 1\n",optarg);
+                return 2;
+            }
+            if(pipeline>1)
+                keepalive=1;
+            printf("pipeline=%d\n",pipeline);
+            break;
+
+        case OPT_RATE://开环模式，按固定速率发出请求
+            rate=atof(optarg);
+            if(rate<=0)
+            {
+                fprintf(stderr,"Option parameter error,Rate %s must be positive\n",optarg);
+                return 2;
+            }
+            printf("rate=%g requests/s\n",rate);
+            break;
+
+        case OPT_WARMUP://预热的秒数，不计入结果
+            warmup=atoi(optarg);
+            if(warmup<0)
+            {
+                fprintf(stderr,"Option parameter error,Warmup %s can't be negative\n",optarg);
+                return 2;
+            }
+            printf("warmup=%d\n",warmup);
+            break;
+
+        case OPT_RAMP://负载从0线性增加到满负荷的秒数
+            ramp=atoi(optarg);
+            if(ramp<0)
+            {
+                fprintf(stderr,"Option parameter error,Ramp %s can't be negative\n",optarg);
+                return 2;
+            }
+            printf("ramp=%d\n",ramp);
+            break;
+
+        case OPT_STEPS://测试时间分成几个负载递增的台阶
+            steps=atoi(optarg);
+            if(steps<0)
+            {
+                fprintf(stderr,"Option parameter error,Steps %s can't be negative\n",optarg);
+                return 2;
+            }
+            printf("steps=%d\n",steps);
+            break;
+
+        case OPT_OUTPUT://机器可读的结果格式
+            if(strcasecmp(optarg,"json")==0)
+                output=OUTPUT_JSON;
+            else if(strcasecmp(optarg,"csv")==0)
+                output=OUTPUT_CSV;
+            else
+            {
+                fprintf(stderr,"Option parameter error,Unknown output format %s\n",optarg);
+                return 2;
+            }
+            break;
+
+        case OPT_OUTPUT_FILE:
+            output_file=optarg;
+            break;
+
+        case OPT_AGENT://分布式测试的代理，监听的地址
+            if(agent_fd>=0)
+                return agent_forbid("--agent");
+            if(agent_parse(optarg))
+            {
+                fprintf(stderr,"Option parameter error,Illegal agent address %s\n",optarg);
+                return 2;
+            }
+            break;
+
+        case OPT_AGENTS://分布式测试的协调者，代理的地址
+            if(agent_fd>=0)
+                return agent_forbid("--agents");
+            agents_arg=strdup(optarg);
+            if(agents_parse(optarg))
+            {
+                fprintf(stderr,"Option parameter error,Illegal agent list %s\n",agents_arg);
+                return 2;
+            }
+            break;
+
+        case OPT_AGENT_TOKEN://代理和协调者共用的口令
+            agent_token=optarg;
+            break;
+
+        case OPT_AGENT_DIR://代理上允许读取文件的目录
+            if(agent_fd>=0)
+                return agent_forbid("--agent-dir");
+            agent_dir=optarg;
+            break;
+
+        case OPT_TLS_RESUME://HTTPS的会话复用方式
+            for(i=0; i<3 && strcmp(optarg,tls_resume_names[i]); i++)
+                ;
+            if(i==3)
+            {
+                fprintf(stderr,"Option parameter error,Unknown session resumption %s\n",optarg);
+                return 2;
+            }
+            tls_resume=i;
+            break;
+
+        case OPT_STREAMS://HTTP/2每个连接上的并发流数
+            streams=atoi(optarg);
+            if(streams<1)
+            {
+                fprintf(stderr,"Option parameter error,Stream count %s must be at least 1\n",optarg);
+                return 2;
+            }
+            printf("streams=%d\n",streams);
+            break;
+
+        case OPT_SERVE://参考服务器，监听的端口
+            if(agent_fd>=0)
+                return agent_forbid("--serve");
+            serve_port=atoi(optarg);
+            if(serve_port<=0 || serve_port>65535)
+            {
+                fprintf(stderr,"Option parameter error,Illegal server port %s\n",optarg);
+                return 2;
+            }
+            break;
+
+        case OPT_SERVE_SIZE://参考服务器回复正文的字节数
+            serve_size=atoll(optarg);
+            if(serve_size<0)
+            {
+                fprintf(stderr,"Option parameter error,Response size %s can't be negative\n",optarg);
+                return 2;
+            }
+            break;
+
+        case OPT_SERVE_DELAY://参考服务器每个回复的延迟，单位毫秒
+            serve_delay=atof(optarg);
+            if(serve_delay<0)
+            {
+                fprintf(stderr,"Option parameter error,Response delay %s can't be negative\n",optarg);
+                return 2;
+            }
+            break;
+
+        case OPT_CONNECT_TIMEOUT://建立连接的超时时间，单位毫秒
+            connect_timeout=atoi(optarg);
+            if(connect_timeout<0)
+            {
+                fprintf(stderr,"Option parameter error,Connect timeout %s can't be negative\n",optarg);
+                return 2;
+            }
+            printf("connect timeout=%d ms\n",connect_timeout);
+            break;
+
+        case OPT_TIMEOUT://请求的期限，单位毫秒
+            request_timeout=atoi(optarg);
+            if(request_timeout<0)
+            {
+                fprintf(stderr,"Option parameter error,Request timeout %s can't be negative\n",optarg);
+                return 2;
+            }
+            printf("request timeout=%d ms\n",request_timeout);
+            break;
+
+        case OPT_IDLE_TIMEOUT://长连接空闲的期限，单位毫秒
+            idle_timeout=atoi(optarg);
+            if(idle_timeout<0)
+            {
+                fprintf(stderr,"Option parameter error,Idle timeout %s can't be negative\n",optarg);
+                return 2;
+            }
+            printf("idle timeout=%d ms\n",idle_timeout);
+            break;
+
+        case OPT_WORKLOAD://从文件读取多个带权重的请求
+            if(agent_fd>=0 && agent_path_check("--workload",optarg))
+                return 2;
+            workload_file=optarg;
+            break;
+
+        case OPT_BODY://POST/PUT请求的正文
+            if(agent_fd>=0 && agent_path_check("--body",optarg))
+                return 2;
+            body_file=optarg;
+            break;
+
+        case OPT_HEADER://额外的请求报头，值里可以有变量
+            if(nheaders==MAX_HEADERS)
+            {
+                fprintf(stderr,"Option parameter error,At most %d headers\n",MAX_HEADERS);
+                return 2;
+            }
+            if(strchr(optarg,':')==NULL || optarg[0]==':' || strpbrk(optarg,"\r\n")!=NULL)
+            {
+                fprintf(stderr,"Option parameter error,Header %s must be \"Name: value\"\n",optarg);
+                return 2;
+            }
+            headers_len+=strlen(optarg)+2;
+            if(headers_len>HEADERS_SIZE)
+            {
+                fprintf(stderr,"Option parameter error,Headers are too long\n");
+                return 2;
+            }
+            headers[nheaders++]=optarg;
+            break;
+
+        case OPT_CONTENT_TYPE:
+            content_type=optarg;
+            if(strlen(content_type)>200)
+            {
+                fprintf(stderr,"Option parameter error,Content type is too long\n");
+                return 2;
+            }
+            break;
+
+        case OPT_EXPECT_STATUS://期望的状态码，如200，或者整类如2xx
+            expect_status=atoi(optarg);
+            if(strlen(optarg)==3 && strcasecmp(optarg+1,"xx")==0)
+                expect_status=optarg[0]-'0';
+            else if(strspn(optarg,"0123456789")!=strlen(optarg))
+                expect_status=0;
+            if((expect_status<1 || expect_status>5) && (expect_status<100 || expect_status>599))
+            {
+                fprintf(stderr,"Option parameter error,Expected status %s is not a status code or class\n",optarg);
+                return 2;
+            }
+            expect=1;
+            break;
+
+        case OPT_EXPECT_LENGTH://正文长度n，或者范围n-m，m省略时没有上限
+            expect_min_len=strtoll(optarg,&tmp,10);
+            expect_max_len=expect_min_len;
+            if(*tmp=='-')
+                expect_max_len=tmp[1]?strtoll(tmp+1,&tmp,10):-1;
+            if(tmp==optarg || *tmp!='\0' || expect_min_len<0 ||
+               (expect_max_len>=0 && expect_max_len<expect_min_len))
+            {
+                fprintf(stderr,"Option parameter error,Expected length %s should be n or n-m\n",optarg);
+                return 2;
+            }
+            expect=1;
+            break;
+
+        case OPT_EXPECT_CRC32://正文的CRC-32，十六进制，和zlib.crc32、gzip的结果相同
+            expect_crc=strtoul(optarg,&tmp,16);
+            if(tmp==optarg || *tmp!='\0')
+            {
+                fprintf(stderr,"Option parameter error,Expected CRC-32 %s is not a hex number\n",optarg);
+                return 2;
+            }
+            expect_crc_set=1;
+            expect=1;
+            crc32_init();
+            break;
+
+        case OPT_BIND://新连接绑定的本地地址
+            bind_arg=strdup(optarg);
+            if(bind_parse(optarg))
+            {
+                fprintf(stderr,"Option parameter error,Illegal local address list %s\n",bind_arg);
+                return 2;
+            }
+            break;
+
+        case OPT_CPUS://子进程绑定的核
+            cpus_arg=optarg;
+            break;
+
+        case OPT_IRQ_CPUS://留给网卡中断的核
+            irq_cpus_arg=optarg;
+            break;
+
         case 'p'://使用代理服务器，则设置其代理网络号和端口号，格式：-p server:port
 
             //server:port是一个参数，下面把这个字符串解析成服务器地址和端口两个参数
 
+            //IPv6地址本身带':'，要写在方括号里，如 [::1]:3128
+            if(optarg[0]=='[')
+            {
+                tmp=strchr(optarg,']');
+                if(tmp==NULL || (tmp[1]!='\0' && tmp[1]!=':') || tmp==optarg+1)
+                {
+                    fprintf(stderr,"Option parameter error,Proxy server %s: Illegal IPv6 address ",optarg);
+                    return 2;
+                }
+                *tmp='\0';
+                proxyhost=optarg+1;
+                if(tmp[1]==':')
+                    proxyport=atoi(tmp+2);
+                if(proxyport==0)
+                {
+                    fprintf(stderr,"Option parameter error,Proxy server %s: Missing port number ",optarg);
+                    return 2;
+                }
+                printf("Using proxy server [%s]:%d\n",proxyhost,proxyport);
+                break;
+            }
+
             tmp=strrchr(optarg,':');//在optagr中找到':'最后出现的位置
 
             proxyhost=optarg;
@@ -249,54 +1095,214 @@ int main(int argc, char *argv[])
         }
     }
 
+    //代理不需要URL，等协调者发来完整的命令行
+    if(agent_port>0)
+    {
+        if(nagents>0)
+        {
+            fprintf(stderr,"Option parameter error,--agent and --agents can't be used together\n");
+            return 2;
+        }
+        return agent_serve();
+    }
+
+    //参考服务器也不需要URL，只用-w和--cpus/--irq-cpus/--numa
+    if(serve_port>0)
+    {
+        if(nagents>0)
+        {
+            fprintf(stderr,"Option parameter error,--serve and --agents can't be used together\n");
+            return 2;
+        }
+        i=affinity_setup();
+        if(i)
+            return i;
+        return serve();
+    }
+
+    //代理只在自己的终端上打印文本结果，机器可读的结果由协调者输出
+    if(agent_fd>=0)
+        output=OUTPUT_TEXT;
+
     //命令参数解析完毕之后，刚好是读到URL，此时argv[optind]指向URL
-    //URL参数为空
-    if(optind==argc)
+    //URL参数为空，有--workload时可以不给URL
+    if(optind==argc && workload_file==NULL)
+    {
+        fprintf(stderr,"Missing URL\n");
+        usage();
+        return 2;
+    }
+
+    //设置默认值
+    if(clients==0)
+        clients=1;
+    if(benchtime==0)
+        benchtime=30;
+
+    //给了正文就是要上传，默认用POST
+    if(body_file!=NULL && method!=METHOD_PUT)
+        method=METHOD_POST;
+
+    //正文只映射一次，所有子进程共用
+    if(body_file!=NULL)
+        body_load(body_file);
+
+    //HTTP/2：连接一直复用，请求靠流区分，流水线由--streams代替
+    if(h2c)
+    {
+        if(proxyhost!=NULL)
+        {
+            fprintf(stderr,"Option parameter error,--h2c can't be used through a proxy server\n");
+            return 2;
+        }
+        if(rate>0)
+        {
+            fprintf(stderr,"Option parameter error,--h2c only supports closed-loop tests,not --rate\n");
+            return 2;
+        }
+        if(force)
+        {
+            fprintf(stderr,"Option parameter error,--h2c needs to read responses and can't be used with --force\n");
+            return 2;
+        }
+        if(pipeline>1)
+        {
+            fprintf(stderr,"Option parameter error,--h2c doesn't pipeline,use --streams instead\n");
+            return 2;
+        }
+        http10=2;
+        keepalive=1;
+    }
+
+    //长连接要靠读回复来区分一个个请求，不能和不等待回复一起用
+    if(keepalive && force)
+    {
+        fprintf(stderr,"Option parameter error,--keep-alive needs to read responses and can't be used with --force\n");
+        return 2;
+    }
+
+    //检查回复必须读回复
+    if(expect && force)
+    {
+        fprintf(stderr,"Option parameter error,--expect-* needs to read responses and can't be used with --force\n");
+        return 2;
+    }
+
+    //io_uring引擎只做闭环压测，开环模式和内核不支持io_uring时用epoll引擎
+    if(engine==ENGINE_URING && rate>0)
+    {
+        printf("The uring engine doesn't support --rate,falling back to epoll engine\n");
+        engine=ENGINE_EPOLL;
+    }
+    if(engine==ENGINE_URING && !uring_available())
+    {
+        printf("io_uring is not available in this kernel,falling back to epoll engine\n");
+        engine=ENGINE_EPOLL;
+    }
+    if(h2c && engine!=ENGINE_EPOLL)
+    {
+        printf("HTTP/2 runs on the epoll engine,using epoll engine\n");
+        engine=ENGINE_EPOLL;
+    }
+
+    //排出预热、加压和台阶各个阶段
+    i=profile_setup();
+    if(i)
+        return i;
+
+    //客户端和速率要分给各个代理
+    if(nagents>clients)
+    {
+        fprintf(stderr,"Option parameter error,%d agents need at least as many clients\n",nagents);
+        return 2;
+    }
+
+    //算出子进程要绑定的核，协调者不运行子进程，核由各个代理自己绑定
+    i=nagents>0?0:affinity_setup();
+    if(i)
+        return i;
+    if(numa && !pinned && nagents==0)
     {
-        fprintf(stderr,"Missing URL\n");
-        usage();
+        fprintf(stderr,"Option parameter error,--numa needs --cpus or --irq-cpus\n");
         return 2;
     }
 
-    //设置默认值
-    if(clients==0)
-        clients=1;
-    if(benchtime==0)
-        benchtime=30;
+    //epoll和uring引擎默认每个CPU一个工作进程(绑定时每个绑定的核一个)，工作进程不能比客户端多
+    if(engine!=ENGINE_FORK)
+    {
+        if(workers<=0)
+            workers=pinned?ncpu_list:sysconf(_SC_NPROCESSORS_ONLN);
+        if(workers<=0)
+            workers=1;
+        if(workers>clients)
+            workers=clients;
+    }
 
     //程序说明
     fprintf(stderr,"WebBench: A Lightweight Web Pressure Measuring Tool "PROGRAM_VERSION" covered by YB \nGPL Open Source Software\n");
 
-    //构造请求报文
-    build_request(argv[optind]);//参数为URL
+    //构造请求报文，所有请求报文都放进arena
+    if(workload_file!=NULL)
+        workload_load(workload_file);
+    else
+        workload_add(argv[optind],method,1);
+    workload_alias();
+    target_url=entries[0].url;
 
-    //请求报文构造好了，开始测压
-    printf("\nIn testing :\n");
+    //URL和报头里的变量编译成模板
+    tmpl_setup();
 
-    //选择请求方法
-    switch(method)
+    //https://：io_uring引擎没有TLS，改用epoll引擎；正文要解密，不能在内核里丢掉
+    if(tls)
     {
-    case METHOD_OPTIONS:
-        printf("OPTIONS");
-        break;
+        if(engine==ENGINE_URING)
+        {
+            printf("The uring engine doesn't support HTTPS,falling back to epoll engine\n");
+            engine=ENGINE_EPOLL;
+        }
+        if(drain)
+        {
+            printf("--drain has no effect on HTTPS,response bodies must be decrypted\n");
+            drain=0;
+        }
+        i=tls_setup();
+        if(i)
+            return i;
+    }
 
-    case METHOD_HEAD:
-        printf("HEAD");
-        break;
+    //h2c是明文的HTTP/2，https://要靠TLS的ALPN协商，不支持
+    //回复的正文在DATA帧里，不能在内核里丢掉
+    if(h2c)
+    {
+        if(tls)
+        {
+            fprintf(stderr,"Option parameter error,--h2c is cleartext HTTP/2 and can't be used with https:// URLs\n");
+            return 2;
+        }
+        if(drain)
+        {
+            printf("--drain has no effect on HTTP/2,response bodies arrive in frames\n");
+            drain=0;
+        }
+        i=h2_setup();
+        if(i)
+            return i;
+    }
 
-    case METHOD_GET:
-        printf("GET");
-        break;
-    default:
-        printf("GET");
-        break;
+    //请求报文构造好了，开始测压
+    printf("\nIn testing :\n");
 
-    }
+    //选择请求方法
+    printf("%s",method_names[method]);
 
     //打印URL
-    printf(" %s",argv[optind]);
+    printf(" %s",target_url);
+    if(workload_file!=NULL)
+        printf(" and %d more requests from %s",nentries-1,workload_file);
 
-    switch(http10)
+    if(h2c)
+        printf("(Using HTTP/2 over cleartext)");
+    else switch(http10)
     {
     case 0:
         printf("(Using HTTP/0.9)");
@@ -315,16 +1321,54 @@ int main(int argc, char *argv[])
 
     printf("%d Clients",clients);
 
+    if(engine!=ENGINE_FORK)
+        printf(",%d %s workers",workers,engine_names[engine]);
+
     printf(",Testing running %d s",benchtime);
 
+    if(warmup>0)
+        printf(" after %d s warmup",warmup);
+
+    if(ramp>0)
+        printf(",Ramping up over %d s ",ramp);
+
+    if(steps>0)
+        printf(",%d load steps ",steps);
+
     if(force)
         printf(",Choose to close the connection ahead of time ");
 
+    if(h2c)
+        printf(",%d concurrent streams per connection ",streams);
+    else if(keepalive)
+        printf(",Keep-alive connections ");
+
+    if(pipeline>1)
+        printf(",Pipeline depth %d ",pipeline);
+
+    if(drain)
+        printf(",Draining response bodies ");
+
+    if(tls)
+        printf(",HTTPS with %s session resumption ",tls_resume_names[tls_resume]);
+
+    if(pinned)
+        printf(",Pinned to %d CPUs%s ",ncpu_list,numa?" with NUMA-local memory":"");
+
+    if(rate>0)
+        printf(",Open-loop at %g requests/s ",rate);
+
     if(proxyhost!=NULL)
         printf(",Through proxy server %s:%d ",proxyhost,proxyport);
 
+    if(nlocals>0)
+        printf(",Binding to %d local addresses ",nlocals);
+
+    if(nagents>0)
+        printf(",Spread over %d agents ",nagents);
+
     if(force_reload)
-        printf(",Choose no cache ");
+        printf(",Unique query per request ");
 
     /*
      *换行不能少！库函数是默认行缓冲，子进程会复制整个缓冲区
@@ -334,7 +1378,9 @@ int main(int argc, char *argv[])
     */
     printf(".\n");
 
-    //真正开始压力测试！
+    //真正开始压力测试！分布式测试时由各个代理去测
+    if(nagents>0)
+        return coordinate(argc,argv);
     return bench();
 }
 
@@ -342,14 +1388,31 @@ int main(int argc, char *argv[])
 static int bench(void)
 {
     int i,j;
-    int k;
-    int c1,c2,c3,c4,c5;
+    char line[128];
+    long long delay=1000000;//子进程fork之后等1秒再一起开始
+    struct timespec ts;
 
     pid_t pid=0;//进程号定义 实际上也是int型的
-    FILE *f;//文件
+    struct addr tmpaddr;
+
+    //解析服务器地址，只在这里解析一次，子进程继承解析结果
+    naddrs=Resolve(proxyhost==NULL?host:proxyhost,proxyport,addrs,MAX_ADDRS);
+    if(naddrs<0)
+    {
+        fprintf(stderr,"\n Failed to resolve %s, interrupt test \n",proxyhost==NULL?host:proxyhost);
+        return 3;
+    }
 
-    //先检查一下目标服务器是可用性
-    i=Socket(proxyhost==NULL?host:proxyhost,proxyport);
+    //先检查一下目标服务器是可用性，第一个能连上的地址放到最前面
+    //父进程这几次系统调用记在total里，汇总结果时会被覆盖
+    st=&total;
+    i=-1;
+    for(j=0; j<naddrs; j++)
+    {
+        i=connect_timed(&addrs[j]);
+        if(i>=0)
+            break;
+    }
 
     //目标服务器不可用
     if(i<0)
@@ -361,13 +1424,73 @@ static int bench(void)
     //尝试连接成功了，关闭连接
     close(i);
 
-    //建立父子进程通信的管道
-    if(pipe(mypipe))
+    tmpaddr=addrs[0];
+    addrs[0]=addrs[j];
+    addrs[j]=tmpaddr;
+
+    AddrString(&addrs[0],line,sizeof(line));
+
+    //--bind的地址里至少要有一个能用来连接服务器
+    if(nlocals>0 && next_local(&addrs[0])==NULL)
+    {
+        fprintf(stderr,"\n None of the --bind addresses can reach %s, interrupt test \n",line);
+        return 3;
+    }
+
+    //预检查时已经用过本地地址了，子进程重新开始数
+    local_next=0;
+    for(j=0; j<nlocals; j++)
+        locals[j].used=0;
+
+    printf("Resolved %s to %d address(es),",proxyhost==NULL?host:proxyhost,naddrs);
+    if(all_addrs)
+        printf(" connecting to all of them round-robin\n");
+    else
+        printf(" connecting to %s\n",line);
+
+    //fork引擎每个客户端一个子进程，epoll和uring引擎每个工作进程负责一部分客户端
+    if(engine!=ENGINE_FORK)
+    {
+        nprocs=workers;
+        nhists=workers;
+
+        //每个连接占用一个文件描述符，子进程会继承这个上限
+        raise_nofile(clients/workers+64);
+    }
+    else
+    {
+        nprocs=clients;
+        nhists=pinned?ncpu_list:sysconf(_SC_NPROCESSORS_ONLN);
+        if(nhists<=0)
+            nhists=1;
+        if(nhists>clients)
+            nhists=clients;
+    }
+
+    //建立父子进程共享的统计槽，每个阶段一组，每个条目的结果也放在共享内存里
+    //直方图另外放，每个阶段只有nhists组
+    slots=stats_alloc(nstages*nprocs);
+    hist_slots=hists_alloc(nstages*nhists);
+    entry_slots=mmap(NULL,sizeof(struct entry_stats)*nstages*nprocs*nentries,PROT_READ|PROT_WRITE,
+                     MAP_SHARED|MAP_ANONYMOUS,-1,0);
+    if(slots==NULL || hist_slots==NULL || entry_slots==MAP_FAILED)
+    {
+        perror(" Failed to allocate shared statistics ");
+        return 3;
+    }
+
+    //分布式测试的代理：准备好了告诉协调者，等它统一发出开始信号
+    if(agent_fd>=0 && (delay=agent_ready())<0)
     {
-        perror(" Communication Pipeline Failure ");
+        fprintf(stderr,"\n Lost the coordinator, interrupt test \n");
         return 3;
     }
 
+    //所有子进程从同一时刻开始，开环模式的计划时间也从那时开始算
+    bench_start=now_us()+delay;
+    ts.tv_sec=bench_start/1000000;
+    ts.tv_nsec=bench_start%1000000*1000;
+
 
     /*
     父进程创建子进程后，fork函数是让子进程完全拷贝父进程，
@@ -376,9 +1499,16 @@ static int bench(void)
     也就是说，父进程执行过的代码子进程是不会再执行，
     子进程下一条该执行的命令与父进程完全一样！！！
     */
+    //标准输出不是终端时是全缓冲的，fork前不清空缓冲区，子进程会把里面的内容再打印一遍
+    fflush(stdout);
+
     //创建子进程进行测试，子进程数量和clients有关
-    for(i=0; i<clients; i++)
+    for(i=0; i<nprocs; i++)
     {
+        worker_id=i;//子进程从这里得到自己的编号
+        addr_next=i;//轮流使用地址时每个子进程从不同的地址开始
+        local_next=i;
+
         // pid 为 pid_t 类型 表示进程号
 
         pid=fork();//建立子进程
@@ -386,7 +1516,9 @@ static int bench(void)
         //fork失败 子进程错误
         if(pid <= (pid_t) 0)
         {
-            sleep(1);  //当前进程挂起1毫秒，将cpu时间交给其他进程
+            //子进程挂起到共同的起始时间，将cpu时间交给其他进程
+            while(pid==0 && clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL)==EINTR)
+                ;
             break;     //跳出去，阻止子进程继续fork
         }
     }
@@ -402,179 +1534,444 @@ static int bench(void)
     //当前进程是子进程
     if(pid == (pid_t) 0)
     {
+        st=&slots[i];
+        if(engine==ENGINE_FORK && (hist_own=calloc(nstages,sizeof(struct hists)))==NULL)
+        {
+            perror(" Failed to allocate histograms ");
+            exit(3);
+        }
+        hs=hists_stage(0);
+        workload_start(i);
+        affinity_apply(i);
 
         //由子进程发出请求报文 根据是否采用代理发送不同的报文
-        if(proxyhost==NULL)
-            benchcore(host,proxyport,request);
+        if(engine!=ENGINE_FORK)
+        {
+            //第i个工作进程分到的连接数，除不尽的余数分给前面的进程
+            j=clients/workers+(i<clients%workers);
+            if(engine==ENGINE_URING)
+                uringcore(j);
+            else
+                epollcore(j);
+        }
         else
-            benchcore(proxyhost,proxyport,request);
+            benchcore();
+
+        //结果都已经记在共享内存的槽位里了，最后记下用了多少内存，fork引擎合并直方图
+        mem_record();
+        hists_flush();
+        return 0;
+    }
+    //当前进程是父进程
+    else
+    {
+        //测试过程中每秒打印一次，直到所有子进程结束
+        monitor(slots,nprocs);
+
+        //从所有槽位汇总结果，中途退出的子进程已经记下的结果也算在内
+        //预热阶段的槽位不算
+        stats_sum(&total,slots+first_stage*nprocs,(nstages-first_stage)*nprocs);
+        hists_sum(&hist_total,hist_slots+first_stage*nhists,(nstages-first_stage)*nhists);
 
-        //子进程获得管道写端的文件指针，准备向父进程写结果
-        f=fdopen(mypipe[1],"w");
+        i=report();
 
-        //管道写端打开失败
-        if(f==NULL)
+        //代理把结果发回协调者
+        if(agent_fd>=0 && agent_result())
         {
-            perror(" Pipeline Writer End Failed to Open ");
+            fprintf(stderr,"\n Failed to send the results to the coordinator \n");
             return 3;
         }
+        return i;
+    }
+
+    return 0;
+}
 
+//输出汇总在total里的结果，每个阶段的结果在slots里，每nprocs个槽位一个阶段
+static int report(void)
+{
+    double target;
 
-        /*向管道中写入该孩子进程在一定时间内
-          请求成功的次数
-          失败次数
-          读取到服务器回复的总字节数
-        */
-        fprintf(f,"%d %d %d %d %d %d %d %d\n",speed,failed,bytes,connect_failed,send_failed,wclose_failed,read_failed,sclose_failed);
+    //统计处理结果
+    printf("\nSpeed:%lld pages/min,%lld requests/s,%lld bytes/s.\nRequest:%lld Success,%lld Fail\n",\
+          (total.speed+total.failed)*60/benchtime,\
+          total.speed/benchtime,\
+          total.bytes/benchtime,\
+          total.speed,total.failed);
 
-        //关闭写端
-        fclose(f);
+    //平均每个请求进入内核的次数，用来比较各个引擎
+    printf("System calls:%lld,%.2f per request\n",total.syscalls,
+           total.speed+total.failed?total.syscalls/(double)(total.speed+total.failed):0.0);
 
-        return 0;
+    //平均每个连接占用客户端多少内存，fork引擎是整个进程，epoll/uring引擎另外给出连接状态和缓冲区的部分
+    if(total.conns_peak>0)
+    {
+        printf("Memory:%lld connections at peak,%lld bytes per connection",
+               total.conns_peak,total.mem_pss/total.conns_peak);
+        if(engine!=ENGINE_FORK)
+            printf("(connection state and buffers %lld)",total.mem_state/total.conns_peak);
+        printf("\n");
     }
-    //当前进程是父进程
-    else
+
+    //失败的类型及个数
+    printf("Reasons for failure:\n");
+    printf("connect failed:%lld\n",total.connect_failed);
+    printf("connect timed out:%lld\n",total.connect_timeout);
+    printf("request timed out:%lld\n",total.timeouts);
+    printf("local address/port unavailable:%lld\n",total.addr_unavail);
+    printf("send message failed:%lld\n",total.send_failed);
+    printf("write-side shutdown failed:%lld\n",total.wclose_failed);
+    printf("read server message failed:%lld\n",total.read_failed);
+    printf("response check failed:%lld\n",total.invalid);
+    printf("socket close failed:%lld\n",total.sclose_failed);
+
+    //开环模式：实际速率和目标速率的差距，有负载曲线时目标是计入结果的阶段的平均速率
+    if(rate>0)
     {
-        //父进程获得管道读端的文件指针
-        f=fdopen(mypipe[0],"r");
+        target=(profile_count(stages[nstages-1].end)-profile_count(stages[first_stage].start))/benchtime;
+        printf("Rate:target %lld requests/s,achieved %lld requests/s(%.1f%% of target),%lld requests behind schedule\n",
+               (long long)target,
+               (total.speed+total.failed)/benchtime,
+               (total.speed+total.failed)/(double)benchtime/target*100,
+               total.unsent);
+        printf("Latency is measured from the intended send time\n");
+    }
+
+    //按状态码分类，看清楚回复里有多少是错误页
+    status_print(&total);
+
+    //成功请求的延迟分布
+    hist_print(&hist_total.latency);
+
+    //各阶段的耗时分布，看慢在建立连接、服务器处理还是传输
+    printf("Phases:\n");
+    hist_print_line("connect",&hist_total.connect_time);
+    hist_print_line("ttfb",&hist_total.ttfb);
+    hist_print_line("transfer",&hist_total.transfer);
+
+    //HTTPS的握手单独统计，完整握手和会话复用分开
+    tls_print(&total,&hist_total);
+
+    //HTTP/2连接和流的情况
+    h2_print(&total,&hist_total);
+
+    //有负载曲线时每个阶段单独汇总，看负载加到多少时吞吐不再增长
+    if(profiled())
+        stages_print(slots,nprocs,hist_slots,nhists);
+
+    //多个请求时逐条列出，看是哪个接口拖慢了服务器
+    if(workload_file!=NULL)
+        workload_print(first_stage*nprocs,(nstages-first_stage)*nprocs);
+
+    //每个子进程在哪个核上，用同样的--cpus可以原样重复
+    affinity_print(nprocs);
+
+    //机器可读的完整结果
+    if(output!=OUTPUT_TEXT)
+        return write_result();
+
+    return 0;
+}
+
+/*
+fork引擎建立连接：
+阻塞的connect没有超时，服务器不可达时要等内核重传SYN放弃，可能要一两分钟
+所以先发起非阻塞connect，用poll等--connect-timeout(最多到测试结束)，连上之后再改回阻塞的socket
+超时返回-1并把errno设为ETIMEDOUT
+*/
+static int connect_timed(const struct addr *ad)
+{
+    struct pollfd pfd;
+    const struct addr *local=next_local(ad);
+    int s,inprogress,err=0,n;
+    socklen_t len=sizeof(err);
 
-        //管道读端打开失败
-        if(f==NULL)
+    s=SocketNonblock(ad,local,&inprogress);
+    st->syscalls+=local!=NULL?4:2;//socket和connect，绑定时还有setsockopt和bind
+    if(s<0)
+        return -1;
+
+    if(inprogress)
+    {
+        pfd.fd=s;
+        pfd.events=POLLOUT;
+        n=SYSCALL(poll(&pfd,1,wait_until(now_us(),run_end(),connect_timeout>0?connect_timeout:-1)));
+        if(n<=0)
         {
-            perror(" Pipeline Reader Failed to Open ");
-            return 3;
+            err=n==0?ETIMEDOUT:errno;
+            SYSCALL(close(s));
+            errno=err;
+            return -1;
         }
 
-        /*
-        fopen标准IO函数是自带缓冲区的
-        我们输入的数据非常短，并且数据要及时
-        所以没有缓冲是最合适的
-        我们不需要缓冲区
-        因此把缓冲类型设置为_IONBF*/
-        setvbuf(f,NULL,_IONBF,0);
+        //取出连接的结果
+        if(SYSCALL(getsockopt(s,SOL_SOCKET,SO_ERROR,&err,&len)) || err)
+        {
+            SYSCALL(close(s));
+            errno=err?err:errno;
+            return -1;
+        }
+    }
 
-        speed=0;  //连接成功次数，后面除以时间可以得到速度
-        failed=0; //失败的请求次数
-        bytes=0;  //服务器回复的总字节数
+    //benchcore()用阻塞的读写
+    if(SYSCALL(fcntl(s,F_SETFL,0)))
+    {
+        SYSCALL(close(s));
+        return -1;
+    }
 
-        connect_failed=0;
-        send_failed=0;
-        wclose_failed=0;
-        read_failed=0;
-        sclose_failed=0;
+    return s;
+}
 
+//关闭fork引擎的连接，https://时先释放TLS状态，会话留给下一个连接复用
+static int close_conn(int s,struct tls_conn **t)
+{
+    tls_free(*t);
+    *t=NULL;
+    return SYSCALL(close(s));
+}
 
-        //父进程不停的读
-        while(1)
-        {
-            //读入参数以及得到成功得到的参数的个数
-            pid=fscanf(f,"%d %d %d %d %d %d %d %d",&i,&j,&k,&c1,&c2,&c3,&c4,&c5);
+/*
+fork引擎的阻塞读写最多等到deadline：
+SO_RCVTIMEO/SO_SNDTIMEO让阻塞的读写到时间返回EAGAIN，*set是这个socket上设置过的等待时间(毫秒)，
+0表示还没有设置，-1表示上次等满了要重新设置
+设置过的时间最多比剩下的时间长SOCK_SLACK毫秒(或者剩下时间的1/8)时不用再设置，
+不然期限固定(测试结束)时剩下的时间每毫秒都在变，每次读写都要多一次系统调用
+内核的定时器轮对长的超时留了余量，最多会晚1/8，所以先少设1/8，等满了再按剩下的时间设，几次就逼近期限
+已经到了deadline时返回-1并把errno设为ETIMEDOUT
+*/
+#define SOCK_SLACK 10
+static int sock_deadline(int s,int opt,int *set,long long deadline)
+{
+    struct timeval tv;
+    int ms=wait_until(now_us(),deadline,-1);
 
-            //成功得到的参数个数小于8
-            if(pid<8)
-            {
-                fprintf(stderr,"A child process deaid\n");
-                break;
-            }
+    if(ms==0)
+    {
+        errno=ETIMEDOUT;
+        return -1;
+    }
+    if(*set>0 && *set<=ms+(ms/8<SOCK_SLACK?ms/8:SOCK_SLACK))
+        return 0;
 
-            //计总数
-            speed+=i;
-            failed+=j;
-            bytes+=k;
+    ms-=ms/8;
+    tv.tv_sec=ms/1000;
+    tv.tv_usec=ms%1000*1000;
+    if(SYSCALL(setsockopt(s,SOL_SOCKET,opt,&tv,sizeof(tv))))
+        return -1;
+    *set=ms;
+    return 0;
+}
 
-            connect_failed+=c1;
-            send_failed+=c2;
-            wclose_failed+=c3;
-            read_failed+=c4;
-            sclose_failed+=c5;
+//新连接的发送缓冲区至少放得下这么多(net.ipv4.tcp_wmem的默认值)，更短的请求写的时候不会阻塞，不用设SO_SNDTIMEO
+#define SEND_NOBLOCK 16384
 
+//fork引擎发出第e个条目的请求m，最多等到deadline，全部发出返回0，失败返回-1，超时errno是ETIMEDOUT
+//https://时SSL_write一次最多写一个TLS记录，报文长时要写几次
+static int send_request(int s,struct tls_conn *t,int e,const struct request_msg *m,struct iovec *iov,int *sndto,long long deadline)
+{
+    int sent=0,n,niov;
 
+    while(sent<m->len)
+    {
+        if((m->len>SEND_NOBLOCK || *sndto!=0) && sock_deadline(s,SO_SNDTIMEO,sndto,deadline))
+            return -1;
 
-            if(--clients==0)//记录已经读了多少个子进程的数据，读完就退出
-                break;
+        niov=request_iov(&entries[e],m,sent,iov);
+        if(t!=NULL)
+            n=SYSCALL(tls_writev(t,iov,niov));
+        else
+            n=SYSCALL(writev(s,iov,niov));
+        if(n<0 && errno==EAGAIN)
+        {
+            *sndto=-1;
+            continue;
         }
+        if(n<=0)
+            return -1;
+        sent+=n;
+    }
+    return 0;
+}
 
-        //关闭读端
-        fclose(f);
+//fork引擎阻塞地握手，最多等到deadline，成功返回0
+static int handshake_timed(int s,struct tls_conn *t,int *rcvto,long long deadline)
+{
+    int n;
 
-        //统计处理结果
-        printf("\nSpeed:%d pages/min,%lld bytes/s.\nRequest:%d Success,%d Fail\n",\
-              (int)((speed+failed)/(benchtime/60.0f)),\
-              (int)(bytes/(float)benchtime),\
-              speed,failed);
+    while(!sock_deadline(s,SO_RCVTIMEO,rcvto,deadline))
+    {
+        n=SYSCALL(tls_handshake(t));
+        if(n!=0)
+            return n==1?0:-1;
+        *rcvto=-1;
+    }
+    return -1;
+}
 
-        //失败的类型及个数
-        printf("Reasons for failure:\n");
-        printf("connect failed:%d\n",connect_failed);
-        printf("send message failed:%d\n",send_failed);
-        printf("write-side shutdown failed:%d\n",wclose_failed);
-        printf("read server message failed:%d\n",read_failed);
-        printf("socket close failed:%d\n",sclose_failed);
+//fork引擎读一段回复，最多等到deadline，超时返回-1并把errno设为ETIMEDOUT
+static int recv_timed(int s,struct tls_conn *t,char *buf,int size,const struct http_resp *r,int *discard,int *rcvto,long long deadline)
+{
+    int n;
 
+    while(!sock_deadline(s,SO_RCVTIMEO,rcvto,deadline))
+    {
+        n=recv_resp(s,t,buf,size,r,discard);
+        if(n>=0 || errno!=EAGAIN)
+            return n;
+        *rcvto=-1;
     }
+    return -1;
+}
 
-    return i;
+//fork引擎的请求没能完成，n个请求算失败：超过--timeout的记为超时，其他的记在reason上(NULL表示原因已经记过了)
+//测试时间到了的既不算成功也不算失败
+static void fork_fail(int e,int n,long long *reason)
+{
+    int timedout=errno==ETIMEDOUT;
+
+    if(run_over(now_us()))
+        return;
+    request_fail(e,n);
+    if(timedout)
+        st->timeouts+=n;
+    else if(reason!=NULL)
+        *reason+=n;
 }
 
 //子进程真正向服务器发送请求报文并以其得到期间相关数据
-void benchcore(const char *host,const int port,const char *req)
+void benchcore(void)
 {
-    int rlen;
-    char buf[1500];//记录服务器响应请求返回的数据
+    struct iovec *iov;//本次请求的报文(和正文)
+    struct request_msg m;//本次请求的报文，有变量时渲染在tbuf里
+    char *tbuf;
+    int e=0;//本次请求是第几个条目
+    char *buf;//记录服务器响应请求返回的数据
+    int bufsize=drain?DRAIN_BUF_SIZE:1500;
+    int discard;//读到的是在内核里丢掉的正文
     int s,i;
-    struct sigaction sa;//信号处理函数定义
-
-    //设置alarm_handler函数为闹钟信号处理函数
-    sa.sa_handler=alarm_handler;
-    sa.sa_flags=0;
-
-    if(sigaction(SIGALRM,&sa,NULL))//超时会产生信号SIGALRM，用sa中指定函数处理
+    int rcvto=0,sndto=0;//连接上设置过的SO_RCVTIMEO和SO_SNDTIMEO
+    long long deadline;//当前阶段(握手、发送、等回复)的期限
+    long long idle_since=0;//长连接上一批回复收完的时间
+    struct http_resp resp;//解析回复，长连接时靠它找到回复的结尾
+    int inflight;//流水线上还没有收到回复的请求数
+    int first;//还没有收到回复的第一个字节
+    long long start;//本次请求开始的时间
+    long long phase;//当前阶段开始的时间
+    long long sent=0;//开环模式下已经发出的请求数
+    long long wake;//负载曲线上轮到这个客户端的时间
+    struct timespec ts;
+    struct tls_conn *t=NULL;//https://时连接的TLS状态
+
+    iov=malloc(sizeof(struct iovec)*REQUEST_IOV);
+    buf=malloc(bufsize);
+    tbuf=tmpl_bufs(1);
+    if(iov==NULL || buf==NULL)
         exit(3);
 
-    alarm(benchtime);//开始计时
-
-    rlen=strlen(req);//得到请求报文的长度
+    s=-1;//长连接时socket在多个请求之间保留
 
 nexttry:
     while(1)
     {
-        //只有在收到闹钟信号后会使得timeout=1
-        if(timeout)//超时返回
-        {
-            //修正失败信号
-            if(failed>0)
-                failed--;
-            if(connect_failed>0)
-                connect_failed--;
-            else if(send_failed>0)
-                send_failed--;
-            else if(wclose_failed>0)
-                wclose_failed--;
-            else if(read_failed>0)
-                read_failed--;
-            else if(sclose_failed>0)
-                sclose_failed--;
+        //测试时间到了，进行中的请求既不算成功也不算失败
+        if(run_over(now_us()))
+        {
+            if(s>=0)
+                close_conn(s,&t);
 
+            //开环模式：计划时间已经到了却没有发出去的请求
+            if(rate>0 && intended_count(now_us())>sent)
+                st->unsent=intended_count(now_us())-sent;
             return;
         }
 
-        //建立到目的网站的tcp连接,发送http请求
-        s=Socket(host,port);
+        stage_check(now_us());
 
-        //连接失败
-        if(s<0)
+        //闭环模式下负载还没加到这个客户端，关掉连接等到轮到为止
+        if(rate==0 && !active_conns(1,now_us()))
         {
-            failed++;//失败次数+1
-            connect_failed++;
+            if(s>=0)
+                close_conn(s,&t);
+            s=-1;
+
+            //一直轮不到时睡到测试结束
+            wake=active_wake(0,now_us());
+            if(wake<0 || wake>run_end())
+                wake=run_end();
+            ts.tv_sec=wake/1000000;
+            ts.tv_nsec=wake%1000000*1000;
+            SYSCALL(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL));
             continue;
         }
 
+        //请求从建立连接(长连接时从发送)开始计时
+        //开环模式从计划发出的时间开始计时，还没到时间就等一等
+        if(rate>0)
+        {
+            start=intended_time(sent);
+            if(start>now_us())
+            {
+                //计划时间在测试结束之后，睡到结束为止
+                wake=start<run_end()?start:run_end();
+                ts.tv_sec=wake/1000000;
+                ts.tv_nsec=wake%1000000*1000;
+                if(SYSCALL(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL)) || wake<start)
+                    continue;
+            }
+            sent+=pipeline;
+        }
+        else
+            start=now_us();
+
+        //按权重选出这次发哪个请求，报文早已构造好(有变量时在这里填入)，正文直接从映射的文件发出
+        e=workload_pick();
+        request_prepare(e,tbuf,&m);
+
+        //长连接空闲超过--idle-timeout就不再用了，重新连接
+        if(s>=0 && idle_timeout>0 && now_us()-idle_since>=idle_timeout*1000LL)
+        {
+            close_conn(s,&t);
+            s=-1;
+        }
+
+        //建立到目的网站的tcp连接,发送http请求
+        //长连接时只有还没有连接或者上一个连接被关闭了才需要重新连接
+        if(s<0)
+        {
+            phase=now_us();
+            s=connect_timed(next_addr());
+
+            //连接失败，测试时间到了的不算
+            if(s<0)
+            {
+                if(run_over(now_us()))
+                    continue;
+                request_fail(e,1);//失败次数+1
+                connect_error(errno);
+                continue;
+            }
+            phase_record(&hs->connect_time,phase);
+            rcvto=sndto=0;
+
+            //https://：连上之后先握手，握手失败这个请求就失败了
+            if(tls && ((t=tls_new(s))==NULL || handshake_timed(s,t,&rcvto,request_deadline(now_us()))))
+            {
+                if(t==NULL)
+                    st->tls_failed++;
+                fork_fail(e,1,NULL);
+                close_conn(s,&t);
+                s=-1;
+                continue;
+            }
+        }
+
         //发出请求报文
-        if(rlen!=write(s,req,rlen))//write函数会返回实际写入的字节数
+        if(send_request(s,t,e,&m,iov,&sndto,request_deadline(now_us())))
         {
-            failed++;//实际写入的字节数和请求报文字节数不相同，写失败，发送1失败次数+1
-            send_failed++;
-            close(s);//写失败了也不要忘记关闭套接字
+            fork_fail(e,1,&st->send_failed);//写失败，发送失败次数+1
+            close_conn(s,&t);//写失败了也不要忘记关闭套接字
+            s=-1;
             continue;
         }
 
@@ -587,29 +1984,121 @@ nexttry:
          *当这个写一定是可以关闭的，因为客户端也不需要写，只需要读
          *因此，我们主动破坏套接字的写，但这不是关闭套接字，关闭还是得用close
         */
-        if(http10==0)
+        if(http10==0 && t==NULL)
         {
-            if(shutdown(s,1))//1表示关闭写 关闭成功返回0，出错返回-1
+            if(SYSCALL(shutdown(s,1)))//1表示关闭写 关闭成功返回0，出错返回-1
             {
-                failed++;//关闭出错，失败次数+1
-                wclose_failed++;
-                close(s);//关闭套接字
+                request_fail(e,1);//关闭出错，失败次数+1
+                st->wclose_failed++;
+                close_conn(s,&t);//关闭套接字
+                s=-1;
                 continue;
             }
         }
 
+        //请求发完了，开始等第一个字节
+        phase=now_us();
+        deadline=request_deadline(phase);
+        http_resp_init(&resp,entries[e].head);
+
+        //长连接：读完发出去的每个请求的回复，连接留给下一批请求
+        if(keepalive)
+        {
+            inflight=pipeline;
+            first=1;
+
+            while(inflight>0)
+            {
+                i=recv_timed(s,t,buf,bufsize,&resp,&discard,&rcvto,deadline);
+
+                //超过了--timeout，还没收到回复的请求都算超时
+                if(i<0 && errno==ETIMEDOUT)
+                {
+                    fork_fail(e,inflight,NULL);
+                    close_conn(s,&t);
+                    s=-1;
+                    goto nexttry;
+                }
+
+                //对端关闭时回复正好完整，算一次成功
+                if(i==0 && http_resp_eof(&resp))
+                {
+                    if(!first)
+                        phase_record(&hs->transfer,phase);
+                    request_done(e,start,1,&resp);
+                    inflight--;
+                    resp.close=1;
+                    break;
+                }
+
+                //读取出错或者回复不完整，还没收到回复的请求都算读取失败
+                if(i<=0)
+                    break;
+
+                request_bytes(e,i);
+
+                if(first)
+                {
+                    phase_record(&hs->ttfb,phase);
+                    phase=now_us();
+                    first=0;
+                }
+
+                if(discard)
+                    i=http_resp_skip(&resp,i,&inflight);
+                else
+                    i=http_resp_feed(&resp,buf,i,&inflight);
+
+                //回复格式错误，连接上的数据已经对不齐了
+                if(i<0)
+                    break;
+
+                if(i>0)
+                    request_done(e,start,i,&resp);
+                if(inflight==0)
+                    phase_record(&hs->transfer,phase);
+
+                //服务器要求关闭，后面的请求不会有回复了
+                if(resp.state==RESP_DONE && resp.close)
+                    break;
+            }
+
+            if(inflight>0)
+            {
+                request_fail(e,inflight);
+                st->read_failed+=inflight;
+                close_conn(s,&t);
+                s=-1;
+                goto nexttry;
+            }
+
+            //服务器没有要求关闭，连接留给下一批请求
+            if(!resp.close)
+            {
+                idle_since=now_us();
+                continue;
+            }
+
+            if(close_conn(s,&t))
+            {
+                request_fail(e,1);
+                st->sclose_failed++;
+            }
+            s=-1;
+            continue;
+        }
         //foece=0 默认需要等待服务器回复
-        if(force==0)
+        else if(force==0)
         {
+            inflight=1;
+            first=1;
+
             //从套接字读取所有服务器回复的数据
             while(1)
             {
-                //超时标志为1，不再读取服务器回复的数据
-                if(timeout)
-                    break;
-
-                //读取套接字中1500个字节数据到buf数组中
-                i=read(s,buf,1500);//如果套接字中数据小于要读取的字节数1500会引起阻塞 返回-1
+                //读取套接字中bufsize个字节数据到buf数组中，--drain时正文直接在内核里丢掉
+                //如果套接字中没有数据会引起阻塞，最多等到期限
+                i=recv_timed(s,t,buf,bufsize,&resp,&discard,&rcvto,deadline);
 
                 //read返回值：
 
@@ -618,21 +2107,39 @@ nexttry:
                 //阻塞             返回   -1
 
 
-                //读取阻塞了
+                //读取出错或者超时了
                 if(i<0)
                 {
-                    failed++;       //失败次数+1
-                    read_failed++;
-                    close(s);       //关闭套接字，不然失败次数多会严重浪费资源
+                    fork_fail(e,1,&st->read_failed);  //失败次数+1
+                    close_conn(s,&t);       //关闭套接字，不然失败次数多会严重浪费资源
+                    s=-1;
                     goto nexttry;   //这次失败了那么继续请求下一次连接和发出请求
                 }
                 //读取成功
                 else
                 {
                     if(i==0)
+                    {
+                        //回复读完了
+                        if(!first)
+                            phase_record(&hs->transfer,phase);
+                        http_resp_end(&resp);
                         break;//没有读取到任何字节数
+                    }
+
+                    request_bytes(e,i);//从服务器读取到的总字节数增加
+
+                    //解析状态码，格式错误时回复按不完整处理
+                    if(discard)
+                        http_resp_skip(&resp,i,&inflight);
                     else
-                        bytes+=i;//从服务器读取到的总字节数增加
+                        http_resp_feed(&resp,buf,i,&inflight);
+                    if(first)
+                    {
+                        phase_record(&hs->ttfb,phase);
+                        phase=now_us();
+                        first=0;
+                    }
                 }
             }
         }
@@ -646,15 +2153,17 @@ nexttry:
         */
 
         //套接字关闭失败
-        if(close(s))
+        i=close_conn(s,&t);
+        s=-1;
+        if(i)
         {
-            failed++;//没有成功得到服务器响应的子进程数量
-            sclose_failed++;
+            request_fail(e,1);//没有成功得到服务器响应的子进程数量
+            st->sclose_failed++;
             continue;
         }
 
-        //套接字关闭成功 成功得到服务器响应的子进程数量+1
-        speed++;
+        //套接字关闭成功 成功得到服务器响应的子进程数量+1，回复没有通过检查的算失败
+        request_done(e,start,1,&resp);
     }
 }
 
@@ -678,6 +2187,8 @@ void build_request(const char *url)
 {
     //存放端口号的中间数组
     char tmp[10];
+    //IPv6地址结尾的方括号
+    const char *tmp2;
     //存放url中主机名开始的位置
     int i;
 
@@ -688,15 +2199,19 @@ void build_request(const char *url)
 
     //判断应该使用的http协议
 
-    //1.缓存和代理都是都是http/1.0以后才有到的
-    if(force_reload && proxyhost!=NULL && http10<1)
+    //1.长连接是http/1.0后才有的，http/0.9靠关闭连接结束回复
+    if(keepalive && http10<1)
         http10=1;
 
     //2.head请求是http/1.0后才有的
     if(method==METHOD_HEAD && http10<1)
         http10=1;
 
-    //3.options请求和reace请求都是http/1.1才有
+    //3.post和put请求的正文要靠Content-Length确定长度，http/1.0后才有
+    if((method==METHOD_POST || method==METHOD_PUT) && http10<1)
+        http10=1;
+
+    //4.options请求和reace请求都是http/1.1才有
     if(method==METHOD_OPTIONS && http10<2)
         http10=2;
     if(method==METHOD_TRACE && http10<2)
@@ -706,22 +2221,7 @@ void build_request(const char *url)
 
 
     //填充请求方法到请求行
-    switch(method)
-    {
-    default:
-    case METHOD_GET:
-        strcpy(request,"GET");
-        break;
-    case METHOD_HEAD:
-        strcpy(request,"HEAD");
-        break;
-    case METHOD_OPTIONS:
-        strcpy(request,"OPTIONS");
-        break;
-    case METHOD_TRACE:
-        strcpy(request,"TRACE");
-        break;
-    }
+    strcpy(request,method_names[method]);
 
     //按照请求报文格式在请求方法后填充一个空格
     strcat(request," ");
@@ -741,11 +2241,20 @@ void build_request(const char *url)
         exit(2);
     }
 
-    //3.若无代理服务器，则只支持http协议
+    //3.若无代理服务器，则只支持http和https协议
     if(proxyhost==NULL)
     {
-        //忽略字母大小写比较前7位
-        if (0!=strncasecmp("http://",url,7))
+        //忽略字母大小写比较前7位，https://的默认端口是443
+        tls=0==strncasecmp("https://",url,8);
+        if(tls)
+        {
+#ifndef WEBBENCH_TLS
+            fprintf(stderr,"\n %s: this webbench was built without TLS support, rebuild with make TLS=1\n",url);
+            exit(2);
+#endif
+            proxyport=443;
+        }
+        else if (0!=strncasecmp("http://",url,7))
         {
             fprintf(stderr,"\n URL can't be parsed, need it or not, but don't choose to use proxy server\n");
             usage();
@@ -772,8 +2281,28 @@ void build_request(const char *url)
     //无代理时
     if(proxyhost==NULL)
     {
+        //IPv6地址写在方括号里 比如http://[::1]:8080/
+        if(url[i]=='[')
+        {
+            tmp2=strchr(url+i,']');
+            if(tmp2==NULL || tmp2>strchr(url+i,'/') || tmp2==url+i+1)
+            {
+                fprintf(stderr,"\n URL illegal: bad IPv6 address \n");
+                exit(2);
+            }
+
+            //host中不带方括号，方括号只在Host字段中需要
+            strncpy(host,url+i+1,tmp2-url-i-1);
+
+            if(tmp2[1]==':')
+            {
+                proxyport=atoi(tmp2+2);
+                if(proxyport==0)
+                    proxyport=tls?443:80;
+            }
+        }
         //存在端口号 比如http://www.baidu.com:80/
-        if(index(url+i,':')!=NULL && index(url+i,':')<index(url+i,'/'))
+        else if(index(url+i,':')!=NULL && index(url+i,':')<index(url+i,'/'))
         {
             //填充主机名到host字符数组，比如www.baidu.com
             strncpy(host,url+i,strchr(url+i,':')-url-i);
@@ -788,9 +2317,9 @@ void build_request(const char *url)
             //设置端口号 atoi将字符串转整型
             proxyport=atoi(tmp);
 
-            //避免写了';'却没有写端口号，这种情况下默认设置端口号为80
+            //避免写了';'却没有写端口号，这种情况下默认设置端口号为80(https为443)
             if(proxyport==0)
-                proxyport=80;
+                proxyport=tls?443:80;
         }
         //不存在端口号
         else
@@ -814,6 +2343,10 @@ void build_request(const char *url)
         strcat(request,url);
     }
 
+    //-r：查询参数里加上序号，每个请求都是缓存里没有的新URL，缓存和代理都绕不过去
+    if(force_reload)
+        strcat(request,strchr(request,'?')!=NULL?"&_wb={{seq}}":"?_wb={{seq}}");
+
     //填充http协议版本到请求报文的请求行
     if(http10==1)
         strcat(request," HTTP/1.0");
@@ -834,27 +2367,48 @@ void build_request(const char *url)
     if(proxyhost==NULL && http10>0)
     {
         strcat(request,"Host: ");
-        strcat(request,host);//Host字段填充的是主机名或者IP
+        //Host字段填充的是主机名或者IP，IPv6地址要加上方括号
+        if(strchr(host,':')!=NULL)
+        {
+            strcat(request,"[");
+            strcat(request,host);
+            strcat(request,"]");
+        }
+        else
+            strcat(request,host);
         strcat(request,"\r\n");
     }
 
-    /*pragma是http/1.1之前版本的历史遗留问题，仅作为与http的向后兼容而定义
-    规范定义的唯一形式：
-    Pragma:no-cache
-    若选择强制重新加载，则选择无缓存
-    */
-    if(force_reload && proxyhost!=NULL)
+    //--header给出的报头，长度在解析选项时已经限制过
+    if(http10>0)
     {
-        strcat(request,"Pragma: no-cache\r\n");
+        for(i=0; i<nheaders; i++)
+        {
+            strcat(request,headers[i]);
+            strcat(request,"\r\n");
+        }
     }
 
-    /*我们的目的是构造请求给网站，不需要传输任何内容，所以不必用长连接
+    /*不复用连接时，我们的目的是构造请求给网站，不需要传输任何内容，所以不必用长连接
     http/1.1默认Keep-alive(长连接）
     所以需要当http版本为http/1.1时要手动设置为 Connection: close
+    选择了长连接时http/1.1什么都不用加，http/1.0要显式要求keep-alive
     */
-    if(http10>1)
+    if(keepalive)
+    {
+        if(http10==1)
+            strcat(request,"Connection: keep-alive\r\n");
+    }
+    else if(http10>1)
         strcat(request,"Connection: close\r\n");
 
+    //上传的正文不放在request里，发送时直接从映射的文件发出，这里只写长度和类型
+    if(method==METHOD_POST || method==METHOD_PUT)
+    {
+        sprintf(request+strlen(request),"Content-Type: %s\r\nContent-Length: %lld\r\n",
+                content_type,body_len);
+    }
+
     //在末尾填入空行
     if(http10>0)
         strcat(request,"\r\n");
@@ -0,0 +1,470 @@
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+/*
+
+多URL加权负载：
+
+真实的流量分散在很多个接口上，只压一个URL看不出是哪个接口拖慢了服务器
+--workload <file> 每行描述一个请求：
+
+    [权重] [方法] URL
+
+    # 井号开头的行和空行被忽略
+    10 GET  http://example.com/index.html
+    3       http://example.com/api/list      省略方法时用命令行的-G/-H/-O
+    1 HEAD  http://example.com/static/a.js
+    http://example.com/health                省略权重时为1
+
+所有URL必须是同一个主机和端口，地址只在开始时解析一次，长连接也在不同的条目之间复用
+没有--workload时，命令行的URL就是唯一的一个条目
+
+开始时把每个条目的请求报文构造好，连续地放在一块内存(arena)里
+流水线时每个条目放pipeline份，一次发出
+测试过程中每个请求只是按权重抽一个条目，取出它的偏移和长度，不再有任何字符串操作
+
+按权重抽样用别名法(alias method)：
+预先把每个条目的权重切分到n个等宽的格子里，每个格子最多属于两个条目
+抽样时随机选一个格子，再用一个随机数决定是格子本身的条目还是它的别名
+不管有多少个条目，每次抽样都是常数时间
+
+每个条目单独统计成功数、失败数、字节数和延迟，结果中逐条列出
+
+POST/PUT的正文(--body)：
+正文可能有几十兆，不能每个请求拷贝一次，也放不进request
+开始时把文件mmap一次，fork出的子进程都共用这一份映射
+arena里只放报头，发送时用writev把报头和正文(流水线时是多组)一次交给内核：
+
+    iov[0] 报头(arena中)  iov[1] 正文(映射的文件)  iov[2] 报头  iov[3] 正文 ...
+
+客户端不碰正文的内容，正文越大，每个字节的CPU开销越小
+
+*/
+
+//一个条目
+struct entry
+{
+    int off;        //请求报文在arena中的偏移
+    int len;        //要发送的总长度，流水线时是pipeline份的总长度
+    int hlen;       //有正文时一份报头的长度，arena中只放一份
+    int blen;       //正文的长度，没有正文时为0
+    int method;     //请求方法
+    int head;       //HEAD请求，回复没有正文
+    int tmpl;       //报文中有变量时是它的模板，-1表示报文是固定的
+    double weight;  //权重
+    char *url;
+};
+
+//一次发送的报文：固定的报文就是arena里构造好的，有变量时是渲染出来的
+struct request_msg
+{
+    const char *head;//报头，流水线时是pipeline份连在一起
+    int hlen;       //报头的长度
+    int len;        //报头和正文的总长度
+};
+
+//一个条目的测试结果，每个子进程一份
+struct entry_stats
+{
+    long long speed;        //成功的请求数
+    long long failed;       //失败的请求数
+    long long bytes;        //读取到的字节数
+    long long latency_sum;  //成功请求的延迟之和，单位微秒
+    long long latency_max;  //成功请求的最大延迟
+};
+
+char *workload_file=NULL;    //--workload指定的文件，NULL表示只有命令行的一个URL
+char *arena;                 //所有条目的请求报文
+int arena_len=0;
+struct entry *entries;       //所有条目
+int nentries=0;
+struct entry_stats *entry_slots;//父子进程共享，每个子进程nentries个
+struct entry_stats *est;     //子进程自己的那nentries个
+
+char *body_file=NULL;         //--body指定的文件
+char *body=NULL;              //映射到内存的正文
+long long body_len=0;         //正文的长度
+char *content_type="application/octet-stream";
+
+static double *alias_prob;   //别名表：第i个格子属于条目i的概率
+static int *alias;           //别名表：第i个格子的另一个条目
+static unsigned long long rng;//子进程自己的随机数状态
+
+//只在开始时调用，失败时直接退出
+static void *workload_realloc(void *p,size_t size)
+{
+    p=realloc(p,size);
+    if(p==NULL)
+    {
+        perror(" Failed to build workload ");
+        exit(3);
+    }
+    return p;
+}
+
+//把--body的文件映射到内存，失败时退出
+static void body_load(const char *path)
+{
+    struct stat sb;
+    int fd;
+
+    fd=open(path,O_RDONLY);
+    if(fd<0 || fstat(fd,&sb))
+    {
+        perror(" Failed to open body file ");
+        exit(2);
+    }
+
+    //流水线时每个请求两个iovec，一次writev的iovec个数有上限
+    if(2*pipeline>sysconf(_SC_IOV_MAX))
+    {
+        fprintf(stderr,"Pipeline depth %d is too large for requests with a body\n",pipeline);
+        exit(2);
+    }
+
+    //每个请求的总长度要放得进int
+    if(sb.st_size>=INT_MAX/2/pipeline)
+    {
+        fprintf(stderr,"Body file %s is too large\n",path);
+        exit(2);
+    }
+
+    body_len=sb.st_size;
+    if(body_len>0)
+    {
+        body=mmap(NULL,body_len,PROT_READ,MAP_SHARED,fd,0);
+        if(body==MAP_FAILED)
+        {
+            perror(" Failed to map body file ");
+            exit(2);
+        }
+
+        //提前读进页缓存，测试开始后不用等磁盘
+        madvise(body,body_len,MADV_WILLNEED);
+    }
+
+    close(fd);
+}
+
+//构造一个条目的请求报文，追加到arena中
+static void workload_add(const char *url,int m,double weight)
+{
+    static char first_host[MAXHOSTNAMELEN];
+    static int first_port,first_tls;
+    struct entry *e;
+    int saved_method=method,saved_http=http10;
+    int len,i;
+
+    //build_request()按方法调整http版本、按URL设置主机和端口
+    //每个条目都从命令行的设置开始，互不影响
+    method=m;
+    if(proxyhost==NULL)
+        proxyport=80;
+    build_request(url);
+    http10=saved_http;
+    method=saved_method;
+
+    //同一个主机和端口才能共用解析好的地址和长连接
+    if(nentries==0)
+    {
+        strcpy(first_host,host);
+        first_port=proxyport;
+        first_tls=tls;
+    }
+    else if(strcmp(first_host,host)!=0 || first_port!=proxyport || first_tls!=tls)
+    {
+        fprintf(stderr,"Workload error,%s: all URLs must use the same scheme,host and port as the first one\n",url);
+        exit(2);
+    }
+
+    entries=workload_realloc(entries,sizeof(struct entry)*(nentries+1));
+    e=&entries[nentries++];
+
+    len=strlen(request);
+    e->off=arena_len;
+    e->method=m;
+    e->head=(m==METHOD_HEAD);
+    e->tmpl=-1;
+    e->weight=weight;
+    e->url=strdup(url);
+
+    //有正文的请求arena里只放一份报头，发送时和正文交替组成iovec
+    if(m==METHOD_POST || m==METHOD_PUT)
+    {
+        e->hlen=len;
+        e->blen=body_len;
+        e->len=(len+body_len)*pipeline;
+
+        arena=workload_realloc(arena,arena_len+len+1);
+        memcpy(arena+arena_len,request,len);
+        arena_len+=len;
+        arena[arena_len]='\0';
+        return;
+    }
+
+    //流水线时把请求报文重复pipeline次，一次write全部发出
+    e->hlen=e->len=len*pipeline;
+    e->blen=0;
+
+    arena=workload_realloc(arena,arena_len+e->len+1);
+    for(i=0; i<pipeline; i++)
+        memcpy(arena+arena_len+i*len,request,len);
+    arena_len+=e->len;
+    arena[arena_len]='\0';
+}
+
+//方法名对应的编号，不认识返回-1
+static int workload_method(const char *s)
+{
+    int i;
+
+    for(i=0; i<(int)(sizeof(method_names)/sizeof(method_names[0])); i++)
+        if(strcasecmp(s,method_names[i])==0)
+            return i;
+    return -1;
+}
+
+//读取--workload文件，格式错误时退出
+static void workload_load(const char *path)
+{
+    FILE *f;
+    char line[2048],*tok[3],*p,*end;
+    int n,lineno=0,k,m;
+    double w;
+
+    f=fopen(path,"r");
+    if(f==NULL)
+    {
+        perror(" Failed to open workload file ");
+        exit(2);
+    }
+
+    while(fgets(line,sizeof(line),f)!=NULL)
+    {
+        lineno++;
+
+        //最多三个字段：权重 方法 URL
+        n=0;
+        for(p=strtok(line," \t\r\n"); p!=NULL && n<3; p=strtok(NULL," \t\r\n"))
+            tok[n++]=p;
+        if(n==0 || tok[0][0]=='#')
+            continue;
+
+        k=0;
+        w=1;
+        m=method;
+
+        //第一个字段是数字就是权重
+        if(n>1)
+        {
+            w=strtod(tok[0],&end);
+            if(*end=='\0')
+                k++;
+            else
+                w=1;
+        }
+        if(n-k>1)
+        {
+            m=workload_method(tok[k]);
+            if(m<0)
+            {
+                fprintf(stderr,"Workload error,%s:%d: unknown method %s\n",path,lineno,tok[k]);
+                exit(2);
+            }
+            k++;
+        }
+        if(n-k!=1 || p!=NULL)
+        {
+            fprintf(stderr,"Workload error,%s:%d: expected [weight] [method] URL\n",path,lineno);
+            exit(2);
+        }
+        if(!(w>0))
+        {
+            fprintf(stderr,"Workload error,%s:%d: weight must be positive\n",path,lineno);
+            exit(2);
+        }
+
+        workload_add(tok[k],m,w);
+    }
+
+    fclose(f);
+
+    if(nentries==0)
+    {
+        fprintf(stderr,"Workload error,%s: no requests\n",path);
+        exit(2);
+    }
+}
+
+//按权重建立别名表(Vose的做法)
+static void workload_alias(void)
+{
+    double sum=0,*p;
+    int *small,*large;
+    int ns=0,nl=0,i,s,l;
+
+    alias_prob=workload_realloc(NULL,sizeof(double)*nentries);
+    alias=workload_realloc(NULL,sizeof(int)*nentries);
+    p=workload_realloc(NULL,sizeof(double)*nentries);
+    small=workload_realloc(NULL,sizeof(int)*nentries);
+    large=workload_realloc(NULL,sizeof(int)*nentries);
+
+    for(i=0; i<nentries; i++)
+        sum+=entries[i].weight;
+
+    //每个格子的宽度是1，权重按比例换算成格子数
+    for(i=0; i<nentries; i++)
+    {
+        p[i]=entries[i].weight*nentries/sum;
+        if(p[i]<1)
+            small[ns++]=i;
+        else
+            large[nl++]=i;
+    }
+
+    //不满一格的条目用一个超过一格的条目补满，补的那个就是别名
+    while(ns>0 && nl>0)
+    {
+        s=small[--ns];
+        l=large[--nl];
+        alias_prob[s]=p[s];
+        alias[s]=l;
+        p[l]-=1-p[s];
+        if(p[l]<1)
+            small[ns++]=l;
+        else
+            large[nl++]=l;
+    }
+
+    //剩下的由于舍入误差只差一点点，都算整格
+    while(nl>0)
+    {
+        l=large[--nl];
+        alias_prob[l]=1;
+        alias[l]=l;
+    }
+    while(ns>0)
+    {
+        s=small[--ns];
+        alias_prob[s]=1;
+        alias[s]=s;
+    }
+
+    free(p);
+    free(small);
+    free(large);
+}
+
+//子进程开始测试前调用，每个子进程的随机数序列不同
+static void workload_start(int id)
+{
+    rng=(unsigned long long)now_us()^((unsigned long long)(id+1)*0x9E3779B97F4A7C15ULL);
+    if(rng==0)
+        rng=1;
+    est=&entry_slots[id*nentries];
+}
+
+//子进程自己的随机数，xorshift64*
+static unsigned long long workload_rand(void)
+{
+    rng^=rng>>12;
+    rng^=rng<<25;
+    rng^=rng>>27;
+    return rng*0x2545F4914F6CDD1DULL;
+}
+
+//按权重抽下一个请求的条目
+static int workload_pick(void)
+{
+    unsigned long long r;
+    int i;
+
+    if(nentries==1)
+        return 0;
+
+    //高32位选格子，低32位决定是不是别名
+    r=workload_rand();
+
+    i=(int)((r>>32)%(unsigned)nentries);
+    if((r&0xffffffffULL)<alias_prob[i]*4294967296.0)
+        return i;
+    return alias[i];
+}
+
+//汇总从第first个开始的nslots个槽位中第e个条目的结果
+static void workload_sum(struct entry_stats *dst,int e,int first,int nslots)
+{
+    const struct entry_stats *s;
+    int i;
+
+    memset(dst,0,sizeof(*dst));
+    for(i=first; i<first+nslots; i++)
+    {
+        s=&entry_slots[i*nentries+e];
+        dst->speed+=s->speed;
+        dst->failed+=s->failed;
+        dst->bytes+=s->bytes;
+        dst->latency_sum+=s->latency_sum;
+        if(s->latency_max>dst->latency_max)
+            dst->latency_max=s->latency_max;
+    }
+}
+
+//逐条打印每个条目的结果，只算从第first个开始的nslots个槽位
+static void workload_print(int first,int nslots)
+{
+    struct entry_stats s;
+    int i;
+
+    printf("Per-entry results:\n");
+    printf("%6s %10s %10s %8s %12s %10s %10s  %s\n",
+           "weight","requests","req/s","failed","bytes/s","mean ms","max ms","request");
+    for(i=0; i<nentries; i++)
+    {
+        workload_sum(&s,i,first,nslots);
+        printf("%6g %10lld %10lld %8lld %12lld %10.3f %10.3f  %s %s\n",
+               entries[i].weight,s.speed,s.speed/benchtime,s.failed,s.bytes/benchtime,
+               s.speed?s.latency_sum/(double)s.speed/1000.0:0.0,s.latency_max/1000.0,
+               method_names[entries[i].method],entries[i].url);
+    }
+}
+
+//一个请求最多要用的iovec个数
+#define REQUEST_IOV (2*pipeline)
+
+//第e个条目的报文m从第sent个字节开始还没发出的部分，填到iov中，返回用了几个iovec
+static int request_iov(const struct entry *e,const struct request_msg *m,int sent,struct iovec *iov)
+{
+    int n=0,i;
+
+    if(e->blen==0)
+    {
+        iov[0].iov_base=(char *)m->head+sent;
+        iov[0].iov_len=m->len-sent;
+        return 1;
+    }
+
+    //报头和正文交替，跳过已经发出的部分
+    for(i=0; i<pipeline; i++)
+    {
+        if(sent>=m->hlen)
+            sent-=m->hlen;
+        else
+        {
+            iov[n].iov_base=(char *)m->head+sent;
+            iov[n++].iov_len=m->hlen-sent;
+            sent=0;
+        }
+
+        if(sent>=e->blen)
+            sent-=e->blen;
+        else
+        {
+            iov[n].iov_base=body+sent;
+            iov[n++].iov_len=e->blen-sent;
+            sent=0;
+        }
+    }
+
+    return n;
+}